@@ -1,6 +1,11 @@
 /*
 *   TODO:
 *   - complex root finder using Newton's method = DONE
+*   - Halley and damped Newton steps, iteration budgets = DONE
+*   - all roots of a polynomial at once (Aberth-Ehrlich) = DONE
+*   - parallel Newton basin renderer = DONE
+*   - Newton's method for systems of equations = DONE
+*   - multi-start search for all roots of a function = DONE
 */
 
 #include <stdlib.h>
@@ -8,20 +13,88 @@
 #include <math.h>
 #include <complex.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <time.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <ctype.h>
+
+#define MAX_NEWTON_ITER 100
+#define MAX_DAMPING_STEPS 30
+#define NEWTON_DZ 1e-4
+#define MAX_ABERTH_ITER 500
+#define LANE_COUNT 4
+#define BATCH_COUNT 2000
+#define BATCH_DEGREE 30
+#define MAX_THREADS 256
+#define MAX_IMAGE_SIDE 65536
+#define MAX_DEGREE 64
+#define SYSTEM_LEN 200
+#define ROOT_HASH_LEN 4096
+#define MAX_ROOTS 1024
+#define MULTI_SPAN 10.0
+#define BASIN_TILE 32
+#define BASIN_SPAN 8.0
+#define BASIN_ROOT_TOL 1e-4
+#define BASIN_SHADE_ITER 32
+#define BASIN_COLOR_COUNT 8
+#define EXPR_MAX_CODE 128
+#define EXPR_MAX_REGS 128
+#define EXPR_MAX_DEPTH 64
+#define EXPR_MAX_POWI 64
+#define EXPR_BATCH_LEN 128
+#define USAGE "Usage: ./ch13 [-j THREADS] [-s WIDTH HEIGHT] [-p COEFFS] " \
+              "[-o FILE | -f EXPR [-g RE IM | -m]]\n"
 
 typedef double complex doubleC;
 
+// Parts of LANE_COUNT roots side by side, and the comparison masks they
+// produce (all ones for true)
+typedef double Lanes __attribute__((vector_size(LANE_COUNT*sizeof(double))));
+typedef int64_t Lanes_Mask
+    __attribute__((vector_size(LANE_COUNT*sizeof(int64_t))));
+
 typedef enum {
     
     SUCCESS = 0,
     UNDEFINED = 1,
-    UNSTABLE = 2
+    UNSTABLE = 2,
+    NO_CONVERGENCE = 3
 } Error_Type;
 
+// value is f'(z). The stencil used for it also gives f(z) and f''(z) for free,
+// so they are returned too and callers need not evaluate f again.
 typedef struct Cmpl_Deriv_Result Cmpl_Deriv_Result;
 struct Cmpl_Deriv_Result {
 
     doubleC value;
+    doubleC f_value;
+    doubleC second;
+    Error_Type error;
+};
+
+// Cmpl_Deriv_Result in the other floating point types
+typedef Cmpl_Deriv_Result Cmpl_Deriv_Result_d;
+
+typedef struct Cmpl_Deriv_Result_f Cmpl_Deriv_Result_f;
+struct Cmpl_Deriv_Result_f {
+
+    float complex value;
+    float complex f_value;
+    float complex second;
+    Error_Type error;
+};
+
+typedef struct Cmpl_Deriv_Result_ld Cmpl_Deriv_Result_ld;
+struct Cmpl_Deriv_Result_ld {
+
+    long double complex value;
+    long double complex f_value;
+    long double complex second;
     Error_Type error;
 };
 
@@ -30,102 +103,529 @@ struct Newton_Root_Result {
 
     doubleC value;
     Error_Type error;
+    size_t iterations;
+    size_t evaluations;
 };
 
+typedef struct Newton_Root_Result_f Newton_Root_Result_f;
+struct Newton_Root_Result_f {
 
-// Given z = x + iy and f(z) = u(x,y) + iv(x,y), computes f'(z) as:
-// du/dx + i*dv/dx with both derivatives evaluated at z_0
-Cmpl_Deriv_Result 
-cmpl_deriv(doubleC(*f)(const doubleC), const doubleC z, const double dz) {
-    
-    const double h = fabs(dz/2);
-
-    const doubleC f1 = f(z - 2*(doubleC)h);
-    const doubleC f2 = f(z - (doubleC)h);
-    const doubleC f3 = f(z);
-    const doubleC f4 = f(z + (doubleC)h);
-    const doubleC f5 = f(z + 2*(doubleC)h);
-
-    const double u1 = creal(f1);
-    const double u2 = creal(f2);
-    const double u3 = creal(f3);
-    const double u4 = creal(f4);
-    const double u5 = creal(f5);
-
-    const double v1 = cimag(f1);
-    const double v2 = cimag(f2);
-    const double v3 = cimag(f3);
-    const double v4 = cimag(f4);
-    const double v5 = cimag(f5);
-
-    Cmpl_Deriv_Result result = {0, SUCCESS};
-    
-    const double dudx = (u1 - 8*u2 + 8*u4 - u5) / (12*h);
-    const double dvdx = (v1 - 8*v2 + 8*v4 - v5) / (12*h);
+    float complex value;
+    Error_Type error;
+    size_t iterations;
+    size_t evaluations;
+};
 
-    if (isnan(dudx) || isinf(dudx) || isnan(dvdx) || isinf(dvdx) ||
-        isnan(u3) || isinf(u3) || isnan(v3) || isinf(v3)) {
+typedef struct Newton_Root_Result_ld Newton_Root_Result_ld;
+struct Newton_Root_Result_ld {
 
-        result.error = UNDEFINED;
-        return result;
-    }
-    
-    result.value = (doubleC)dudx + I*(doubleC)dvdx;
+    long double complex value;
+    Error_Type error;
+    size_t iterations;
+    size_t evaluations;
+};
 
-    const bool u_monotonic = (u1 < u2 && u2 < u3 && u3 < u4 && u4 < u5) ||
-                             (u1 > u2 && u2 > u3 && u3 > u4 && u4 > u5);
-    const bool v_monotonic = (v1 < v2 && v2 < v3 && v3 < v4 && v4 < v5) ||
-                             (v1 > v2 && v2 > v3 && v3 > v4 && v4 > v5);
+// Picks name_f, name_d or name_ld by the type of the function f, since
+// literals such as 1 + I are float complex whatever the caller means
+#define CMPL_GENERIC(name, f) \
+    _Generic((f), float complex (*)(const float complex): name##_f, \
+             doubleC (*)(const doubleC): name##_d, \
+             long double complex (*)(const long double complex): name##_ld)
 
-    if (u_monotonic && v_monotonic) { 
-        return result;
-    }
-    
-    const bool u_right_hump = (u4 > u3 && u4 > u5) || (u4 < u3 && u4 < u5);
-    const bool u_left_hump = (u2 > u1 && u2 > u3) || (u2 < u1 && u2 < u3); 
+typedef enum {
 
-    if (u_right_hump) {
-        
-        if (u_left_hump || fabs(2*u4 - u3 - u5) > fabs(u3 - u1)) { 
-            
-            result.error = UNSTABLE;
-            return result;
-        }
-    }
+    NEWTON = 0,
+    DAMPED_NEWTON = 1,
+    HALLEY = 2
+} Root_Method;
 
-    if (u_left_hump) {
-        
-        if (u_right_hump || fabs(2*u2 - u1 - u3) > fabs(u5 - u3)) {
-            
-            result.error = UNSTABLE;
-            return result;
-        }
-        
-    }
+// Zero budgets mean no limit on that count. dz is the stencil step of
+// cmpl_deriv, or NEWTON_DZ scaled by |z| past 1 when zero. It is kept
+// apart from eps because the rounding error of the second derivative
+// Halley uses grows like DBL_EPSILON/dz^2. f_batch, if set, must compute
+// the same function as f on n points at once, and then gets the five
+// stencil points of each iteration in one call.
+typedef struct Newton_Options Newton_Options;
+struct Newton_Options {
 
-    const bool v_right_hump = (v4 > v3 && v4 > v5) || (v4 < v3 && v4 < v5);
-    const bool v_left_hump = (v2 > v1 && v2 > v3) || (v2 < v1 && v2 < v3); 
+    Root_Method method;
+    double eps;
+    double dz;
+    size_t max_iterations;
+    size_t max_evaluations;
+    void (*f_batch)(const size_t n, const doubleC zs[static n],
+                    doubleC ys[static n]);
+};
 
-    if (v_right_hump) {
-        
-        if (v_left_hump || fabs(2*v4 - v3 - v5) > fabs(v3 - v1)) { 
-            
-            result.error = UNSTABLE;
-            return result;
-        }
-    }
+typedef struct RGB_Pixel RGB_Pixel;
+struct RGB_Pixel {
+    uint8_t R;
+    uint8_t G;
+    uint8_t B;
+};
 
-    if (v_left_hump) {
-        
-        if (v_right_hump || fabs(2*v2 - v1 - v3) > fabs(v5 - v3)) {
-            
-            result.error = UNSTABLE;
-            return result;
-        }
-        
+typedef union Pixel Pixel;
+union Pixel {
+    RGB_Pixel rgb;
+    uint8_t gray;
+};
+
+typedef struct Image_Header Image_Header;
+struct Image_Header {
+    int16_t format;
+    size_t height;
+    size_t width;
+};
+
+static const RGB_Pixel BASIN_COLORS[BASIN_COLOR_COUNT] = {
+    {230, 25, 75}, {60, 180, 75}, {255, 225, 25}, {0, 130, 200},
+    {245, 130, 48}, {145, 30, 180}, {70, 240, 240}, {240, 50, 230}
+};
+
+typedef struct Poly_Roots_Result Poly_Roots_Result;
+struct Poly_Roots_Result {
+
+    Error_Type error;
+    size_t iterations;
+};
+
+// Scratch space of poly_roots, allocated once for polynomials up to
+// max_degree and reused across a batch
+typedef struct Aberth_Workspace Aberth_Workspace;
+struct Aberth_Workspace {
+
+    size_t max_degree;
+    double* re;
+    double* im;
+    double* next_re;
+    double* next_im;
+    int64_t* done;
+};
+
+// Shared by the threads of render_basins. Pixel (row, col) starts Newton's
+// method at x_min + col*pixel_size + i(y_max - row*pixel_size).
+typedef struct Basin_Job Basin_Job;
+struct Basin_Job {
+
+    size_t degree;
+    const doubleC* coeffs;
+    const doubleC* roots;
+    size_t width;
+    size_t height;
+    double x_min;
+    double y_max;
+    double pixel_size;
+    size_t max_iterations;
+    double eps;
+    Pixel* image;
+    atomic_size_t next_tile;
+};
+
+typedef enum {
+
+    OP_CONST,
+    OP_VAR,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_NEG,
+    OP_POW,
+    OP_POWI,
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_EXP,
+    OP_LOG,
+    OP_SQRT,
+    OP_ABS
+} Expr_Op;
+
+// dst = op(a, b) on registers; OP_CONST loads consts[a] and OP_POWI raises
+// register a to the literal power b
+typedef struct Expr_Instr Expr_Instr;
+struct Expr_Instr {
+
+    uint8_t op;
+    uint8_t dst;
+    uint8_t a;
+    uint8_t b;
+};
+
+// A formula compiled by expr_compile. The value ends up in register result.
+typedef struct Expr Expr;
+struct Expr {
+
+    size_t length;
+    size_t reg_count;
+    size_t const_count;
+    size_t result;
+    size_t error_pos;
+    Expr_Instr code[EXPR_MAX_CODE];
+    doubleC consts[EXPR_MAX_CODE];
+};
+
+typedef struct Expr_Parser Expr_Parser;
+struct Expr_Parser {
+
+    const char* src;
+    size_t pos;
+    size_t depth;
+    bool failed;
+    Expr* expr;
+};
+
+// Names an expression may use: the variable, constants and functions
+typedef struct Expr_Name Expr_Name;
+struct Expr_Name {
+
+    const char* name;
+    Expr_Op op;
+    doubleC value;
+};
+
+static const Expr_Name EXPR_NAMES[] = {
+    {"z", OP_VAR, 0},
+    {"i", OP_CONST, I},
+    {"pi", OP_CONST, M_PI},
+    {"e", OP_CONST, M_E},
+    {"sin", OP_SIN, 0},
+    {"cos", OP_COS, 0},
+    {"tan", OP_TAN, 0},
+    {"exp", OP_EXP, 0},
+    {"log", OP_LOG, 0},
+    {"sqrt", OP_SQRT, 0},
+    {"abs", OP_ABS, 0}
+};
+
+// The search region of find_roots is the rectangle with corners lower and
+// upper. Starting points come from a grid if grid is set and from a Halton
+// sequence otherwise.
+typedef struct Multi_Start_Options Multi_Start_Options;
+struct Multi_Start_Options {
+
+    doubleC lower;
+    doubleC upper;
+    bool grid;
+    size_t max_starts;
+    size_t round_len;
+    size_t patience;
+    double tol;
+    size_t thread_count;
+    Newton_Options newton;
+};
+
+typedef struct Multi_Start_Result Multi_Start_Result;
+struct Multi_Start_Result {
+
+    Error_Type error;
+    size_t root_count;
+    size_t starts;
+    size_t rounds;
+};
+
+// One round of starting points, shared by the threads of find_roots
+typedef struct Multi_Start_Job Multi_Start_Job;
+struct Multi_Start_Job {
+
+    doubleC (*f)(const doubleC);
+    const Newton_Options* newton;
+    const doubleC* seeds;
+    Newton_Root_Result* results;
+    size_t count;
+    atomic_size_t next;
+};
+
+// Open addressing table from grid cells to the roots in them. index holds
+// the position of the root plus one, zero marking an empty slot.
+typedef struct Root_Hash Root_Hash;
+struct Root_Hash {
+
+    int64_t cell[ROOT_HASH_LEN][2];
+    size_t index[ROOT_HASH_LEN];
+};
+
+typedef enum {
+
+    SYSTEM_NEWTON = 0,
+    SYSTEM_BROYDEN = 1
+} System_Method;
+
+// Evaluates F: R^n -> R^n at count points stored back to back in xs,
+// writing the values back to back to fxs. ctx is passed through.
+typedef void System_Func(const size_t n, const size_t count,
+                         const double xs[static count*n],
+                         double fxs[static count*n], void* ctx);
+
+typedef struct System_Options System_Options;
+struct System_Options {
+
+    System_Method method;
+    double eps;
+    size_t max_iterations;
+};
+
+// residual is |F(x)| at the returned x
+typedef struct System_Result System_Result;
+struct System_Result {
+
+    Error_Type error;
+    size_t iterations;
+    size_t evaluations;
+    double residual;
+};
+
+// Scratch space of solve_system for systems of n unknowns. jac, lu,
+// points, values, us and dxs are n by n; row k of us and dxs holds the
+// vectors of the k-th rank one update SYSTEM_BROYDEN makes.
+typedef struct System_Work System_Work;
+struct System_Work {
+
+    size_t n;
+    double* jac;
+    double* lu;
+    size_t* pivots;
+    double* points;
+    double* values;
+    double* us;
+    double* dxs;
+    double* fx;
+    double* step;
+    double* h_df;
+};
+
+// A complex value together with its complex derivative, so that a function
+// written with the cdual_* operations yields f(z) and f'(z) in one call
+typedef struct Cmpl_Dual Cmpl_Dual;
+struct Cmpl_Dual {
+
+    doubleC value;
+    doubleC deriv;
+};
+
+
+// Computes f'(z) and f''(z) from fs, the values of f at z - 2h, z - h, z,
+// z + h and z + 2h, as in cmpl_deriv
+//
+// Written once for the real type T, whose complex type is C, together with
+// cmpl_deriv below, and instantiated for float, double and long double.
+// RE, IM and ABS are the creal, cimag and fabs of T.
+#define DEFINE_CMPL_DERIV(T, C, S, RE, IM, ABS)                             \
+                                                                            \
+Cmpl_Deriv_Result_##S                                                       \
+cmpl_deriv_stencil_##S(const C fs[static 5], const T h) {                   \
+                                                                            \
+    const C f1 = fs[0];                                                     \
+    const C f2 = fs[1];                                                     \
+    const C f3 = fs[2];                                                     \
+    const C f4 = fs[3];                                                     \
+    const C f5 = fs[4];                                                     \
+                                                                            \
+    const T u1 = RE(f1);                                                    \
+    const T u2 = RE(f2);                                                    \
+    const T u3 = RE(f3);                                                    \
+    const T u4 = RE(f4);                                                    \
+    const T u5 = RE(f5);                                                    \
+                                                                            \
+    const T v1 = IM(f1);                                                    \
+    const T v2 = IM(f2);                                                    \
+    const T v3 = IM(f3);                                                    \
+    const T v4 = IM(f4);                                                    \
+    const T v5 = IM(f5);                                                    \
+                                                                            \
+    Cmpl_Deriv_Result_##S result = {.f_value = f3, .error = SUCCESS};       \
+                                                                            \
+    const T dudx = (u1 - 8*u2 + 8*u4 - u5) / (12*h);                        \
+    const T dvdx = (v1 - 8*v2 + 8*v4 - v5) / (12*h);                        \
+    const T d2udx2 = (-u1 + 16*u2 - 30*u3 + 16*u4 - u5) / (12*h*h);         \
+    const T d2vdx2 = (-v1 + 16*v2 - 30*v3 + 16*v4 - v5) / (12*h*h);         \
+                                                                            \
+    if (isnan(dudx) || isinf(dudx) || isnan(dvdx) || isinf(dvdx) ||         \
+        isnan(u3) || isinf(u3) || isnan(v3) || isinf(v3)) {                 \
+                                                                            \
+        result.error = UNDEFINED;                                           \
+        return result;                                                      \
+    }                                                                       \
+                                                                            \
+    result.value = (C)dudx + I*(C)dvdx;                                     \
+    result.second = (C)d2udx2 + I*(C)d2vdx2;                                \
+                                                                            \
+    const bool u_monotonic = (u1 < u2 && u2 < u3 && u3 < u4 && u4 < u5) ||  \
+                             (u1 > u2 && u2 > u3 && u3 > u4 && u4 > u5);    \
+    const bool v_monotonic = (v1 < v2 && v2 < v3 && v3 < v4 && v4 < v5) ||  \
+                             (v1 > v2 && v2 > v3 && v3 > v4 && v4 > v5);    \
+                                                                            \
+    if (u_monotonic && v_monotonic) {                                       \
+        return result;                                                      \
+    }                                                                       \
+                                                                            \
+    const bool u_right_hump = (u4 > u3 && u4 > u5) || (u4 < u3 && u4 < u5); \
+    const bool u_left_hump = (u2 > u1 && u2 > u3) || (u2 < u1 && u2 < u3);  \
+                                                                            \
+    if (u_right_hump) {                                                     \
+                                                                            \
+        if (u_left_hump || ABS(2*u4 - u3 - u5) > ABS(u3 - u1)) {            \
+                                                                            \
+            result.error = UNSTABLE;                                        \
+            return result;                                                  \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    if (u_left_hump) {                                                      \
+                                                                            \
+        if (u_right_hump || ABS(2*u2 - u1 - u3) > ABS(u5 - u3)) {           \
+                                                                            \
+            result.error = UNSTABLE;                                        \
+            return result;                                                  \
+        }                                                                   \
+                                                                            \
+    }                                                                       \
+                                                                            \
+    const bool v_right_hump = (v4 > v3 && v4 > v5) || (v4 < v3 && v4 < v5); \
+    const bool v_left_hump = (v2 > v1 && v2 > v3) || (v2 < v1 && v2 < v3);  \
+                                                                            \
+    if (v_right_hump) {                                                     \
+                                                                            \
+        if (v_left_hump || ABS(2*v4 - v3 - v5) > ABS(v3 - v1)) {            \
+                                                                            \
+            result.error = UNSTABLE;                                        \
+            return result;                                                  \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    if (v_left_hump) {                                                      \
+                                                                            \
+        if (v_right_hump || ABS(2*v2 - v1 - v3) > ABS(v5 - v3)) {           \
+                                                                            \
+            result.error = UNSTABLE;                                        \
+            return result;                                                  \
+        }                                                                   \
+                                                                            \
+    }                                                                       \
+                                                                            \
+    return result;                                                          \
+}                                                                           \
+                                                                            \
+                                                                            \
+/* Given z = x + iy and f(z) = u(x,y) + iv(x,y), computes f'(z) as: */      \
+/* du/dx + i*dv/dx with both derivatives evaluated at z_0 */                \
+Cmpl_Deriv_Result_##S                                                       \
+cmpl_deriv_##S(C (*f)(const C), const C z, const T dz) {                    \
+                                                                            \
+    const T h = ABS(dz/2);                                                  \
+    const C fs[5] = {                                                       \
+        f(z - 2*(C)h),                                                      \
+        f(z - (C)h),                                                        \
+        f(z),                                                               \
+        f(z + (C)h),                                                        \
+        f(z + 2*(C)h)                                                       \
+    };                                                                      \
+                                                                            \
+    return cmpl_deriv_stencil_##S(fs, h);                                   \
+}
+
+DEFINE_CMPL_DERIV(float, float complex, f, crealf, cimagf, fabsf)
+DEFINE_CMPL_DERIV(double, doubleC, d, creal, cimag, fabs)
+DEFINE_CMPL_DERIV(long double, long double complex, ld, creall, cimagl, fabsl)
+
+#define cmpl_deriv_stencil(fs, h)                                \
+    _Generic((fs)[0], float complex: cmpl_deriv_stencil_f,       \
+             doubleC: cmpl_deriv_stencil_d,                      \
+             long double complex: cmpl_deriv_stencil_ld)(fs, h)
+
+#define cmpl_deriv(f, z, dz) CMPL_GENERIC(cmpl_deriv, f)(f, z, dz)
+
+
+Cmpl_Dual
+cdual_var(const doubleC z) {
+
+    return (Cmpl_Dual) {z, 1};
+}
+
+
+Cmpl_Dual
+cdual_const(const doubleC c) {
+
+    return (Cmpl_Dual) {c, 0};
+}
+
+
+Cmpl_Dual
+cdual_add(const Cmpl_Dual a, const Cmpl_Dual b) {
+
+    return (Cmpl_Dual) {a.value + b.value, a.deriv + b.deriv};
+}
+
+
+Cmpl_Dual
+cdual_sub(const Cmpl_Dual a, const Cmpl_Dual b) {
+
+    return (Cmpl_Dual) {a.value - b.value, a.deriv - b.deriv};
+}
+
+
+Cmpl_Dual
+cdual_mul(const Cmpl_Dual a, const Cmpl_Dual b) {
+
+    return (Cmpl_Dual) {a.value*b.value, a.deriv*b.value + a.value*b.deriv};
+}
+
+
+Cmpl_Dual
+cdual_div(const Cmpl_Dual a, const Cmpl_Dual b) {
+
+    return (Cmpl_Dual) {a.value/b.value,
+                        (a.deriv*b.value - a.value*b.deriv)
+                        / (b.value*b.value)};
+}
+
+
+Cmpl_Dual
+cdual_exp(const Cmpl_Dual a) {
+
+    const doubleC value = cexp(a.value);
+
+    return (Cmpl_Dual) {value, value*a.deriv};
+}
+
+
+// Principal branch, like clog
+Cmpl_Dual
+cdual_log(const Cmpl_Dual a) {
+
+    return (Cmpl_Dual) {clog(a.value), a.deriv/a.value};
+}
+
+
+Cmpl_Dual
+cdual_sin(const Cmpl_Dual a) {
+
+    return (Cmpl_Dual) {csin(a.value), ccos(a.value)*a.deriv};
+}
+
+
+Cmpl_Dual
+cdual_cos(const Cmpl_Dual a) {
+
+    return (Cmpl_Dual) {ccos(a.value), -csin(a.value)*a.deriv};
+}
+
+
+// Computes a^b on the principal branch. A constant exponent uses the power
+// rule, which stays defined at a = 0 for exponents of at least one.
+Cmpl_Dual
+cdual_pow(const Cmpl_Dual a, const Cmpl_Dual b) {
+
+    const doubleC value = cpow(a.value, b.value);
+
+    if (b.deriv == 0) {
+
+        return (Cmpl_Dual) {value,
+                            b.value*cpow(a.value, b.value - 1)*a.deriv};
     }
-    
-    return result;
+
+    return (Cmpl_Dual) {value, value*(b.deriv*clog(a.value)
+                                      + b.value*a.deriv/a.value)};
 }
 
 
@@ -143,80 +643,2337 @@ poly2(const doubleC z) {
 }
 
 
+// poly2 in the other floating point types
+float complex
+poly2f(const float complex z) {
+
+    return z*z*z - 2*z*z + 5*z + 4;
+}
+
+
+long double complex
+poly2l(const long double complex z) {
+
+    return z*z*z - 2*z*z + 5*z + 4;
+}
+
+
+bool
+cmpl_finite(const doubleC z) {
+
+    return !(isnan(creal(z)) || isnan(cimag(z)) ||
+             isinf(creal(z)) || isinf(cimag(z)));
+}
+
+
+// Newton's method with the step chosen by opts->method:
+// NEWTON takes the plain step f/f'.
+// DAMPED_NEWTON halves the step until |f| decreases, which keeps far-off
+// guesses from being thrown further away.
+// HALLEY takes 2ff'/(2f'^2 - ff''), converging cubically near simple roots.
+// Each iteration costs five evaluations, plus one per damping trial.
 Newton_Root_Result
-find_root(doubleC(*f)(const doubleC), doubleC guess, double eps) {
+find_root_opts(doubleC(*f)(const doubleC), doubleC guess,
+               const Newton_Options* opts) {
     
     Newton_Root_Result result = {0};
     Cmpl_Deriv_Result deriv = {0};
     doubleC change = 0;
-    doubleC f_guess = 0;
     
     do {
 
-        deriv = cmpl_deriv(f, guess, eps);
+        if ((opts->max_iterations &&
+             result.iterations >= opts->max_iterations) ||
+            (opts->max_evaluations &&
+             result.evaluations + 5 > opts->max_evaluations)) {
+
+            result.value = guess;
+            result.error = NO_CONVERGENCE;
+            return result;
+        }
+        result.iterations++;
+
+        const double dz = opts->dz ? opts->dz
+                          : NEWTON_DZ*fmax(1, cabs(guess));
+        if (opts->f_batch) {
+
+            const double h = fabs(dz/2);
+            const doubleC zs[5] = {
+                guess - 2*(doubleC)h,
+                guess - (doubleC)h,
+                guess,
+                guess + (doubleC)h,
+                guess + 2*(doubleC)h
+            };
+            doubleC fs[5];
+
+            opts->f_batch(5, zs, fs);
+            deriv = cmpl_deriv_stencil(fs, h);
+
+        } else {
+
+            deriv = cmpl_deriv(f, guess, dz);
+        }
+        result.evaluations += 5;
         if (deriv.error) {
 
             result.error = deriv.error;
             return result;
         }
 
-        f_guess = f(guess);
-        if (isnan(creal(f_guess)) || isnan(cimag(f_guess)) ||
-            isinf(creal(f_guess)) || isinf(cimag(f_guess))) {
+        change = deriv.f_value / deriv.value;
+        if (opts->method == HALLEY) {
+
+            change = 2*deriv.f_value*deriv.value
+                     / (2*deriv.value*deriv.value
+                        - deriv.f_value*deriv.second);
+        }
+
+        if (opts->method == DAMPED_NEWTON) {
+
+            const double f_abs = cabs(deriv.f_value);
+            for (size_t i = 0; i < MAX_DAMPING_STEPS; i++) {
+
+                if (opts->max_evaluations &&
+                    result.evaluations >= opts->max_evaluations) {
+                    break;
+                }
+
+                const doubleC f_trial = f(guess - change);
+                result.evaluations++;
+                if (cmpl_finite(f_trial) && cabs(f_trial) < f_abs) {
+                    break;
+                }
+                change /= 2;
+            }
+        }
+
+        if (!cmpl_finite(change)) {
 
             result.error = UNDEFINED;
             return result;
         }
 
-        change = f_guess / deriv.value;
-        
-
         guess -= change;
 
-    } while (cabs(f_guess) > eps);
+    } while (cabs(deriv.f_value) > opts->eps);
     
     result.value = guess;
     return result;
 }
 
-int
-main() {
-    
-    Newton_Root_Result res1 = find_root(poly1, 1 + I, 1e-6);
-    if (res1.error) {
 
-        fprintf(stderr, "Failed to find a root.\n");
-        return EXIT_FAILURE;
-    }
-    printf("Root #1 of p(z) = z : ");
-    printf("%f + %fi\n", creal(res1.value), cimag(res1.value));
+Newton_Root_Result
+find_root_d(doubleC(*f)(const doubleC), doubleC guess, double eps) {
 
-    Newton_Root_Result res2 = find_root(poly2, -1, 1e-6);
-    if (res2.error) {
+    const Newton_Options opts = {.method = NEWTON, .eps = eps,
+                                 .max_iterations = MAX_NEWTON_ITER};
 
-        fprintf(stderr, "Failed to find a root.\n");
-        return EXIT_FAILURE;
-    }
-    printf("Root #1 of p(z) = z^3 - 2z^2 + 5z + 4 : ");
-    printf("%f + %fi\n", creal(res2.value), cimag(res2.value));
+    return find_root_opts(f, guess, &opts);
+}
 
-    Newton_Root_Result res3 = find_root(poly2, 1.3 + 2.2*I, 1e-6);
-    if (res3.error) {
 
-        fprintf(stderr, "Failed to find a root.\n");
-        return EXIT_FAILURE;
-    }
-    printf("Root #2 of p(z) = z^3 - 2z^2 + 5z + 4 : ");
-    printf("%f + %fi\n", creal(res3.value), cimag(res3.value));
+// The NEWTON method of find_root_opts in float and long double, for the
+// find_root of those types. The stencil step is 2*T_EPSILON^(1/5) scaled
+// by |z| past 1, which balances truncation against rounding in T. CABS is
+// the cabs of T.
+#define DEFINE_FIND_ROOT(T, C, S, T_EPSILON, CABS)                          \
+                                                                            \
+Newton_Root_Result_##S                                                      \
+find_root_##S(C (*f)(const C), C guess, const T eps) {                      \
+                                                                            \
+    Newton_Root_Result_##S result = {0};                                    \
+    Cmpl_Deriv_Result_##S deriv = {0};                                      \
+    const T dz = 2*pow(T_EPSILON, 0.2);                                     \
+                                                                            \
+    do {                                                                    \
+                                                                            \
+        if (result.iterations >= MAX_NEWTON_ITER) {                         \
+                                                                            \
+            result.value = guess;                                           \
+            result.error = NO_CONVERGENCE;                                  \
+            return result;                                                  \
+        }                                                                   \
+        result.iterations++;                                                \
+                                                                            \
+        const T abs_guess = CABS(guess);                                    \
+        deriv = cmpl_deriv(f, guess, abs_guess > 1 ? dz*abs_guess : dz);    \
+        result.evaluations += 5;                                            \
+        if (deriv.error) {                                                  \
+                                                                            \
+            result.error = deriv.error;                                     \
+            return result;                                                  \
+        }                                                                   \
+                                                                            \
+        const C change = deriv.f_value / deriv.value;                       \
+        const T abs_change = CABS(change);                                  \
+        if (isnan(abs_change) || isinf(abs_change)) {                       \
+                                                                            \
+            result.error = UNDEFINED;                                       \
+            return result;                                                  \
+        }                                                                   \
+                                                                            \
+        guess -= change;                                                    \
+                                                                            \
+    } while (CABS(deriv.f_value) > eps);                                    \
+                                                                            \
+    result.value = guess;                                                   \
+    return result;                                                          \
+}
 
-    Newton_Root_Result res4 = find_root(poly2, 1.3 - 2.2*I, 1e-6);
-    if (res4.error) {
+DEFINE_FIND_ROOT(float, float complex, f, FLT_EPSILON, cabsf)
+DEFINE_FIND_ROOT(long double, long double complex, ld, LDBL_EPSILON, cabsl)
 
-        fprintf(stderr, "Failed to find a root.\n");
-        return EXIT_FAILURE;
-    }
-    printf("Root #3 of p(z) = z^3 - 2z^2 + 5z + 4 : ");
-    printf("%f + %fi\n", creal(res4.value), cimag(res4.value));
+#define find_root(f, guess, eps) CMPL_GENERIC(find_root, f)(f, guess, eps)
+
+
+Cmpl_Dual
+poly2_dual(const Cmpl_Dual z) {
+
+    const Cmpl_Dual z2 = cdual_mul(z, z);
+    const Cmpl_Dual z3 = cdual_mul(z2, z);
+
+    return cdual_add(cdual_add(cdual_sub(z3, cdual_mul(cdual_const(2), z2)),
+                               cdual_mul(cdual_const(5), z)),
+                     cdual_const(4));
+}
+
+
+// Same iteration as find_root, but each Newton step costs one evaluation of
+// f on dual numbers instead of six plain ones
+Newton_Root_Result
+find_root_dual(Cmpl_Dual(*f)(const Cmpl_Dual), doubleC guess, double eps) {
+
+    Newton_Root_Result result = {0};
+    Cmpl_Dual f_guess = {0};
+
+    do {
+
+        if (result.iterations >= MAX_NEWTON_ITER) {
+
+            result.value = guess;
+            result.error = NO_CONVERGENCE;
+            return result;
+        }
+        result.iterations++;
+
+        f_guess = f(cdual_var(guess));
+        result.evaluations++;
+        if (!cmpl_finite(f_guess.value) || !cmpl_finite(f_guess.deriv) ||
+            f_guess.deriv == 0) {
+
+            result.error = UNDEFINED;
+            return result;
+        }
+
+        guess -= f_guess.value / f_guess.deriv;
+
+    } while (cabs(f_guess.value) > eps);
+
+    result.value = guess;
+    return result;
+}
+
+
+// Factors the n by n matrix a in place as PA = LU with partial pivoting,
+// recording the row taken as pivot of each column in pivots. Returns 0 on
+// success, 1 if a is singular.
+int
+lu_factor(const size_t n, double a[static n][n], size_t pivots[static n]) {
+
+    for (size_t c = 0; c < n; c++) {
+
+        size_t pivot = c;
+        for (size_t r = c + 1; r < n; r++) {
+
+            if (fabs(a[r][c]) > fabs(a[pivot][c])) {
+                pivot = r;
+            }
+        }
+
+        pivots[c] = pivot;
+        if (a[pivot][c] == 0) {
+
+            return 1;
+        }
+
+        if (pivot != c) {
+
+            for (size_t k = 0; k < n; k++) {
+
+                const double swap = a[c][k];
+                a[c][k] = a[pivot][k];
+                a[pivot][k] = swap;
+            }
+        }
+
+        const double lead_inv = 1.0/a[c][c];
+        for (size_t r = c + 1; r < n; r++) {
+
+            const double mult = a[r][c]*lead_inv;
+            a[r][c] = mult;
+            for (size_t k = c + 1; k < n; k++) {
+
+                a[r][k] -= mult*a[c][k];
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+// Solves Ax = b in place in b, given the factors from lu_factor
+void
+lu_solve(const size_t n, double lu[static n][n],
+         const size_t pivots[static n], double b[static n]) {
+
+    for (size_t r = 0; r < n; r++) {
+
+        const double swap = b[r];
+        b[r] = b[pivots[r]];
+        b[pivots[r]] = swap;
+
+        for (size_t k = 0; k < r; k++) {
+
+            b[r] -= lu[r][k]*b[k];
+        }
+    }
+
+    for (size_t r = n; r-- > 0;) {
+
+        for (size_t k = r + 1; k < n; k++) {
+
+            b[r] -= lu[r][k]*b[k];
+        }
+        b[r] /= lu[r][r];
+    }
+}
+
+
+void
+system_work_free(System_Work* work) {
+
+    if (!work) {
+        return;
+    }
+
+    free(work->jac);
+    free(work->lu);
+    free(work->pivots);
+    free(work->points);
+    free(work->values);
+    free(work->us);
+    free(work->dxs);
+    free(work->fx);
+    free(work->step);
+    free(work->h_df);
+    free(work);
+}
+
+
+System_Work*
+system_work_alloc(const size_t n) {
+
+    System_Work* work = malloc(sizeof(System_Work));
+    if (!work) {
+        return NULL;
+    }
+
+    work->n = n;
+    work->jac = malloc(sizeof(double[n*n]));
+    work->lu = malloc(sizeof(double[n*n]));
+    work->pivots = malloc(sizeof(size_t[n]));
+    work->points = malloc(sizeof(double[n*n]));
+    work->values = malloc(sizeof(double[n*n]));
+    work->us = malloc(sizeof(double[n*n]));
+    work->dxs = malloc(sizeof(double[n*n]));
+    work->fx = malloc(sizeof(double[n]));
+    work->step = malloc(sizeof(double[n]));
+    work->h_df = malloc(sizeof(double[n]));
+
+    if (!work->jac || !work->lu || !work->pivots || !work->points ||
+        !work->values || !work->us || !work->dxs || !work->fx ||
+        !work->step || !work->h_df) {
+
+        system_work_free(work);
+        return NULL;
+    }
+
+    return work;
+}
+
+
+double
+norm2(const size_t n, const double x[static n]) {
+
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+
+        sum += x[i]*x[i];
+    }
+
+    return sqrt(sum);
+}
+
+
+// Fills work->jac with forward differences of F at x, whose value is in
+// work->fx. The n shifted points go to F in a single call.
+void
+system_jacobian(System_Func* f, void* ctx, const double x[],
+                System_Work* work) {
+
+    const size_t n = work->n;
+    double (*points)[n] = (double (*)[n])work->points;
+    double (*values)[n] = (double (*)[n])work->values;
+    double (*jac)[n] = (double (*)[n])work->jac;
+
+    for (size_t j = 0; j < n; j++) {
+
+        memcpy(points[j], x, sizeof(double[n]));
+        points[j][j] += sqrt(DBL_EPSILON)*fmax(fabs(x[j]), 1);
+    }
+
+    f(n, n, work->points, work->values, ctx);
+
+    for (size_t j = 0; j < n; j++) {
+
+        const double h = points[j][j] - x[j];
+        for (size_t i = 0; i < n; i++) {
+
+            jac[i][j] = (values[j][i] - work->fx[i]) / h;
+        }
+    }
+}
+
+
+// Multiplies v in place by the inverse Jacobian of SYSTEM_BROYDEN after
+// count updates, (I + u_count dx_count^T)...(I + u_1 dx_1^T) J^-1, where J
+// is factored in work->lu. Costs O(n^2 + count*n).
+void
+broyden_apply(const System_Work* work, const size_t count,
+              double v[static work->n]) {
+
+    const size_t n = work->n;
+    double (*lu)[n] = (double (*)[n])work->lu;
+    const double (*us)[n] = (const double (*)[n])work->us;
+    const double (*dxs)[n] = (const double (*)[n])work->dxs;
+
+    lu_solve(n, lu, work->pivots, v);
+
+    for (size_t k = 0; k < count; k++) {
+
+        double dot = 0;
+        for (size_t i = 0; i < n; i++) {
+
+            dot += dxs[k][i]*v[i];
+        }
+
+        for (size_t i = 0; i < n; i++) {
+
+            v[i] += dot*us[k][i];
+        }
+    }
+}
+
+
+// Solves F(x) = 0 for x in R^n by Newton's method, starting from x and
+// leaving the solution in it. Each step solves J dx = -F(x) through an LU
+// factorization. SYSTEM_NEWTON rebuilds and refactors the Jacobian by
+// finite differences every iteration, at n evaluations of F and O(n^3)
+// work each. SYSTEM_BROYDEN factors it once and keeps the inverse H up to
+// date with the Sherman-Morrison form of the rank one update,
+// H += (dx - H dF) dx^T H / (dx^T H dF) = u dx^T H. The updates are kept
+// as the pairs u, dx rather than applied to a matrix, so each step costs
+// one evaluation and O(n^2) work. A step that fails to reduce |F| is taken
+// back and the Jacobian rebuilt at the old x, as it is after n updates;
+// if the step from the rebuilt Jacobian fails too, it is halved until |F|
+// drops.
+// work must come from system_work_alloc(n) and is reused between calls.
+System_Result
+solve_system(System_Func* f, void* ctx, double x[],
+             const System_Options* opts, System_Work* work) {
+
+    const size_t n = work->n;
+    double (*lu)[n] = (double (*)[n])work->lu;
+    double (*us)[n] = (double (*)[n])work->us;
+    double (*dxs)[n] = (double (*)[n])work->dxs;
+    double* fx = work->fx;
+    double* step = work->step;
+    double* f_new = work->values;
+    double* h_df = work->h_df;
+    System_Result result = {0};
+    size_t update_count = 0;
+    bool fresh_jacobian = false;
+    bool need_jacobian = true;
+
+    f(n, 1, x, fx, ctx);
+    result.evaluations = 1;
+    result.residual = norm2(n, fx);
+
+    while (!(result.residual <= opts->eps)) {
+
+        if (isnan(result.residual) || isinf(result.residual)) {
+
+            result.error = UNDEFINED;
+            return result;
+        }
+
+        if (result.iterations >= opts->max_iterations) {
+
+            result.error = NO_CONVERGENCE;
+            return result;
+        }
+        result.iterations++;
+
+        if (need_jacobian || opts->method == SYSTEM_NEWTON) {
+
+            system_jacobian(f, ctx, x, work);
+            result.evaluations += n;
+
+            memcpy(work->lu, work->jac, sizeof(double[n*n]));
+            if (lu_factor(n, lu, work->pivots)) {
+
+                result.error = UNSTABLE;
+                return result;
+            }
+
+            update_count = 0;
+            need_jacobian = false;
+            fresh_jacobian = true;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+
+            step[i] = -fx[i];
+        }
+        broyden_apply(work, update_count, step);
+
+        for (size_t i = 0; i < n; i++) {
+
+            x[i] += step[i];
+        }
+
+        f(n, 1, x, f_new, ctx);
+        result.evaluations++;
+        double residual = norm2(n, f_new);
+
+        if (opts->method == SYSTEM_BROYDEN && !(residual < result.residual)) {
+
+            if (!fresh_jacobian) {
+
+                for (size_t i = 0; i < n; i++) {
+
+                    x[i] -= step[i];
+                }
+
+                need_jacobian = true;
+                continue;
+            }
+
+            // Even the Newton step overshoots, so it is halved until |F|
+            // drops, as DAMPED_NEWTON does in find_root_opts
+            for (size_t t = 0; t < MAX_DAMPING_STEPS
+                               && !(residual < result.residual); t++) {
+
+                for (size_t i = 0; i < n; i++) {
+
+                    step[i] /= 2;
+                    x[i] -= step[i];
+                }
+
+                f(n, 1, x, f_new, ctx);
+                result.evaluations++;
+                residual = norm2(n, f_new);
+            }
+        }
+
+        if (opts->method == SYSTEM_BROYDEN) {
+
+            for (size_t i = 0; i < n; i++) {
+
+                h_df[i] = f_new[i] - fx[i];
+            }
+            broyden_apply(work, update_count, h_df);
+
+            double denom = 0;
+            for (size_t i = 0; i < n; i++) {
+
+                denom += step[i]*h_df[i];
+            }
+
+            if (update_count < n && denom != 0 && !isinf(denom)
+                && !isnan(denom)) {
+
+                for (size_t i = 0; i < n; i++) {
+
+                    us[update_count][i] = (step[i] - h_df[i]) / denom;
+                    dxs[update_count][i] = step[i];
+                }
+                update_count++;
+
+            } else {
+
+                need_jacobian = true;
+            }
+
+            fresh_jacobian = false;
+        }
+
+        memcpy(fx, f_new, sizeof(double[n]));
+        result.residual = residual;
+    }
+
+    return result;
+}
+
+
+// Evaluates the polynomial with coefficients coeffs[0] + coeffs[1]z + ...
+// + coeffs[degree]z^degree and its derivative at z in one Horner pass
+void
+horner_deriv(const size_t degree, const doubleC coeffs[static degree + 1],
+             const doubleC z, doubleC* p, doubleC* dp) {
+
+    doubleC value = coeffs[degree];
+    doubleC deriv = 0;
+
+    for (size_t k = degree; k-- > 0;) {
+
+        deriv = deriv*z + value;
+        value = value*z + coeffs[k];
+    }
+
+    *p = value;
+    *dp = deriv;
+}
+
+
+void
+aberth_free(Aberth_Workspace* work) {
+
+    if (!work) {
+        return;
+    }
+
+    free(work->re);
+    free(work->im);
+    free(work->next_re);
+    free(work->next_im);
+    free(work->done);
+    free(work);
+}
+
+
+Aberth_Workspace*
+aberth_alloc(const size_t max_degree) {
+
+    Aberth_Workspace* work = malloc(sizeof(Aberth_Workspace));
+    if (!work) {
+        return NULL;
+    }
+
+    // Rounded up to whole lanes, so the last block needs no special case
+    const size_t padded = (max_degree + LANE_COUNT - 1)
+                          / LANE_COUNT * LANE_COUNT;
+    work->max_degree = max_degree;
+    work->re = malloc(sizeof(double[padded]));
+    work->im = malloc(sizeof(double[padded]));
+    work->next_re = malloc(sizeof(double[padded]));
+    work->next_im = malloc(sizeof(double[padded]));
+    work->done = malloc(sizeof(int64_t[padded]));
+
+    if (!work->re || !work->im || !work->next_re || !work->next_im ||
+        !work->done) {
+
+        aberth_free(work);
+        return NULL;
+    }
+
+    return work;
+}
+
+
+// Finds all roots of a polynomial of the given degree at once with the
+// Aberth-Ehrlich iteration. The Newton correction w = p/p' of every root is
+// deflated by the others as w/(1 - w*sum 1/(z_i - z_j)), so no two
+// approximations converge to the same root and no starting guesses are
+// needed. Roots are kept as separate real and imaginary arrays and updated
+// LANE_COUNT at a time; a root stops moving once its correction falls below
+// eps relative to its size.
+Poly_Roots_Result
+poly_roots(Aberth_Workspace* work, const size_t degree,
+           const doubleC coeffs[static degree + 1], doubleC roots[static degree],
+           const double eps, const size_t max_iterations) {
+
+    Poly_Roots_Result result = {0};
+
+    if (degree == 0 || degree > work->max_degree || coeffs[degree] == 0) {
+
+        result.error = UNDEFINED;
+        return result;
+    }
+
+    const size_t padded = (degree + LANE_COUNT - 1) / LANE_COUNT * LANE_COUNT;
+    double* re = work->re;
+    double* im = work->im;
+    double* next_re = work->next_re;
+    double* next_im = work->next_im;
+    int64_t* done = work->done;
+
+    // Start on a circle with the geometric mean of the root moduli as its
+    // radius, turned off the real axis so conjugate pairs can separate
+    double radius = pow(cabs(coeffs[0] / coeffs[degree]), 1.0/degree);
+    if (!(radius > 0) || isinf(radius)) {
+        radius = 1;
+    }
+
+    for (size_t i = 0; i < padded; i++) {
+
+        const double angle = 2*M_PI*i/degree + 0.4;
+        re[i] = (i < degree) ? radius*cos(angle) : 0;
+        im[i] = (i < degree) ? radius*sin(angle) : 0;
+        done[i] = (i < degree) ? 0 : -1;
+    }
+
+    size_t remaining = degree;
+
+    while (remaining > 0) {
+
+        if (result.iterations >= max_iterations) {
+
+            result.error = NO_CONVERGENCE;
+            break;
+        }
+        result.iterations++;
+
+        for (size_t i = 0; i < padded; i += LANE_COUNT) {
+
+            Lanes z_re;
+            Lanes z_im;
+            Lanes_Mask finished;
+            memcpy(&z_re, &re[i], sizeof(Lanes));
+            memcpy(&z_im, &im[i], sizeof(Lanes));
+            memcpy(&finished, &done[i], sizeof(Lanes_Mask));
+
+            const Lanes z_norm = z_re*z_re + z_im*z_im;
+            Lanes z_abs;
+            for (size_t l = 0; l < LANE_COUNT; l++) {
+
+                z_abs[l] = sqrt(z_norm[l]);
+            }
+
+            Lanes p_re = (Lanes){0} + creal(coeffs[degree]);
+            Lanes p_im = (Lanes){0} + cimag(coeffs[degree]);
+            Lanes dp_re = {0};
+            Lanes dp_im = {0};
+            Lanes scale = (Lanes){0} + cabs(coeffs[degree]);
+
+            for (size_t k = degree; k-- > 0;) {
+
+                scale = scale*z_abs + cabs(coeffs[k]);
+
+                const Lanes next_dp_re = dp_re*z_re - dp_im*z_im + p_re;
+                dp_im = dp_re*z_im + dp_im*z_re + p_im;
+                dp_re = next_dp_re;
+
+                const Lanes next_p_re = p_re*z_re - p_im*z_im
+                                        + creal(coeffs[k]);
+                p_im = p_re*z_im + p_im*z_re + cimag(coeffs[k]);
+                p_re = next_p_re;
+            }
+
+            // Sum of 1/(z_i - z_j) over j != i; the zero difference of a
+            // root with itself is masked out
+            Lanes sum_re = {0};
+            Lanes sum_im = {0};
+
+            for (size_t j = 0; j < degree; j++) {
+
+                const Lanes diff_re = z_re - re[j];
+                const Lanes diff_im = z_im - im[j];
+                const Lanes norm = diff_re*diff_re + diff_im*diff_im;
+                const Lanes inv = (Lanes)((Lanes_Mask)(1/norm) & (norm > 0));
+
+                sum_re += diff_re*inv;
+                sum_im -= diff_im*inv;
+            }
+
+            const Lanes dp_norm = dp_re*dp_re + dp_im*dp_im;
+            const Lanes w_re = (p_re*dp_re + p_im*dp_im) / dp_norm;
+            const Lanes w_im = (p_im*dp_re - p_re*dp_im) / dp_norm;
+
+            const Lanes t_re = 1 - (w_re*sum_re - w_im*sum_im);
+            const Lanes t_im = -(w_re*sum_im + w_im*sum_re);
+            const Lanes t_norm = t_re*t_re + t_im*t_im;
+            const Lanes step_re = (w_re*t_re + w_im*t_im) / t_norm;
+            const Lanes step_im = (w_im*t_re - w_re*t_im) / t_norm;
+
+            const Lanes step_norm = step_re*step_re + step_im*step_im;
+
+            // Converged once the step is small, or once p(z) is within the
+            // rounding error of Horner's rule, which is as close as a
+            // multiple root can be located
+            const Lanes p_norm = p_re*p_re + p_im*p_im;
+            const Lanes p_bound = 2*degree*DBL_EPSILON*scale;
+            const Lanes_Mask converged = (step_norm <= eps*eps*(1 + z_norm))
+                                         | (p_norm <= p_bound*p_bound);
+
+            // Roots with a stationary point under them (p' = 0) get a
+            // non-finite step and simply wait for the next sweep
+            const Lanes_Mask move = ~finished & (step_norm <= DBL_MAX);
+
+            z_re -= (Lanes)((Lanes_Mask)step_re & move);
+            z_im -= (Lanes)((Lanes_Mask)step_im & move);
+            finished |= move & converged;
+
+            memcpy(&next_re[i], &z_re, sizeof(Lanes));
+            memcpy(&next_im[i], &z_im, sizeof(Lanes));
+            memcpy(&done[i], &finished, sizeof(Lanes_Mask));
+        }
+
+        double* swap = re;
+        re = next_re;
+        next_re = swap;
+        swap = im;
+        im = next_im;
+        next_im = swap;
+
+        remaining = 0;
+        for (size_t i = 0; i < degree; i++) {
+
+            remaining += !done[i];
+        }
+    }
+
+    for (size_t i = 0; i < degree; i++) {
+
+        roots[i] = CMPLX(re[i], im[i]);
+    }
+
+    return result;
+}
+
+
+// Solves count polynomials of the same degree, stored back to back in
+// coeffs and roots, sharing one workspace
+void
+poly_roots_batch(Aberth_Workspace* work, const size_t count,
+                 const size_t degree,
+                 const doubleC coeffs[static count*(degree + 1)],
+                 doubleC roots[static count*degree], const double eps,
+                 const size_t max_iterations,
+                 Poly_Roots_Result results[static count]) {
+
+    for (size_t i = 0; i < count; i++) {
+
+        results[i] = poly_roots(work, degree, &coeffs[i*(degree + 1)],
+                                &roots[i*degree], eps, max_iterations);
+    }
+}
+
+
+// Evaluates every instruction of expr across n points at a time, so the
+// cost of decoding an instruction is paid once per EXPR_BATCH_LEN points
+// rather than once per point
+void
+expr_eval_batch(const Expr* expr, const size_t n, const doubleC xs[static n],
+                doubleC ys[static n]) {
+
+    doubleC regs[expr->reg_count][EXPR_BATCH_LEN];
+
+    for (size_t first = 0; first < n; first += EXPR_BATCH_LEN) {
+
+        const size_t len = (n - first < EXPR_BATCH_LEN)
+                           ? n - first : EXPR_BATCH_LEN;
+        const doubleC* x = &xs[first];
+
+        for (size_t pc = 0; pc < expr->length; pc++) {
+
+            const Expr_Instr in = expr->code[pc];
+            doubleC* d = regs[in.dst];
+
+            switch (in.op) {
+
+                case OP_CONST:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = expr->consts[in.a];
+                    }
+                    break;
+
+                case OP_VAR:
+                    memcpy(d, x, sizeof(doubleC[len]));
+                    break;
+
+                case OP_ADD:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] + regs[in.b][i];
+                    }
+                    break;
+
+                case OP_SUB:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] - regs[in.b][i];
+                    }
+                    break;
+
+                case OP_MUL:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] * regs[in.b][i];
+                    }
+                    break;
+
+                case OP_DIV:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] / regs[in.b][i];
+                    }
+                    break;
+
+                case OP_NEG:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = -regs[in.a][i];
+                    }
+                    break;
+
+                case OP_POW:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = cpow(regs[in.a][i], regs[in.b][i]);
+                    }
+                    break;
+
+                // Exponent in in.b, by repeated squaring
+                case OP_POWI:
+                    for (size_t i = 0; i < len; i++) {
+
+                        doubleC power = 1;
+                        doubleC base = regs[in.a][i];
+                        for (unsigned e = in.b; e; e >>= 1) {
+
+                            if (e & 1) {
+                                power *= base;
+                            }
+                            base *= base;
+                        }
+                        d[i] = power;
+                    }
+                    break;
+
+                case OP_SIN:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = csin(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_COS:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = ccos(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_TAN:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = ctan(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_EXP:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = cexp(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_LOG:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = clog(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_SQRT:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = csqrt(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_ABS:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = cabs(regs[in.a][i]);
+                    }
+                    break;
+            }
+        }
+
+        memcpy(&ys[first], regs[expr->result], sizeof(doubleC[len]));
+    }
+}
+
+
+doubleC
+expr_eval(const Expr* expr, const doubleC x) {
+
+    doubleC y;
+    expr_eval_batch(expr, 1, &x, &y);
+
+    return y;
+}
+
+
+// Appends an instruction writing to a fresh register and returns that
+// register, or -1 once the program or register file is full
+int
+expr_emit(Expr_Parser* parser, const Expr_Op op, const int a, const int b) {
+
+    Expr* expr = parser->expr;
+
+    if (a < 0 || b < 0 || expr->length >= EXPR_MAX_CODE
+        || expr->reg_count >= EXPR_MAX_REGS) {
+
+        parser->failed = true;
+        return -1;
+    }
+
+    expr->code[expr->length++] = (Expr_Instr) {
+        .op = op, .dst = expr->reg_count, .a = a, .b = b
+    };
+
+    return expr->reg_count++;
+}
+
+
+void
+expr_skip_space(Expr_Parser* parser) {
+
+    while (isspace((unsigned char)parser->src[parser->pos])) {
+
+        parser->pos++;
+    }
+}
+
+
+bool
+expr_accept(Expr_Parser* parser, const char c) {
+
+    expr_skip_space(parser);
+    if (parser->src[parser->pos] != c) {
+
+        return false;
+    }
+
+    parser->pos++;
+    return true;
+}
+
+
+int expr_parse_sum(Expr_Parser* parser);
+int expr_parse_unary(Expr_Parser* parser);
+
+
+// primary = number | variable | constant | function "(" sum ")" | "(" sum ")"
+int
+expr_parse_primary(Expr_Parser* parser) {
+
+    Expr* expr = parser->expr;
+    expr_skip_space(parser);
+    const char* start = &parser->src[parser->pos];
+
+    if (isdigit((unsigned char)*start) || *start == '.') {
+
+        char* end = NULL;
+        const double value = strtod(start, &end);
+        if (end == start || expr->const_count >= EXPR_MAX_CODE) {
+
+            parser->failed = true;
+            return -1;
+        }
+
+        parser->pos += end - start;
+        expr->consts[expr->const_count] = value;
+        return expr_emit(parser, OP_CONST, expr->const_count++, 0);
+    }
+
+    if (expr_accept(parser, '(')) {
+
+        const int reg = expr_parse_sum(parser);
+        if (!expr_accept(parser, ')')) {
+
+            parser->failed = true;
+            return -1;
+        }
+        return reg;
+    }
+
+    size_t name_len = 0;
+    while (isalpha((unsigned char)start[name_len])) {
+
+        name_len++;
+    }
+
+    if (!name_len) {
+
+        parser->failed = true;
+        return -1;
+    }
+    parser->pos += name_len;
+
+    for (size_t i = 0; i < sizeof(EXPR_NAMES)/sizeof(EXPR_NAMES[0]); i++) {
+
+        if (strlen(EXPR_NAMES[i].name) != name_len
+            || strncmp(EXPR_NAMES[i].name, start, name_len)) {
+            continue;
+        }
+
+        if (EXPR_NAMES[i].op == OP_VAR) {
+
+            return expr_emit(parser, OP_VAR, 0, 0);
+        }
+
+        if (EXPR_NAMES[i].op == OP_CONST) {
+
+            if (expr->const_count >= EXPR_MAX_CODE) {
+
+                parser->failed = true;
+                return -1;
+            }
+
+            expr->consts[expr->const_count] = EXPR_NAMES[i].value;
+            return expr_emit(parser, OP_CONST, expr->const_count++, 0);
+        }
+
+        if (!expr_accept(parser, '(')) {
+
+            parser->failed = true;
+            return -1;
+        }
+
+        const int arg = expr_parse_sum(parser);
+        if (!expr_accept(parser, ')')) {
+
+            parser->failed = true;
+            return -1;
+        }
+
+        return expr_emit(parser, EXPR_NAMES[i].op, arg, 0);
+    }
+
+    parser->pos -= name_len;
+    parser->failed = true;
+    return -1;
+}
+
+
+// power = primary ["^" unary], right associative. Small integer literal
+// exponents compile to OP_POWI, which stays exact for negative bases.
+int
+expr_parse_power(Expr_Parser* parser) {
+
+    const int base = expr_parse_primary(parser);
+
+    if (parser->failed || !expr_accept(parser, '^')) {
+
+        return base;
+    }
+
+    expr_skip_space(parser);
+    const char* start = &parser->src[parser->pos];
+    char* end = NULL;
+    const long exponent = strtol(start, &end, 10);
+
+    // A literal followed by another ^ is the base of a power itself, which
+    // the general path below handles right-associatively
+    const char* next = end;
+    while (isspace((unsigned char)*next)) {
+        next++;
+    }
+
+    if (end != start && isdigit((unsigned char)*start)
+        && exponent <= EXPR_MAX_POWI
+        && (*end == '\0' || !strchr(".eE", *end)) && *next != '^') {
+
+        parser->pos += end - start;
+        return expr_emit(parser, OP_POWI, base, exponent);
+    }
+
+    const int power = expr_parse_unary(parser);
+    return expr_emit(parser, OP_POW, base, power);
+}
+
+
+// unary = "-" unary | "+" unary | power. Every level of nesting passes
+// through here, so this is where the recursion depth is bounded.
+int
+expr_parse_unary(Expr_Parser* parser) {
+
+    int reg = -1;
+
+    if (++parser->depth > EXPR_MAX_DEPTH) {
+
+        parser->failed = true;
+
+    } else if (expr_accept(parser, '-')) {
+
+        reg = expr_emit(parser, OP_NEG, expr_parse_unary(parser), 0);
+
+    } else if (expr_accept(parser, '+')) {
+
+        reg = expr_parse_unary(parser);
+
+    } else {
+
+        reg = expr_parse_power(parser);
+    }
+
+    parser->depth--;
+    return reg;
+}
+
+
+// product = unary {("*" | "/") unary}
+int
+expr_parse_product(Expr_Parser* parser) {
+
+    int reg = expr_parse_unary(parser);
+
+    while (!parser->failed) {
+
+        if (expr_accept(parser, '*')) {
+
+            reg = expr_emit(parser, OP_MUL, reg, expr_parse_unary(parser));
+
+        } else if (expr_accept(parser, '/')) {
+
+            reg = expr_emit(parser, OP_DIV, reg, expr_parse_unary(parser));
+
+        } else {
+
+            break;
+        }
+    }
+
+    return reg;
+}
+
+
+// sum = product {("+" | "-") product}
+int
+expr_parse_sum(Expr_Parser* parser) {
+
+    int reg = expr_parse_product(parser);
+
+    while (!parser->failed) {
+
+        if (expr_accept(parser, '+')) {
+
+            reg = expr_emit(parser, OP_ADD, reg, expr_parse_product(parser));
+
+        } else if (expr_accept(parser, '-')) {
+
+            reg = expr_emit(parser, OP_SUB, reg, expr_parse_product(parser));
+
+        } else {
+
+            break;
+        }
+    }
+
+    return reg;
+}
+
+
+// Compiles src into expr. Every node of the expression gets its own
+// register, so the program is a straight line with no stack. Returns 0 on
+// success and 1 on a syntax error, leaving its offset in expr->error_pos.
+int
+expr_compile(Expr* expr, const char* src) {
+
+    *expr = (Expr) {0};
+    Expr_Parser parser = {.src = src, .expr = expr};
+
+    const int result = expr_parse_sum(&parser);
+    expr_skip_space(&parser);
+
+    if (parser.failed || result < 0 || src[parser.pos]) {
+
+        expr->error_pos = parser.pos;
+        return 1;
+    }
+
+    expr->result = result;
+    return 0;
+}
+
+
+// The formula given on the command line, behind the function pointer
+// signatures find_root_opts takes
+static Expr cli_expr;
+
+
+doubleC
+cli_f(const doubleC z) {
+
+    return expr_eval(&cli_expr, z);
+}
+
+
+void
+cli_f_batch(const size_t n, const doubleC zs[static n], doubleC ys[static n]) {
+
+    expr_eval_batch(&cli_expr, n, zs, ys);
+}
+
+
+// Broyden's tridiagonal test function,
+// F_i = (3 - 2x_i)x_i - x_(i-1) - 2x_(i+1) + 1 with x_0 = x_(n+1) = 0
+void
+broyden_tridiagonal(const size_t n, const size_t count,
+                    const double xs[static count*n],
+                    double fxs[static count*n], void* ctx) {
+
+    (void)ctx;
+
+    for (size_t p = 0; p < count; p++) {
+
+        const double* x = &xs[p*n];
+        double* fx = &fxs[p*n];
+
+        for (size_t i = 0; i < n; i++) {
+
+            const double left = (i > 0) ? x[i - 1] : 0;
+            const double right = (i + 1 < n) ? x[i + 1] : 0;
+            fx[i] = (3 - 2*x[i])*x[i] - left - 2*right + 1;
+        }
+    }
+}
+
+
+// Copied from ch11
+int
+write_netpbm_header(FILE* im, Image_Header* head) {
+    
+    if (head->format < 1 || head->format > 6) {
+
+        return 1;
+    }
+    
+    // 11 = 3 for 1st row + 4 for 2nd row + 4 for 3rd row
+    if (11 > fprintf(im, "P%" PRId16 "\n%zu %zu\n255\n",
+                     head->format, head->width, head->height)) {
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// Copied from ch11
+int
+write_netpbm_image(FILE* out, const Image_Header* head, const Pixel data[]) {
+    
+    size_t total = head->height * head->width;
+
+    if (head->format == 5) { 
+
+        for (size_t i = 0; i < total; i++) {
+
+            if (fputc(data[i].gray, out) == EOF) {
+                
+                return 1;
+            }
+        }
+
+    } else if (head->format == 6) {
+
+        for (size_t i = 0; i < total; i++) {
+                
+            if (fputc(data[i].rgb.R, out) == EOF ||
+                fputc(data[i].rgb.G, out) == EOF ||
+                fputc(data[i].rgb.B, out) == EOF) {
+
+                return 1;
+            }
+        }
+    }
+            
+    fflush(out);
+    return 0;
+}
+
+
+// Runs Newton's method on the polynomial of job from the LANE_COUNT pixels
+// starting at (row, col) side by side, then colors each pixel by the root
+// it reached, darker the more iterations it took. Pixels that diverge, stall
+// on a critical point or run out of iterations are left black.
+void
+basin_lanes(const Basin_Job* job, const size_t row, const size_t col) {
+
+    Lanes z_re;
+    Lanes z_im = (Lanes){0} + (job->y_max - row*job->pixel_size);
+    for (size_t l = 0; l < LANE_COUNT; l++) {
+
+        z_re[l] = job->x_min + (col + l)*job->pixel_size;
+    }
+
+    Lanes_Mask finished = {0};
+    Lanes_Mask iterations = {0};
+
+    for (size_t i = 0; i < job->max_iterations; i++) {
+
+        Lanes p_re = (Lanes){0} + creal(job->coeffs[job->degree]);
+        Lanes p_im = (Lanes){0} + cimag(job->coeffs[job->degree]);
+        Lanes dp_re = {0};
+        Lanes dp_im = {0};
+
+        for (size_t k = job->degree; k-- > 0;) {
+
+            const Lanes next_dp_re = dp_re*z_re - dp_im*z_im + p_re;
+            dp_im = dp_re*z_im + dp_im*z_re + p_im;
+            dp_re = next_dp_re;
+
+            const Lanes next_p_re = p_re*z_re - p_im*z_im
+                                    + creal(job->coeffs[k]);
+            p_im = p_re*z_im + p_im*z_re + cimag(job->coeffs[k]);
+            p_re = next_p_re;
+        }
+
+        const Lanes dp_norm = dp_re*dp_re + dp_im*dp_im;
+        const Lanes step_re = (p_re*dp_re + p_im*dp_im) / dp_norm;
+        const Lanes step_im = (p_im*dp_re - p_re*dp_im) / dp_norm;
+        const Lanes step_norm = step_re*step_re + step_im*step_im;
+        const Lanes z_norm = z_re*z_re + z_im*z_im;
+
+        // Also false for NaN, so stalled lanes stop moving
+        const Lanes_Mask finite = step_norm <= DBL_MAX;
+        const Lanes_Mask move = ~finished & finite;
+
+        z_re -= (Lanes)((Lanes_Mask)step_re & move);
+        z_im -= (Lanes)((Lanes_Mask)step_im & move);
+        iterations -= move;
+        finished |= ~finite
+                    | (step_norm <= job->eps*job->eps*(1 + z_norm));
+
+        bool all_finished = true;
+        for (size_t l = 0; l < LANE_COUNT; l++) {
+
+            all_finished &= finished[l] != 0;
+        }
+
+        if (all_finished) {
+            break;
+        }
+    }
+
+    for (size_t l = 0; l < LANE_COUNT && col + l < job->width; l++) {
+
+        RGB_Pixel color = {0};
+        const doubleC z = CMPLX(z_re[l], z_im[l]);
+
+        for (size_t r = 0; r < job->degree; r++) {
+
+            if (cabs(z - job->roots[r]) < BASIN_ROOT_TOL
+                                          * (1 + cabs(job->roots[r]))) {
+
+                const double shade = 1 - (iterations[l] < BASIN_SHADE_ITER
+                                          ? iterations[l]
+                                          : BASIN_SHADE_ITER)
+                                         / (1.25*BASIN_SHADE_ITER);
+                const RGB_Pixel base = BASIN_COLORS[r % BASIN_COLOR_COUNT];
+
+                color.R = base.R*shade;
+                color.G = base.G*shade;
+                color.B = base.B*shade;
+                break;
+            }
+        }
+
+        job->image[row*job->width + col + l].rgb = color;
+    }
+}
+
+
+int
+basin_worker(void* arg) {
+
+    Basin_Job* job = arg;
+    const size_t tiles_x = (job->width + BASIN_TILE - 1) / BASIN_TILE;
+    const size_t tiles_y = (job->height + BASIN_TILE - 1) / BASIN_TILE;
+
+    // Tiles are handed out one at a time, so threads that draw the slow
+    // regions near basin boundaries do not hold up the others
+    for (size_t tile = atomic_fetch_add(&job->next_tile, 1);
+         tile < tiles_x*tiles_y;
+         tile = atomic_fetch_add(&job->next_tile, 1)) {
+
+        const size_t row_start = tile / tiles_x * BASIN_TILE;
+        const size_t col_start = tile % tiles_x * BASIN_TILE;
+
+        for (size_t row = row_start;
+             row < row_start + BASIN_TILE && row < job->height; row++) {
+
+            for (size_t col = col_start;
+                 col < col_start + BASIN_TILE && col < job->width;
+                 col += LANE_COUNT) {
+
+                basin_lanes(job, row, col);
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+// Runs worker on up to thread_count threads sharing job. The calling thread
+// is one of the workers, so a failure to spawn threads only costs
+// parallelism.
+void
+run_workers(thrd_start_t worker, void* job, size_t thread_count) {
+
+    thrd_t threads[MAX_THREADS];
+    size_t spawned = 0;
+
+    if (thread_count > MAX_THREADS) {
+
+        thread_count = MAX_THREADS;
+    }
+
+    while (spawned + 1 < thread_count) {
+
+        if (thrd_create(&threads[spawned], worker, job) != thrd_success) {
+
+            break;
+        }
+        spawned++;
+    }
+
+    worker(job);
+
+    for (size_t t = 0; t < spawned; t++) {
+
+        thrd_join(threads[t], NULL);
+    }
+}
+
+
+// One thread per online processor, up to MAX_THREADS
+size_t
+default_thread_count(void) {
+
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (online > MAX_THREADS) {
+
+        return MAX_THREADS;
+    }
+
+    return (online > 0) ? (size_t)online : 1;
+}
+
+
+// Maps the basins of attraction of the polynomial with the given
+// coefficients over the square centered on the origin with side span,
+// writing a width x height PPM to out. Returns 0 on success.
+int
+render_basins(FILE* out, const size_t degree,
+              const doubleC coeffs[static degree + 1], const size_t width,
+              const size_t height, const double span,
+              const size_t thread_count) {
+
+    Aberth_Workspace* work = aberth_alloc(degree);
+    doubleC* roots = malloc(sizeof(doubleC[degree]));
+    Pixel* image = malloc(sizeof(Pixel[width*height]));
+    if (!work || !roots || !image) {
+
+        fprintf(stderr, "Failed to allocate memory.\n");
+        goto fail;
+    }
+
+    if (poly_roots(work, degree, coeffs, roots, 1e-12,
+                   MAX_ABERTH_ITER).error) {
+
+        fprintf(stderr, "Failed to find the roots of the polynomial.\n");
+        goto fail;
+    }
+
+    const double side = (width > height) ? width : height;
+    Basin_Job job = {
+        .degree = degree,
+        .coeffs = coeffs,
+        .roots = roots,
+        .width = width,
+        .height = height,
+        .x_min = -span/2 * width/side,
+        .y_max = span/2 * height/side,
+        .pixel_size = span/side,
+        .max_iterations = MAX_NEWTON_ITER,
+        .eps = 1e-9,
+        .image = image
+    };
+    atomic_init(&job.next_tile, 0);
+
+    struct timespec begin;
+    struct timespec end;
+    timespec_get(&begin, TIME_UTC);
+    run_workers(basin_worker, &job, thread_count);
+    timespec_get(&end, TIME_UTC);
+
+    const double seconds = (end.tv_sec - begin.tv_sec)
+                           + (end.tv_nsec - begin.tv_nsec)*1e-9;
+    printf("Rendered %zux%zu basins of a degree %zu polynomial on %zu "
+           "threads in %.3f s: %.2f MP/s\n", width, height, degree,
+           thread_count, seconds, width*height/seconds*1e-6);
+
+    Image_Header head = {.format = 6, .height = height, .width = width};
+    if (write_netpbm_header(out, &head) ||
+        write_netpbm_image(out, &head, image)) {
+
+        fprintf(stderr, "Failed to write the image.\n");
+        goto fail;
+    }
+
+    aberth_free(work);
+    free(roots);
+    free(image);
+    return 0;
+
+    fail:
+    aberth_free(work);
+    free(roots);
+    free(image);
+    return 1;
+}
+
+
+int
+multi_start_worker(void* arg) {
+
+    Multi_Start_Job* job = arg;
+
+    for (size_t i = atomic_fetch_add(&job->next, 1); i < job->count;
+         i = atomic_fetch_add(&job->next, 1)) {
+
+        job->results[i] = find_root_opts(job->f, job->seeds[i], job->newton);
+    }
+
+    return 0;
+}
+
+
+// Returns the k-th element of the Halton sequence in the given base, a
+// quasi-random sequence that fills [0, 1) evenly at every length
+double
+halton(size_t k, const size_t base) {
+
+    double value = 0;
+    double scale = 1.0/base;
+
+    for (; k; k /= base) {
+
+        value += (k % base)*scale;
+        scale /= base;
+    }
+
+    return value;
+}
+
+
+size_t
+gcd(size_t a, size_t b) {
+
+    while (b) {
+
+        const size_t rem = a % b;
+        a = b;
+        b = rem;
+    }
+
+    return a;
+}
+
+
+// Writes the k-th starting point. Grid points are visited with a stride
+// close to the golden ratio of their count, so that every round spreads
+// over the whole region instead of sweeping it row by row.
+doubleC
+multi_start_seed(const Multi_Start_Options* opts, const size_t k) {
+
+    const double width = creal(opts->upper) - creal(opts->lower);
+    const double height = cimag(opts->upper) - cimag(opts->lower);
+
+    if (!opts->grid) {
+
+        return opts->lower + CMPLX(width*halton(k + 1, 2),
+                                   height*halton(k + 1, 3));
+    }
+
+    const size_t side = ceil(sqrt(opts->max_starts));
+    const size_t total = side*side;
+    size_t stride = total*0.618 + 1;
+    while (gcd(stride, total) != 1) {
+
+        stride++;
+    }
+
+    const size_t cell = k*stride % total;
+    return opts->lower + CMPLX(width*(cell % side + 0.5)/side,
+                               height*(cell / side + 0.5)/side);
+}
+
+
+// Cell of the spatial hash holding z; cells are tol wide
+void
+root_cell(const doubleC z, const double tol, int64_t cell[static 2]) {
+
+    cell[0] = floor(creal(z)/tol);
+    cell[1] = floor(cimag(z)/tol);
+}
+
+
+size_t
+root_slot(const int64_t x, const int64_t y) {
+
+    const uint64_t hash = (uint64_t)x*0x9E3779B97F4A7C15ull
+                          ^ (uint64_t)y*0xC2B2AE3D27D4EB4Full;
+
+    return (hash >> 32) & (ROOT_HASH_LEN - 1);
+}
+
+
+// Adds z to the roots unless one within tol is already known, looking in
+// the 3 by 3 cells around z. Returns true if z was new.
+bool
+root_hash_insert(Root_Hash* hash, const doubleC z, const double tol,
+                 doubleC roots[], const size_t max_roots, size_t* count) {
+
+    int64_t cell[2];
+    root_cell(z, tol, cell);
+
+    for (int64_t dx = -1; dx <= 1; dx++) {
+
+        for (int64_t dy = -1; dy <= 1; dy++) {
+
+            for (size_t slot = root_slot(cell[0] + dx, cell[1] + dy);
+                 hash->index[slot];
+                 slot = (slot + 1) & (ROOT_HASH_LEN - 1)) {
+
+                if (hash->cell[slot][0] == cell[0] + dx &&
+                    hash->cell[slot][1] == cell[1] + dy &&
+                    cabs(roots[hash->index[slot] - 1] - z) <= tol) {
+
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (*count >= max_roots) {
+
+        return false;
+    }
+
+    size_t slot = root_slot(cell[0], cell[1]);
+    while (hash->index[slot]) {
+
+        slot = (slot + 1) & (ROOT_HASH_LEN - 1);
+    }
+
+    roots[*count] = z;
+    hash->cell[slot][0] = cell[0];
+    hash->cell[slot][1] = cell[1];
+    hash->index[slot] = ++*count;
+    return true;
+}
+
+
+// Looks for all roots of f in the rectangle between opts->lower and
+// opts->upper by running find_root_opts from up to opts->max_starts
+// starting points on opts->thread_count threads. Starts run in rounds of
+// opts->round_len; converged roots are merged within opts->tol through a
+// spatial hash, and the search stops early once opts->patience rounds in a
+// row turn up nothing new. Up to max_roots distinct roots inside the
+// rectangle go to roots; starts that wander off to roots outside it are
+// dropped.
+Multi_Start_Result
+find_roots(doubleC(*f)(const doubleC), const Multi_Start_Options* opts,
+           const size_t max_roots, doubleC roots[static max_roots]) {
+
+    Multi_Start_Result result = {0};
+    Root_Hash* hash = calloc(1, sizeof(Root_Hash));
+    doubleC* seeds = malloc(sizeof(doubleC[opts->round_len]));
+    Newton_Root_Result* results
+        = malloc(sizeof(Newton_Root_Result[opts->round_len]));
+
+    if (!hash || !seeds || !results || !opts->round_len ||
+        max_roots >= ROOT_HASH_LEN/2 || !(opts->tol > 0)) {
+
+        free(hash);
+        free(seeds);
+        free(results);
+        result.error = UNDEFINED;
+        return result;
+    }
+
+    size_t idle_rounds = 0;
+
+    while (result.starts < opts->max_starts && idle_rounds < opts->patience) {
+
+        const size_t count = (opts->max_starts - result.starts
+                              < opts->round_len)
+                             ? opts->max_starts - result.starts
+                             : opts->round_len;
+
+        for (size_t i = 0; i < count; i++) {
+
+            seeds[i] = multi_start_seed(opts, result.starts + i);
+        }
+
+        Multi_Start_Job job = {
+            .f = f,
+            .newton = &opts->newton,
+            .seeds = seeds,
+            .results = results,
+            .count = count
+        };
+        atomic_init(&job.next, 0);
+        run_workers(multi_start_worker, &job, opts->thread_count);
+
+        bool found = false;
+        for (size_t i = 0; i < count; i++) {
+
+            const doubleC z = results[i].value;
+            if (!results[i].error &&
+                creal(z) >= creal(opts->lower) &&
+                creal(z) <= creal(opts->upper) &&
+                cimag(z) >= cimag(opts->lower) &&
+                cimag(z) <= cimag(opts->upper)) {
+
+                found |= root_hash_insert(hash, z, opts->tol,
+                                          roots, max_roots,
+                                          &result.root_count);
+            }
+        }
+
+        result.starts += count;
+        result.rounds++;
+        idle_rounds = found ? 0 : idle_rounds + 1;
+    }
+
+    free(hash);
+    free(seeds);
+    free(results);
+    return result;
+}
+
+
+int
+cmpl_order(const void* a, const void* b) {
+
+    const doubleC* za = a;
+    const doubleC* zb = b;
+
+    if (creal(*za) != creal(*zb)) {
+
+        return (creal(*za) > creal(*zb)) - (creal(*za) < creal(*zb));
+    }
+
+    return (cimag(*za) > cimag(*zb)) - (cimag(*za) < cimag(*zb));
+}
+
+
+// Runs find_roots over the square of side 2*span around the origin with
+// the given number of threads and prints the roots found in order. f_batch
+// may be NULL; see Newton_Options.
+int
+print_all_roots(doubleC(*f)(const doubleC),
+                void (*f_batch)(const size_t n, const doubleC zs[static n],
+                                doubleC ys[static n]),
+                const char* name, const double span, const double height,
+                const size_t thread_count) {
+
+    doubleC* roots = malloc(sizeof(doubleC[MAX_ROOTS]));
+    if (!roots) {
+
+        fprintf(stderr, "Failed to allocate memory.\n");
+        return 1;
+    }
+
+    const Multi_Start_Options opts = {
+        .lower = CMPLX(-span, -height),
+        .upper = CMPLX(span, height),
+        .max_starts = 100000,
+        .round_len = 256,
+        .patience = 4,
+        .tol = 1e-6,
+        .thread_count = thread_count,
+        .newton = {.method = NEWTON, .eps = 1e-10, .dz = 1e-4,
+                   .max_iterations = MAX_NEWTON_ITER, .f_batch = f_batch}
+    };
+
+    const Multi_Start_Result res = find_roots(f, &opts, MAX_ROOTS, roots);
+    if (res.error) {
+
+        fprintf(stderr, "Failed to search for roots.\n");
+        free(roots);
+        return 1;
+    }
+
+    qsort(roots, res.root_count, sizeof(doubleC), cmpl_order);
+    printf("%zu roots of f(z) = %s (%zu starts in %zu rounds) :\n",
+           res.root_count, name, res.starts, res.rounds);
+    for (size_t i = 0; i < res.root_count; i++) {
+
+        printf("    %f + %fi\n", creal(roots[i]), cimag(roots[i]));
+    }
+
+    free(roots);
+    return 0;
+}
+
+
+// Compiles formulas with known values, checking that integer exponents
+// compile to OP_POWI wherever they end, including at the end of the input.
+// Prints each failure and returns how many there were.
+size_t
+check_expr(void) {
+
+    const struct {
+        const char* src;
+        doubleC x;
+        doubleC value;
+        bool powi;
+    } cases[] = {
+        {"z^2", -3, 9, true},
+        {"(z)^3", -2, -8, true},
+        {"z^ 2", -3, 9, true},
+        {"z^2 + 1", -3, 10, true},
+        {"z^2.5", 4, 32, false},
+        {"z^2e0", 3, 9, false},
+        {"2^z", 3, 8, false},
+        {"z^3^2", 2, 512, true},
+        {"2^3^2", 0, 512, true}
+    };
+    const size_t count = sizeof(cases)/sizeof(cases[0]);
+    size_t failed = 0;
+
+    for (size_t i = 0; i < count; i++) {
+
+        Expr expr;
+        if (expr_compile(&expr, cases[i].src)) {
+
+            printf("Check of %s failed: syntax error\n", cases[i].src);
+            failed++;
+            continue;
+        }
+
+        bool powi = false;
+        bool general = false;
+        for (size_t k = 0; k < expr.length; k++) {
+
+            powi = powi || expr.code[k].op == OP_POWI;
+            general = general || expr.code[k].op == OP_POW;
+        }
+
+        const doubleC value = expr_eval(&expr, cases[i].x);
+        // Only OP_POWI on its own has to be exact
+        const bool wrong = (powi && !general) ? value != cases[i].value
+                           : cabs(value - cases[i].value)
+                             > 1e-12*cabs(cases[i].value);
+        if (powi != cases[i].powi || wrong) {
+
+            printf("Check of %s failed: %s, value %.17g + %.17gi\n",
+                   cases[i].src, powi ? "OP_POWI" : "OP_POW",
+                   creal(value), cimag(value));
+            failed++;
+        }
+    }
+
+    printf("Expression compiler: %zu of %zu checks passed\n",
+           count - failed, count);
+    return failed;
+}
+
+
+int
+main(int argc, char * argv[static argc]) {
+
+    size_t thread_count = default_thread_count();
+    size_t width = 1024;
+    size_t height = 1024;
+    const char* out_name = NULL;
+    size_t degree = 3;
+    doubleC basin_coeffs[MAX_DEGREE + 1] = {4, 5, -2, 1};
+    const char* expr_src = NULL;
+    bool multi_start = false;
+    doubleC guess = 1 + I;
+    char* end = NULL;
+    char* im_end = NULL;
+    int arg = 1;
+
+    while (arg < argc) {
+
+        if (!strcmp(argv[arg], "-j") && arg + 1 < argc) {
+
+            thread_count = strtoull(argv[arg + 1], &end, 10);
+            if (*end || !thread_count || thread_count > MAX_THREADS) {
+
+                printf(USAGE);
+                return EXIT_FAILURE;
+            }
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-s") && arg + 2 < argc) {
+
+            width = strtoull(argv[arg + 1], &end, 10);
+            if (*end || !width || width > MAX_IMAGE_SIDE) {
+
+                printf(USAGE);
+                return EXIT_FAILURE;
+            }
+            height = strtoull(argv[arg + 2], &end, 10);
+            if (*end || !height || height > MAX_IMAGE_SIDE) {
+
+                printf(USAGE);
+                return EXIT_FAILURE;
+            }
+            arg += 3;
+
+        } else if (!strcmp(argv[arg], "-p") && arg + 1 < argc) {
+
+            // Comma separated real coefficients, lowest power first
+            char* next = argv[arg + 1];
+            degree = 0;
+            basin_coeffs[0] = strtod(next, &next);
+            while (*next == ',' && degree < MAX_DEGREE) {
+
+                basin_coeffs[++degree] = strtod(next + 1, &next);
+            }
+            arg += 2;
+
+            if (*next) {
+
+                printf(USAGE);
+                return EXIT_FAILURE;
+            }
+
+        } else if (!strcmp(argv[arg], "-o") && arg + 1 < argc) {
+
+            out_name = argv[arg + 1];
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-f") && arg + 1 < argc) {
+
+            expr_src = argv[arg + 1];
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-g") && arg + 2 < argc) {
+
+            guess = CMPLX(strtod(argv[arg + 1], &end),
+                          strtod(argv[arg + 2], &im_end));
+            if (end == argv[arg + 1] || *end
+                || im_end == argv[arg + 2] || *im_end) {
+
+                printf(USAGE);
+                return EXIT_FAILURE;
+            }
+            arg += 3;
+
+        } else if (!strcmp(argv[arg], "-m")) {
+
+            multi_start = true;
+            arg++;
+
+        } else {
+
+            printf(USAGE);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!degree || basin_coeffs[degree] == 0 || (expr_src && out_name)
+        || (multi_start && !expr_src)) {
+
+        printf(USAGE);
+        return EXIT_FAILURE;
+    }
+
+    if (expr_src) {
+
+        if (expr_compile(&cli_expr, expr_src)) {
+
+            fprintf(stderr, "Syntax error at offset %zu: %s\n",
+                    cli_expr.error_pos, &expr_src[cli_expr.error_pos]);
+            return EXIT_FAILURE;
+        }
+
+        if (multi_start) {
+
+            return print_all_roots(cli_f, cli_f_batch, expr_src, MULTI_SPAN,
+                                   MULTI_SPAN, thread_count)
+                   ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+
+        const Newton_Options opts = {.method = HALLEY, .eps = 1e-9,
+                                     .dz = 1e-4,
+                                     .max_iterations = MAX_NEWTON_ITER,
+                                     .f_batch = cli_f_batch};
+        const Newton_Root_Result res = find_root_opts(cli_f, guess, &opts);
+        if (res.error) {
+
+            fprintf(stderr, "Failed to find a root.\n");
+            return EXIT_FAILURE;
+        }
+
+        printf("Root of f(z) = %s : %.12f + %.12fi\n", expr_src,
+               creal(res.value), cimag(res.value));
+        printf("    %zu iterations, %zu evaluations\n",
+               res.iterations, res.evaluations);
+        return EXIT_SUCCESS;
+    }
+    
+    // A render skips the demos and benchmarks below
+    if (out_name) {
+
+        FILE* out = fopen(out_name, "wb");
+        if (!out) {
+
+            fprintf(stderr, "Failed to open %s.\n", out_name);
+            return EXIT_FAILURE;
+        }
+
+        const int failed_render = render_basins(out, degree, basin_coeffs,
+                                                width, height, BASIN_SPAN,
+                                                thread_count);
+        fclose(out);
+        return failed_render ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (check_expr()) {
+
+        return EXIT_FAILURE;
+    }
+
+    Newton_Root_Result res1 = find_root(poly1, 1 + I, 1e-6);
+    if (res1.error) {
+
+        fprintf(stderr, "Failed to find a root.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Root #1 of p(z) = z : ");
+    printf("%f + %fi\n", creal(res1.value), cimag(res1.value));
+
+    Newton_Root_Result res2 = find_root(poly2, -1, 1e-6);
+    if (res2.error) {
+
+        fprintf(stderr, "Failed to find a root.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Root #1 of p(z) = z^3 - 2z^2 + 5z + 4 : ");
+    printf("%f + %fi\n", creal(res2.value), cimag(res2.value));
+
+    Newton_Root_Result res3 = find_root(poly2, 1.3 + 2.2*I, 1e-6);
+    if (res3.error) {
+
+        fprintf(stderr, "Failed to find a root.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Root #2 of p(z) = z^3 - 2z^2 + 5z + 4 : ");
+    printf("%f + %fi\n", creal(res3.value), cimag(res3.value));
+
+    Newton_Root_Result res4 = find_root(poly2, 1.3 - 2.2*I, 1e-6);
+    if (res4.error) {
+
+        fprintf(stderr, "Failed to find a root.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Root #3 of p(z) = z^3 - 2z^2 + 5z + 4 : ");
+    printf("%f + %fi\n", creal(res4.value), cimag(res4.value));
+
+    Newton_Root_Result res5 = find_root_dual(poly2_dual, 1.3 + 2.2*I, 1e-6);
+    if (res5.error) {
+
+        fprintf(stderr, "Failed to find a root.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Root #2 of p(z) = z^3 - 2z^2 + 5z + 4 (dual) : ");
+    printf("%f + %fi\n", creal(res5.value), cimag(res5.value));
+    printf("    %zu iterations, %zu evaluations\n",
+           res5.iterations, res5.evaluations);
+
+    // The same root in each type, with eps near the rounding error of f
+    // there, which is what the step and residual of each type allow
+    const Newton_Root_Result_f res_f = find_root(poly2f, 1.3 + 2.2*I, 1e-4f);
+    const Newton_Root_Result_ld res_ld = find_root(poly2l, 1.3 + 2.2*I,
+                                                   1e-15L);
+    if (res_f.error || res_ld.error) {
+
+        fprintf(stderr, "Failed to find a root.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Root #2 in float: %.7f + %.7fi, |p| = %.1e\n",
+           crealf(res_f.value), cimagf(res_f.value),
+           (double)cabsf(poly2f(res_f.value)));
+    printf("Root #2 in long double: %.17Lf + %.17Lfi, |p| = %.1Le\n",
+           creall(res_ld.value), cimagl(res_ld.value),
+           cabsl(poly2l(res_ld.value)));
+
+    const char* method_names[] = {
+        [NEWTON] = "Newton",
+        [DAMPED_NEWTON] = "Damped Newton",
+        [HALLEY] = "Halley"
+    };
+
+    for (Root_Method method = NEWTON; method <= HALLEY; method++) {
+
+        const Newton_Options opts = {.method = method, .eps = 1e-6,
+                                     .max_iterations = MAX_NEWTON_ITER,
+                                     .max_evaluations = 1000};
+        Newton_Root_Result res = find_root_opts(poly2, 10 + 10*I, &opts);
+        if (res.error) {
+
+            fprintf(stderr, "%s failed to find a root.\n",
+                    method_names[method]);
+            return EXIT_FAILURE;
+        }
+        printf("%s from 10 + 10i : %f + %fi\n", method_names[method],
+               creal(res.value), cimag(res.value));
+        printf("    %zu iterations, %zu evaluations\n",
+               res.iterations, res.evaluations);
+    }
+
+    if (print_all_roots(csin, NULL, "sin(z)", MULTI_SPAN, 1, thread_count)) {
+
+        return EXIT_FAILURE;
+    }
+
+    System_Work* sys_work = system_work_alloc(SYSTEM_LEN);
+    double* sys_x = malloc(sizeof(double[SYSTEM_LEN]));
+    if (!sys_work || !sys_x) {
+
+        fprintf(stderr, "Failed to allocate memory.\n");
+        system_work_free(sys_work);
+        free(sys_x);
+        return EXIT_FAILURE;
+    }
+
+    const char* system_names[] = {
+        [SYSTEM_NEWTON] = "Newton",
+        [SYSTEM_BROYDEN] = "Broyden"
+    };
+
+    for (System_Method method = SYSTEM_NEWTON; method <= SYSTEM_BROYDEN;
+         method++) {
+
+        for (size_t i = 0; i < SYSTEM_LEN; i++) {
+
+            sys_x[i] = -1;
+        }
+
+        const System_Options opts = {.method = method, .eps = 1e-10,
+                                     .max_iterations = MAX_NEWTON_ITER};
+        const clock_t sys_begin = clock();
+        const System_Result sys = solve_system(broyden_tridiagonal, NULL,
+                                               sys_x, &opts, sys_work);
+        const double sys_seconds = (double)(clock() - sys_begin)
+                                   / CLOCKS_PER_SEC;
+        if (sys.error) {
+
+            fprintf(stderr, "%s failed to solve the system.\n",
+                    system_names[method]);
+            system_work_free(sys_work);
+            free(sys_x);
+            return EXIT_FAILURE;
+        }
+
+        printf("%s on Broyden's tridiagonal system, n = %d : |F| = %.1e\n",
+               system_names[method], SYSTEM_LEN, sys.residual);
+        printf("    %zu iterations, %zu evaluations, %.3f s\n",
+               sys.iterations, sys.evaluations, sys_seconds);
+    }
+
+    system_work_free(sys_work);
+    free(sys_x);
+
+    Aberth_Workspace* work = aberth_alloc(BATCH_DEGREE);
+    doubleC* coeffs = malloc(sizeof(doubleC[BATCH_COUNT*(BATCH_DEGREE + 1)]));
+    doubleC* roots = malloc(sizeof(doubleC[BATCH_COUNT*BATCH_DEGREE]));
+    Poly_Roots_Result* results = malloc(sizeof(Poly_Roots_Result[BATCH_COUNT]));
+    if (!work || !coeffs || !roots || !results) {
+
+        fprintf(stderr, "Failed to allocate memory.\n");
+        aberth_free(work);
+        free(coeffs);
+        free(roots);
+        free(results);
+        return EXIT_FAILURE;
+    }
+
+    const doubleC poly2_coeffs[] = {4, 5, -2, 1};
+    Poly_Roots_Result all = poly_roots(work, 3, poly2_coeffs, roots, 1e-12,
+                                       MAX_ABERTH_ITER);
+    if (all.error) {
+
+        fprintf(stderr, "Failed to find the roots.\n");
+        aberth_free(work);
+        free(coeffs);
+        free(roots);
+        free(results);
+        return EXIT_FAILURE;
+    }
+    printf("All roots of p(z) = z^3 - 2z^2 + 5z + 4 (%zu iterations) :\n",
+           all.iterations);
+    for (size_t i = 0; i < 3; i++) {
+
+        printf("    %f + %fi\n", creal(roots[i]), cimag(roots[i]));
+    }
+
+    srand(1);
+    for (size_t i = 0; i < BATCH_COUNT*(BATCH_DEGREE + 1); i++) {
+
+        coeffs[i] = CMPLX(2.0*rand()/RAND_MAX - 1, 2.0*rand()/RAND_MAX - 1);
+    }
+
+    const clock_t begin = clock();
+    poly_roots_batch(work, BATCH_COUNT, BATCH_DEGREE, coeffs, roots, 1e-12,
+                     MAX_ABERTH_ITER, results);
+    const double seconds = (double)(clock() - begin)/CLOCKS_PER_SEC;
+
+    // Backward error |p(z)| / sum |c_k||z|^k of every root found
+    size_t failed = 0;
+    double max_err = 0;
+    for (size_t i = 0; i < BATCH_COUNT; i++) {
+
+        if (results[i].error) {
+
+            failed++;
+            continue;
+        }
+
+        const doubleC* c = &coeffs[i*(BATCH_DEGREE + 1)];
+        for (size_t j = 0; j < BATCH_DEGREE; j++) {
+
+            const doubleC z = roots[i*BATCH_DEGREE + j];
+            doubleC p;
+            doubleC dp;
+            horner_deriv(BATCH_DEGREE, c, z, &p, &dp);
+
+            double scale = 0;
+            for (size_t k = BATCH_DEGREE + 1; k-- > 0;) {
+
+                scale = scale*cabs(z) + cabs(c[k]);
+            }
+
+            if (cabs(p)/scale > max_err) {
+
+                max_err = cabs(p)/scale;
+            }
+        }
+    }
+
+    printf("%d polynomials of degree %d: max backward error %g, "
+           "%zu failed, %.3f s\n", BATCH_COUNT, BATCH_DEGREE, max_err,
+           failed, seconds);
+
+    aberth_free(work);
+    free(coeffs);
+    free(roots);
+    free(results);
 
     return EXIT_SUCCESS;
 }
@@ -1,7 +1,46 @@
+#include <complex.h>
+#include <ctype.h>
 #include <math.h>
+#include <float.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define COMPLEX_STEP 1e-20
+#define PRECISION_BENCH_LEN 100000
+#define RIDDERS_TABLE 10
+#define RIDDERS_SHRINK 1.4
+#define RIDDERS_SAFE 2.0
+#define DERIV_BATCH_LEN 512
+#define GRID_LEN 1000000
+#define EXPR_MAX_CODE 128
+#define EXPR_MAX_REGS 128
+#define EXPR_MAX_DEPTH 64
+#define EXPR_MAX_POWI 64
+#define EXPR_BATCH_LEN 128
+#define USAGE "Usage: ./ch2 [-f EXPR X...]\n"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DERIV_X86
+#endif
+
+// Stencil values of float or double points side by side, and the
+// comparison masks they produce (all ones for true). The plain types fill
+// the 16 byte vectors every x86-64 and ARMv8 CPU has; the avx2 types fill
+// the 32 byte vectors of AVX2, for code compiled with target("avx2,fma").
+typedef float Lanes_f __attribute__((vector_size(16)));
+typedef int32_t Lanes_Mask_f __attribute__((vector_size(16)));
+typedef double Lanes_d __attribute__((vector_size(16)));
+typedef int64_t Lanes_Mask_d __attribute__((vector_size(16)));
+#ifdef DERIV_X86
+typedef float Lanes_avx2_f __attribute__((vector_size(32)));
+typedef int32_t Lanes_Mask_avx2_f __attribute__((vector_size(32)));
+typedef double Lanes_avx2_d __attribute__((vector_size(32)));
+typedef int64_t Lanes_Mask_avx2_d __attribute__((vector_size(32)));
+#endif
 
 typedef enum Num_Deriv_Error{
     SUCCESS = 0,
@@ -9,72 +48,1267 @@ typedef enum Num_Deriv_Error{
     UNSTABLE = 2,
 } Num_Deriv_Error;
 
-typedef struct Num_Deriv_Result Num_Deriv_Result;
-struct Num_Deriv_Result{
-    
-    double value;
-    enum Num_Deriv_Error error;
-};
+typedef struct Num_Deriv_Result Num_Deriv_Result;
+struct Num_Deriv_Result{
+    
+    double value;
+    enum Num_Deriv_Error error;
+};
+
+#ifdef __SIZEOF_FLOAT128__
+#define HAVE_FLOAT128
+__extension__ typedef __float128 float128;
+#define FLOAT128_MAX (__extension__ __FLT128_MAX__)
+#define FLOAT128_EPSILON (__extension__ __FLT128_EPSILON__)
+#define FLOAT128_GENERIC(name) , float128: name##_q
+#else
+#define FLOAT128_GENERIC(name)
+#endif
+
+// Picks name_f, name_d, name_ld or name_q by the type of x
+#define DERIV_GENERIC(name, x) \
+    _Generic((x), float: name##_f, double: name##_d, \
+             long double: name##_ld FLOAT128_GENERIC(name))
+
+#define GENERIC_ABS(x) ((x) < 0 ? -(x) : (x))
+
+// Num_Deriv_Result in the other floating point types
+typedef Num_Deriv_Result Num_Deriv_Result_d;
+
+typedef struct Num_Deriv_Result_f Num_Deriv_Result_f;
+struct Num_Deriv_Result_f{
+
+    float value;
+    enum Num_Deriv_Error error;
+};
+
+typedef struct Num_Deriv_Result_ld Num_Deriv_Result_ld;
+struct Num_Deriv_Result_ld{
+
+    long double value;
+    enum Num_Deriv_Error error;
+};
+
+#ifdef HAVE_FLOAT128
+typedef struct Num_Deriv_Result_q Num_Deriv_Result_q;
+struct Num_Deriv_Result_q{
+
+    float128 value;
+    enum Num_Deriv_Error error;
+};
+#endif
+
+typedef enum {
+
+    OP_CONST,
+    OP_VAR,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_NEG,
+    OP_POW,
+    OP_POWI,
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_EXP,
+    OP_LOG,
+    OP_SQRT,
+    OP_ABS
+} Expr_Op;
+
+// dst = op(a, b) on registers; OP_CONST loads consts[a] and OP_POWI raises
+// register a to the literal power b
+typedef struct Expr_Instr Expr_Instr;
+struct Expr_Instr {
+
+    uint8_t op;
+    uint8_t dst;
+    uint8_t a;
+    uint8_t b;
+};
+
+// A formula compiled by expr_compile. The value ends up in register result.
+typedef struct Expr Expr;
+struct Expr {
+
+    size_t length;
+    size_t reg_count;
+    size_t const_count;
+    size_t result;
+    size_t error_pos;
+    Expr_Instr code[EXPR_MAX_CODE];
+    double consts[EXPR_MAX_CODE];
+};
+
+typedef struct Expr_Parser Expr_Parser;
+struct Expr_Parser {
+
+    const char* src;
+    size_t pos;
+    size_t depth;
+    bool failed;
+    Expr* expr;
+};
+
+// Names an expression may use: the variable, constants and functions
+typedef struct Expr_Name Expr_Name;
+struct Expr_Name {
+
+    const char* name;
+    Expr_Op op;
+    double value;
+};
+
+static const Expr_Name EXPR_NAMES[] = {
+    {"x", OP_VAR, 0},
+    {"pi", OP_CONST, M_PI},
+    {"e", OP_CONST, M_E},
+    {"sin", OP_SIN, 0},
+    {"cos", OP_COS, 0},
+    {"tan", OP_TAN, 0},
+    {"exp", OP_EXP, 0},
+    {"log", OP_LOG, 0},
+    {"sqrt", OP_SQRT, 0},
+    {"abs", OP_ABS, 0}
+};
+
+// Result of an adaptive derivative: the estimate, a bound on its error and
+// the number of evaluations of f that went into it
+typedef struct Adaptive_Deriv_Result Adaptive_Deriv_Result;
+struct Adaptive_Deriv_Result{
+
+    double value;
+    double error_estimate;
+    size_t evaluations;
+    enum Num_Deriv_Error error;
+};
+
+// A value together with its derivative with respect to the variable. Every
+// dual_* operation applies the chain rule as it goes, so a function written
+// in terms of them yields f(x) and the exact f'(x) from one evaluation.
+typedef struct Dual Dual;
+struct Dual {
+
+    double value;
+    double deriv;
+};
+
+
+// stencil_error and num_deriv exist once per floating point type.
+// DEFINE_NUM_DERIV writes them for type T with the suffix S, returning
+// results of type R; T_MAX is the largest finite T. The macros of the same
+// names dispatch on the type of the point with _Generic.
+#define DEFINE_NUM_DERIV(T, S, R, T_MAX)                                    \
+                                                                            \
+/* Classifies a derivative from the 5-point stencil f1..f5 and its value. */\
+/* stencil_lanes_S does the same for a vector of float or double. */        \
+Num_Deriv_Error                                                             \
+stencil_error_##S(const T f1, const T f2, const T f3, const T f4,           \
+                  const T f5, const T dfdx) {                               \
+                                                                            \
+    /* Also false for NaN */                                                \
+    const bool finite = (GENERIC_ABS(f3) <= T_MAX)                          \
+                        & (GENERIC_ABS(dfdx) <= T_MAX);                     \
+                                                                            \
+    const bool pos_monotonic = (f1 < f2) & (f2 < f3) & (f3 < f4)            \
+                               & (f4 < f5);                                 \
+    const bool neg_monotonic = (f1 > f2) & (f2 > f3) & (f3 > f4)            \
+                               & (f4 > f5);                                 \
+                                                                            \
+    const bool right_hump = ((f4 > f3) & (f4 > f5))                         \
+                            | ((f4 < f3) & (f4 < f5));                      \
+    const bool left_hump = ((f2 > f1) & (f2 > f3))                          \
+                           | ((f2 < f1) & (f2 < f3));                       \
+                                                                            \
+    const bool right_unstable = right_hump                                  \
+        & (left_hump                                                        \
+           | (GENERIC_ABS(2*f4 - f3 - f5) > GENERIC_ABS(f3 - f1)));         \
+    const bool left_unstable = left_hump                                    \
+        & (right_hump                                                       \
+           | (GENERIC_ABS(2*f2 - f1 - f3) > GENERIC_ABS(f5 - f3)));         \
+                                                                            \
+    const bool unstable = (right_unstable | left_unstable)                  \
+                          & !(pos_monotonic | neg_monotonic);               \
+                                                                            \
+    return !finite ? UNDEFINED : (unstable ? UNSTABLE : SUCCESS);           \
+}                                                                           \
+                                                                            \
+                                                                            \
+R                                                                           \
+num_deriv_##S(T(*f)(T), const T x, const T dx) {                            \
+                                                                            \
+    const T h = GENERIC_ABS(dx/2);                                          \
+    const T f1 = f(x - 2*h);                                                \
+    const T f2 = f(x - h);                                                  \
+    const T f3 = f(x);                                                      \
+    const T f4 = f(x + h);                                                  \
+    const T f5 = f(x + 2*h);                                                \
+                                                                            \
+    R result = {.value = 0, .error = SUCCESS};                              \
+                                                                            \
+    if (!(GENERIC_ABS(f3) <= T_MAX)) {                                      \
+                                                                            \
+        result.error = UNDEFINED;                                           \
+        return result;                                                      \
+    }                                                                       \
+                                                                            \
+    result.value = (f1 - 8*f2 + 8*f4 - f5) / (12*h);                        \
+    result.error = stencil_error_##S(f1, f2, f3, f4, f5, result.value);     \
+                                                                            \
+    return result;                                                          \
+}
+
+DEFINE_NUM_DERIV(float, f, Num_Deriv_Result_f, FLT_MAX)
+DEFINE_NUM_DERIV(double, d, Num_Deriv_Result, DBL_MAX)
+DEFINE_NUM_DERIV(long double, ld, Num_Deriv_Result_ld, LDBL_MAX)
+#ifdef HAVE_FLOAT128
+DEFINE_NUM_DERIV(float128, q, Num_Deriv_Result_q, FLOAT128_MAX)
+#endif
+
+#define stencil_error(f1, f2, f3, f4, f5, dfdx) \
+    DERIV_GENERIC(stencil_error, f3)(f1, f2, f3, f4, f5, dfdx)
+#define num_deriv(f, x, dx) \
+    DERIV_GENERIC(num_deriv, x)(f, x, dx)
+
+
+// The error a Ridders estimate of value may have under tol: relative to
+// |value| past 1 and absolute below, so that large derivatives can meet it
+double
+ridders_tol(const double tol, const double value) {
+
+    return tol*fmax(1, fabs(value));
+}
+
+
+// Adds row i to a Ridders tableau whose central difference table[0][i] is
+// filled in, keeping the best estimate seen in result. Column j cancels the
+// h^2j error term of column j - 1. Returns true once the error estimate
+// reaches ridders_tol or the extrapolation starts to diverge.
+bool
+ridders_row(double table[static RIDDERS_TABLE][RIDDERS_TABLE],
+            const size_t i, const double tol,
+            Adaptive_Deriv_Result* result) {
+
+    if (!i) {
+
+        result->value = table[0][0];
+        return false;
+    }
+
+    double factor = RIDDERS_SHRINK*RIDDERS_SHRINK;
+    for (size_t j = 1; j <= i; j++) {
+
+        table[j][i] = (table[j - 1][i]*factor - table[j - 1][i - 1])
+                      / (factor - 1);
+        factor *= RIDDERS_SHRINK*RIDDERS_SHRINK;
+
+        const double err = fmax(fabs(table[j][i] - table[j - 1][i]),
+                                fabs(table[j][i] - table[j - 1][i - 1]));
+        if (err <= result->error_estimate) {
+
+            result->error_estimate = err;
+            result->value = table[j][i];
+        }
+    }
+
+    return result->error_estimate <= ridders_tol(tol, result->value) ||
+           fabs(table[i][i] - table[i - 1][i - 1])
+           >= RIDDERS_SAFE*result->error_estimate;
+}
+
+
+// Classifies the final estimate of a Ridders tableau
+void
+ridders_finish(const double tol, Adaptive_Deriv_Result* result) {
+
+    if (isnan(result->value) || isinf(result->value)) {
+
+        result->value = 0;
+        result->error = UNDEFINED;
+
+    } else if (!(result->error_estimate
+                 <= ridders_tol(tol, result->value))) {
+
+        result->error = UNSTABLE;
+    }
+}
+
+
+// Ridders' method: central differences with the step h shrinking by
+// RIDDERS_SHRINK per row of a Richardson extrapolation tableau. Every row
+// costs two evaluations and is combined with all previous ones, so each
+// evaluation keeps paying off. Stops as soon as the error estimate reaches
+// tol, relative to |f'| once that is past 1, or once the extrapolation
+// starts to diverge, returning the best estimate seen. h should be large
+// enough for f to change noticeably over it; an unmet tol is reported as
+// UNSTABLE.
+Adaptive_Deriv_Result
+num_deriv_ridders(double(*f)(double), const double x, const double h,
+                  const double tol) {
+
+    double table[RIDDERS_TABLE][RIDDERS_TABLE];
+    double step = fabs(h);
+    Adaptive_Deriv_Result result = {.error_estimate = INFINITY,
+                                    .error = SUCCESS};
+
+    for (size_t i = 0; i < RIDDERS_TABLE; i++) {
+
+        if (i) {
+            step /= RIDDERS_SHRINK;
+        }
+
+        table[0][i] = (f(x + step) - f(x - step)) / (2*step);
+        result.evaluations += 2;
+
+        if (ridders_row(table, i, tol, &result)) {
+            break;
+        }
+    }
+
+    ridders_finish(tol, &result);
+    return result;
+}
+
+
+// num_deriv_ridders at the n points xs, writing to results. The tableaux
+// advance a row at a time together, and each row evaluates f_batch once on
+// both steps of every point still refining, instead of once per value.
+// Returns 0 on success, 1 if out of memory.
+int
+num_deriv_ridders_many(void (*f_batch)(const size_t n,
+                                       const double xs[static n],
+                                       double ys[static n]),
+                       const size_t n, const double xs[static n],
+                       const double h, const double tol,
+                       Adaptive_Deriv_Result results[static n]) {
+
+    double (*tables)[RIDDERS_TABLE][RIDDERS_TABLE]
+        = malloc(n*sizeof(*tables) + 1);
+    size_t* active = malloc(n*sizeof(size_t) + 1);
+    double* pts = malloc(2*n*sizeof(double) + 1);
+    double* vals = malloc(2*n*sizeof(double) + 1);
+    if (!tables || !active || !pts || !vals) {
+
+        free(tables);
+        free(active);
+        free(pts);
+        free(vals);
+        return 1;
+    }
+
+    for (size_t k = 0; k < n; k++) {
+
+        results[k] = (Adaptive_Deriv_Result) {.error_estimate = INFINITY,
+                                              .error = SUCCESS};
+        active[k] = k;
+    }
+
+    size_t count = n;
+    double step = fabs(h);
+
+    for (size_t i = 0; i < RIDDERS_TABLE && count; i++) {
+
+        if (i) {
+            step /= RIDDERS_SHRINK;
+        }
+
+        for (size_t a = 0; a < count; a++) {
+
+            pts[a] = xs[active[a]] + step;
+            pts[count + a] = xs[active[a]] - step;
+        }
+
+        f_batch(2*count, pts, vals);
+
+        size_t kept = 0;
+        for (size_t a = 0; a < count; a++) {
+
+            const size_t k = active[a];
+            tables[k][0][i] = (vals[a] - vals[count + a]) / (2*step);
+            results[k].evaluations += 2;
+
+            if (!ridders_row(tables[k], i, tol, &results[k])) {
+                active[kept++] = k;
+            }
+        }
+        count = kept;
+    }
+
+    for (size_t k = 0; k < n; k++) {
+
+        ridders_finish(tol, &results[k]);
+    }
+
+    free(tables);
+    free(active);
+    free(pts);
+    free(vals);
+    return 0;
+}
+
+
+// Computes f'(x) as Im(f(x + ih))/h from one evaluation of f_cmpl, a complex
+// extension of a real-analytic f. There is no subtraction, so h can be tiny
+// and the result is accurate to machine precision. Falls back to num_deriv
+// when f_cmpl is NULL.
+Num_Deriv_Result
+num_deriv_cs(double(*f)(double), double complex(*f_cmpl)(double complex),
+             const double x, const double dx) {
+
+    if (!f_cmpl) {
+
+        return num_deriv(f, x, dx);
+    }
+
+    const double complex fx = f_cmpl(CMPLX(x, COMPLEX_STEP));
+    Num_Deriv_Result result = {.value = cimag(fx)/COMPLEX_STEP,
+                               .error = SUCCESS};
+
+    if (isnan(creal(fx)) || isinf(creal(fx))
+        || isnan(result.value) || isinf(result.value)) {
+
+        result.value = 0;
+        result.error = UNDEFINED;
+    }
+
+    return result;
+}
+
+
+// Vectors are passed by pointer, since passing AVX-sized values by value
+// changes the ABI depending on the target flags.
+//
+// lanes_abs_V and stencil_lanes_V exist for float and double, the types
+// GCC can put in vectors. DEFINE_STENCIL_LANES writes them for type T and
+// the lane type Lanes_V, along with stencil_block_V, which runs the
+// stencil over as many whole vectors of a batch as fit. I_MAX is the
+// largest value of the integer type as wide as T, which clears the sign
+// bit. ATTR is put in front of each function, so the same code can be
+// compiled once for the baseline target and once for AVX2.
+#define DEFINE_STENCIL_LANES(T, V, I_MAX, T_MAX, ATTR)                      \
+                                                                            \
+ATTR                                                                        \
+void                                                                        \
+lanes_abs_##V(const Lanes_##V* x, Lanes_##V* abs) {                         \
+                                                                            \
+    *abs = (Lanes_##V)((Lanes_Mask_##V)*x & I_MAX);                         \
+}                                                                           \
+                                                                            \
+                                                                            \
+/* Computes the stencil derivative of a vector of points and classifies */ \
+/* each one exactly as stencil_error does, with vector compares and */      \
+/* masks in place of branches. f holds the five stencil values of every */  \
+/* point. */                                                                \
+ATTR                                                                        \
+void                                                                        \
+stencil_lanes_##V(const Lanes_##V f[static 5], const T h,                   \
+                  Lanes_##V* dfdx, Lanes_Mask_##V* error) {                 \
+                                                                            \
+    *dfdx = (f[0] - 8*f[1] + 8*f[3] - f[4]) / (12*h);                       \
+                                                                            \
+    Lanes_##V abs_value;                                                    \
+    Lanes_##V abs_dfdx;                                                     \
+    lanes_abs_##V(&f[2], &abs_value);                                       \
+    lanes_abs_##V(dfdx, &abs_dfdx);                                         \
+                                                                            \
+    /* Also false for NaN */                                                \
+    const Lanes_Mask_##V value_finite = abs_value <= T_MAX;                 \
+    const Lanes_Mask_##V finite = value_finite & (abs_dfdx <= T_MAX);       \
+                                                                            \
+    const Lanes_Mask_##V pos_monotonic = (f[0] < f[1]) & (f[1] < f[2])      \
+                                         & (f[2] < f[3]) & (f[3] < f[4]);   \
+    const Lanes_Mask_##V neg_monotonic = (f[0] > f[1]) & (f[1] > f[2])      \
+                                         & (f[2] > f[3]) & (f[3] > f[4]);   \
+                                                                            \
+    const Lanes_Mask_##V right_hump = ((f[3] > f[2]) & (f[3] > f[4]))       \
+                                      | ((f[3] < f[2]) & (f[3] < f[4]));    \
+    const Lanes_Mask_##V left_hump = ((f[1] > f[0]) & (f[1] > f[2]))        \
+                                     | ((f[1] < f[0]) & (f[1] < f[2]));     \
+                                                                            \
+    const Lanes_##V right_curve = 2*f[3] - f[2] - f[4];                     \
+    const Lanes_##V right_slope = f[2] - f[0];                              \
+    const Lanes_##V left_curve = 2*f[1] - f[0] - f[2];                      \
+    const Lanes_##V left_slope = f[4] - f[2];                               \
+    Lanes_##V abs_terms[4];                                                 \
+    lanes_abs_##V(&right_curve, &abs_terms[0]);                             \
+    lanes_abs_##V(&right_slope, &abs_terms[1]);                             \
+    lanes_abs_##V(&left_curve, &abs_terms[2]);                              \
+    lanes_abs_##V(&left_slope, &abs_terms[3]);                              \
+                                                                            \
+    const Lanes_Mask_##V right_steep = abs_terms[0] > abs_terms[1];         \
+    const Lanes_Mask_##V left_steep = abs_terms[2] > abs_terms[3];          \
+                                                                            \
+    const Lanes_Mask_##V unstable =                                         \
+        ((right_hump & (left_hump | right_steep))                           \
+         | (left_hump & (right_hump | left_steep)))                         \
+        & ~(pos_monotonic | neg_monotonic);                                 \
+                                                                            \
+    *error = (~finite & UNDEFINED) | (finite & unstable & UNSTABLE);        \
+    *dfdx = (Lanes_##V)((Lanes_Mask_##V)*dfdx & value_finite);              \
+}                                                                           \
+                                                                            \
+                                                                            \
+/* vals holds the five stencil values of len points, row by row. Returns */ \
+/* how many of the points were done. */                                     \
+ATTR                                                                        \
+size_t                                                                      \
+stencil_block_##V(const size_t len, const T vals[static 5*len],             \
+                  const T h, T out[static len],                             \
+                  Num_Deriv_Error err[static len]) {                        \
+                                                                            \
+    const size_t lane_count = sizeof(Lanes_##V)/sizeof(T);                  \
+    size_t i = 0;                                                           \
+                                                                            \
+    for (; i + lane_count <= len; i += lane_count) {                        \
+                                                                            \
+        Lanes_##V f[5];                                                     \
+        Lanes_##V dfdx;                                                     \
+        Lanes_Mask_##V error;                                               \
+                                                                            \
+        for (size_t j = 0; j < 5; j++) {                                    \
+                                                                            \
+            memcpy(&f[j], &vals[j*len + i], sizeof f[j]);                   \
+        }                                                                   \
+                                                                            \
+        stencil_lanes_##V(f, h, &dfdx, &error);                             \
+                                                                            \
+        memcpy(&out[i], &dfdx, sizeof dfdx);                                \
+        for (size_t lane = 0; lane < lane_count; lane++) {                  \
+                                                                            \
+            err[i + lane] = (Num_Deriv_Error)error[lane];                   \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    return i;                                                               \
+}
+
+DEFINE_STENCIL_LANES(float, f, INT32_MAX, FLT_MAX, )
+DEFINE_STENCIL_LANES(double, d, INT64_MAX, DBL_MAX, )
+
+#ifdef DERIV_X86
+bool
+deriv_has_avx2(void) {
+
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+DEFINE_STENCIL_LANES(float, avx2_f, INT32_MAX, FLT_MAX,
+                     __attribute__((target("avx2,fma"))))
+DEFINE_STENCIL_LANES(double, avx2_d, INT64_MAX, DBL_MAX,
+                     __attribute__((target("avx2,fma"))))
+
+// The stencil over a batch of float or double points, in 32 byte vectors
+// when the CPU has AVX2 and in the 16 byte vectors of the baseline
+// otherwise
+#define STENCIL_BLOCK(S) \
+    (deriv_has_avx2() ? stencil_block_avx2_##S : stencil_block_##S)
+#else
+#define STENCIL_BLOCK(S) stencil_block_##S
+#endif
+
+// For long double and __float128, which have no vector lanes, the batch is
+// left entirely to the scalar loop of num_deriv_many_S
+#define STENCIL_NO_LANES(len, vals, h, out, err) 0
+
+
+// Differentiates f at the n points xs with the same stencil as num_deriv,
+// writing the derivatives to out and their classification to err. f_batch
+// evaluates a whole array of points per call; the five stencil points of
+// up to DERIV_BATCH_LEN points go to it together, which amortizes the call
+// overhead, and BLOCK runs as many points per vector as fit. Written per
+// type by DEFINE_NUM_DERIV_MANY like num_deriv.
+#define DEFINE_NUM_DERIV_MANY(T, S, T_MAX, BLOCK)                           \
+                                                                            \
+void                                                                        \
+num_deriv_many_##S(void (*f_batch)(const size_t n, const T xs[static n],    \
+                                   T ys[static n]),                         \
+                   const size_t n, const T xs[static n], const T dx,        \
+                   T out[static n], Num_Deriv_Error err[static n]) {        \
+                                                                            \
+    const T h = GENERIC_ABS(dx/2);                                          \
+    T pts[5*DERIV_BATCH_LEN];                                               \
+    T vals[5*DERIV_BATCH_LEN];                                              \
+                                                                            \
+    for (size_t first = 0; first < n; first += DERIV_BATCH_LEN) {           \
+                                                                            \
+        const size_t len = (n - first < DERIV_BATCH_LEN)                    \
+                           ? n - first : DERIV_BATCH_LEN;                   \
+                                                                            \
+        /* Row j holds the points offset by (j - 2)h */                     \
+        for (size_t i = 0; i < len; i++) {                                  \
+                                                                            \
+            pts[i] = xs[first + i] - 2*h;                                   \
+            pts[len + i] = xs[first + i] - h;                               \
+            pts[2*len + i] = xs[first + i];                                 \
+            pts[3*len + i] = xs[first + i] + h;                             \
+            pts[4*len + i] = xs[first + i] + 2*h;                           \
+        }                                                                   \
+                                                                            \
+        f_batch(5*len, pts, vals);                                          \
+                                                                            \
+        size_t i = BLOCK(len, vals, h, &out[first], &err[first]);           \
+                                                                            \
+        for (; i < len; i++) {                                              \
+                                                                            \
+            const T* f = &vals[i];                                          \
+            const T dfdx = (f[0] - 8*f[len] + 8*f[3*len] - f[4*len])        \
+                           / (12*h);                                        \
+                                                                            \
+            err[first + i] = stencil_error_##S(f[0], f[len], f[2*len],      \
+                                               f[3*len], f[4*len], dfdx);   \
+            out[first + i] = (GENERIC_ABS(f[2*len]) <= T_MAX) ? dfdx : 0;   \
+        }                                                                   \
+    }                                                                       \
+}
+
+DEFINE_NUM_DERIV_MANY(float, f, FLT_MAX, STENCIL_BLOCK(f))
+DEFINE_NUM_DERIV_MANY(double, d, DBL_MAX, STENCIL_BLOCK(d))
+DEFINE_NUM_DERIV_MANY(long double, ld, LDBL_MAX, STENCIL_NO_LANES)
+#ifdef HAVE_FLOAT128
+DEFINE_NUM_DERIV_MANY(float128, q, FLOAT128_MAX, STENCIL_NO_LANES)
+#endif
+
+#define num_deriv_many(f_batch, n, xs, dx, out, err) \
+    DERIV_GENERIC(num_deriv_many, (xs)[0])(f_batch, n, xs, dx, out, err)
+
+
+
+Dual
+dual_var(const double x) {
+
+    return (Dual) {x, 1};
+}
+
+
+Dual
+dual_const(const double c) {
+
+    return (Dual) {c, 0};
+}
+
+
+Dual
+dual_add(const Dual a, const Dual b) {
+
+    return (Dual) {a.value + b.value, a.deriv + b.deriv};
+}
+
+
+Dual
+dual_sub(const Dual a, const Dual b) {
+
+    return (Dual) {a.value - b.value, a.deriv - b.deriv};
+}
+
+
+Dual
+dual_mul(const Dual a, const Dual b) {
+
+    return (Dual) {a.value*b.value, a.deriv*b.value + a.value*b.deriv};
+}
+
+
+Dual
+dual_div(const Dual a, const Dual b) {
+
+    return (Dual) {a.value/b.value,
+                   (a.deriv*b.value - a.value*b.deriv)/(b.value*b.value)};
+}
+
+
+Dual
+dual_exp(const Dual a) {
+
+    const double value = exp(a.value);
+
+    return (Dual) {value, value*a.deriv};
+}
+
+
+Dual
+dual_log(const Dual a) {
+
+    return (Dual) {log(a.value), a.deriv/a.value};
+}
+
+
+Dual
+dual_sin(const Dual a) {
+
+    return (Dual) {sin(a.value), cos(a.value)*a.deriv};
+}
+
+
+Dual
+dual_cos(const Dual a) {
+
+    return (Dual) {cos(a.value), -sin(a.value)*a.deriv};
+}
+
+
+// Computes a^b. A constant exponent uses the power rule, which unlike
+// d/dx exp(b log a) also holds for negative bases.
+Dual
+dual_pow(const Dual a, const Dual b) {
+
+    const double value = pow(a.value, b.value);
+
+    if (!b.deriv) {
+
+        return (Dual) {value, b.value*pow(a.value, b.value - 1)*a.deriv};
+    }
+
+    return (Dual) {value,
+                   value*(b.deriv*log(a.value) + b.value*a.deriv/a.value)};
+}
+
+
+// Computes f'(x) exactly from one evaluation of f on dual numbers
+Num_Deriv_Result
+dual_deriv(Dual(*f)(Dual), const double x) {
+
+    const Dual fx = f(dual_var(x));
+    Num_Deriv_Result result = {.value = fx.deriv, .error = SUCCESS};
+
+    if (isnan(fx.value) || isinf(fx.value)
+        || isnan(fx.deriv) || isinf(fx.deriv)) {
+
+        result.value = 0;
+        result.error = UNDEFINED;
+    }
+
+    return result;
+}
+
+
+// Evaluates every instruction of expr across n points at a time, so the
+// cost of decoding an instruction is paid once per EXPR_BATCH_LEN points
+// rather than once per point
+void
+expr_eval_batch(const Expr* expr, const size_t n, const double xs[static n],
+                double ys[static n]) {
+
+    double regs[expr->reg_count][EXPR_BATCH_LEN];
+
+    for (size_t first = 0; first < n; first += EXPR_BATCH_LEN) {
+
+        const size_t len = (n - first < EXPR_BATCH_LEN)
+                           ? n - first : EXPR_BATCH_LEN;
+        const double* x = &xs[first];
+
+        for (size_t pc = 0; pc < expr->length; pc++) {
+
+            const Expr_Instr in = expr->code[pc];
+            double* d = regs[in.dst];
+
+            switch (in.op) {
+
+                case OP_CONST:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = expr->consts[in.a];
+                    }
+                    break;
+
+                case OP_VAR:
+                    memcpy(d, x, sizeof(double[len]));
+                    break;
+
+                case OP_ADD:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] + regs[in.b][i];
+                    }
+                    break;
+
+                case OP_SUB:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] - regs[in.b][i];
+                    }
+                    break;
+
+                case OP_MUL:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] * regs[in.b][i];
+                    }
+                    break;
+
+                case OP_DIV:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] / regs[in.b][i];
+                    }
+                    break;
+
+                case OP_NEG:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = -regs[in.a][i];
+                    }
+                    break;
+
+                case OP_POW:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = pow(regs[in.a][i], regs[in.b][i]);
+                    }
+                    break;
+
+                // Exponent in in.b, by repeated squaring
+                case OP_POWI:
+                    for (size_t i = 0; i < len; i++) {
+
+                        double power = 1;
+                        double base = regs[in.a][i];
+                        for (unsigned e = in.b; e; e >>= 1) {
+
+                            if (e & 1) {
+                                power *= base;
+                            }
+                            base *= base;
+                        }
+                        d[i] = power;
+                    }
+                    break;
+
+                case OP_SIN:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = sin(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_COS:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = cos(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_TAN:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = tan(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_EXP:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = exp(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_LOG:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = log(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_SQRT:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = sqrt(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_ABS:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = fabs(regs[in.a][i]);
+                    }
+                    break;
+            }
+        }
+
+        memcpy(&ys[first], regs[expr->result], sizeof(double[len]));
+    }
+}
+
+
+double
+expr_eval(const Expr* expr, const double x) {
+
+    double y;
+    expr_eval_batch(expr, 1, &x, &y);
+
+    return y;
+}
+
+
+// Appends an instruction writing to a fresh register and returns that
+// register, or -1 once the program or register file is full
+int
+expr_emit(Expr_Parser* parser, const Expr_Op op, const int a, const int b) {
+
+    Expr* expr = parser->expr;
+
+    if (a < 0 || b < 0 || expr->length >= EXPR_MAX_CODE
+        || expr->reg_count >= EXPR_MAX_REGS) {
+
+        parser->failed = true;
+        return -1;
+    }
+
+    expr->code[expr->length++] = (Expr_Instr) {
+        .op = op, .dst = expr->reg_count, .a = a, .b = b
+    };
+
+    return expr->reg_count++;
+}
+
+
+void
+expr_skip_space(Expr_Parser* parser) {
+
+    while (isspace((unsigned char)parser->src[parser->pos])) {
+
+        parser->pos++;
+    }
+}
+
+
+bool
+expr_accept(Expr_Parser* parser, const char c) {
+
+    expr_skip_space(parser);
+    if (parser->src[parser->pos] != c) {
+
+        return false;
+    }
+
+    parser->pos++;
+    return true;
+}
+
+
+int expr_parse_sum(Expr_Parser* parser);
+int expr_parse_unary(Expr_Parser* parser);
+
+
+// primary = number | variable | constant | function "(" sum ")" | "(" sum ")"
+int
+expr_parse_primary(Expr_Parser* parser) {
+
+    Expr* expr = parser->expr;
+    expr_skip_space(parser);
+    const char* start = &parser->src[parser->pos];
+
+    if (isdigit((unsigned char)*start) || *start == '.') {
+
+        char* end = NULL;
+        const double value = strtod(start, &end);
+        if (end == start || expr->const_count >= EXPR_MAX_CODE) {
+
+            parser->failed = true;
+            return -1;
+        }
+
+        parser->pos += end - start;
+        expr->consts[expr->const_count] = value;
+        return expr_emit(parser, OP_CONST, expr->const_count++, 0);
+    }
+
+    if (expr_accept(parser, '(')) {
+
+        const int reg = expr_parse_sum(parser);
+        if (!expr_accept(parser, ')')) {
+
+            parser->failed = true;
+            return -1;
+        }
+        return reg;
+    }
+
+    size_t name_len = 0;
+    while (isalpha((unsigned char)start[name_len])) {
+
+        name_len++;
+    }
+
+    if (!name_len) {
+
+        parser->failed = true;
+        return -1;
+    }
+    parser->pos += name_len;
+
+    for (size_t i = 0; i < sizeof(EXPR_NAMES)/sizeof(EXPR_NAMES[0]); i++) {
+
+        if (strlen(EXPR_NAMES[i].name) != name_len
+            || strncmp(EXPR_NAMES[i].name, start, name_len)) {
+            continue;
+        }
+
+        if (EXPR_NAMES[i].op == OP_VAR) {
+
+            return expr_emit(parser, OP_VAR, 0, 0);
+        }
+
+        if (EXPR_NAMES[i].op == OP_CONST) {
+
+            if (expr->const_count >= EXPR_MAX_CODE) {
+
+                parser->failed = true;
+                return -1;
+            }
+
+            expr->consts[expr->const_count] = EXPR_NAMES[i].value;
+            return expr_emit(parser, OP_CONST, expr->const_count++, 0);
+        }
+
+        if (!expr_accept(parser, '(')) {
+
+            parser->failed = true;
+            return -1;
+        }
+
+        const int arg = expr_parse_sum(parser);
+        if (!expr_accept(parser, ')')) {
+
+            parser->failed = true;
+            return -1;
+        }
+
+        return expr_emit(parser, EXPR_NAMES[i].op, arg, 0);
+    }
+
+    parser->pos -= name_len;
+    parser->failed = true;
+    return -1;
+}
+
+
+// power = primary ["^" unary], right associative. Small integer literal
+// exponents compile to OP_POWI, which stays exact for negative bases.
+int
+expr_parse_power(Expr_Parser* parser) {
+
+    const int base = expr_parse_primary(parser);
+
+    if (parser->failed || !expr_accept(parser, '^')) {
+
+        return base;
+    }
 
+    expr_skip_space(parser);
+    const char* start = &parser->src[parser->pos];
+    char* end = NULL;
+    const long exponent = strtol(start, &end, 10);
 
-Num_Deriv_Result 
-num_deriv(double(*f)(double), const double x, const double dx) {
-    
-    const double h = fabs(dx/2);
-    const double f1 = f(x - 2*h);
-    const double f2 = f(x - h);
-    const double f3 = f(x);
-    const double f4 = f(x + h);
-    const double f5 = f(x + 2*h);
-    
-    Num_Deriv_Result result = {.value = 0, .error = SUCCESS};
+    // A literal followed by another ^ is the base of a power itself, which
+    // the general path below handles right-associatively
+    const char* next = end;
+    while (isspace((unsigned char)*next)) {
+        next++;
+    }
 
-    if (isnan(f3) || isinf(f3)) {
+    if (end != start && isdigit((unsigned char)*start)
+        && exponent <= EXPR_MAX_POWI
+        && (*end == '\0' || !strchr(".eE", *end)) && *next != '^') {
 
-        result.error = UNDEFINED;
-        return result;
+        parser->pos += end - start;
+        return expr_emit(parser, OP_POWI, base, exponent);
     }
 
-    const double dfdx = (f1 - 8*f2 + 8*f4 - f5) / (12*h);
-    result.value = dfdx;
-    
-    if (isnan(dfdx) || isinf(dfdx)) {
+    const int power = expr_parse_unary(parser);
+    return expr_emit(parser, OP_POW, base, power);
+}
 
-        result.error = UNDEFINED;
-        return result;
+
+// unary = "-" unary | "+" unary | power. Every level of nesting passes
+// through here, so this is where the recursion depth is bounded.
+int
+expr_parse_unary(Expr_Parser* parser) {
+
+    int reg = -1;
+
+    if (++parser->depth > EXPR_MAX_DEPTH) {
+
+        parser->failed = true;
+
+    } else if (expr_accept(parser, '-')) {
+
+        reg = expr_emit(parser, OP_NEG, expr_parse_unary(parser), 0);
+
+    } else if (expr_accept(parser, '+')) {
+
+        reg = expr_parse_unary(parser);
+
+    } else {
+
+        reg = expr_parse_power(parser);
     }
-    
-    const bool pos_monotonic = (f1 < f2 && f2 < f3 && f3 < f4 && f4 < f5);
-    const bool neg_monotonic = (f1 > f2 && f2 > f3 && f3 > f4 && f4 > f5);
 
-    if (pos_monotonic || neg_monotonic) { 
+    parser->depth--;
+    return reg;
+}
+
+
+// product = unary {("*" | "/") unary}
+int
+expr_parse_product(Expr_Parser* parser) {
+
+    int reg = expr_parse_unary(parser);
 
-        return result;
+    while (!parser->failed) {
+
+        if (expr_accept(parser, '*')) {
+
+            reg = expr_emit(parser, OP_MUL, reg, expr_parse_unary(parser));
+
+        } else if (expr_accept(parser, '/')) {
+
+            reg = expr_emit(parser, OP_DIV, reg, expr_parse_unary(parser));
+
+        } else {
+
+            break;
+        }
     }
-    
-    const bool right_hump = (f3 > f3 && f4 > f5) || (f4 < f3 && f4 < f5);
-    const bool left_hump = (f2 > f1 && f2 > f3) || (f2 < f1 && f2 < f3); 
 
-    if (right_hump) {
-        
-        if (left_hump || fabs(2*f4 - f3 - f5) > fabs(f3 - f1)) { 
-            
-            result.error = UNSTABLE;
-            return result;
+    return reg;
+}
+
+
+// sum = product {("+" | "-") product}
+int
+expr_parse_sum(Expr_Parser* parser) {
+
+    int reg = expr_parse_product(parser);
+
+    while (!parser->failed) {
+
+        if (expr_accept(parser, '+')) {
+
+            reg = expr_emit(parser, OP_ADD, reg, expr_parse_product(parser));
+
+        } else if (expr_accept(parser, '-')) {
+
+            reg = expr_emit(parser, OP_SUB, reg, expr_parse_product(parser));
+
+        } else {
+
+            break;
         }
     }
 
-    if (left_hump) {
-        
-        if (right_hump || fabs(2*f2 - f1 - f3) > fabs(f5 - f3)) {
-            
-            result.error = UNSTABLE;
-            return result;
+    return reg;
+}
+
+
+// Compiles src into expr. Every node of the expression gets its own
+// register, so the program is a straight line with no stack. Returns 0 on
+// success and 1 on a syntax error, leaving its offset in expr->error_pos.
+int
+expr_compile(Expr* expr, const char* src) {
+
+    *expr = (Expr) {0};
+    Expr_Parser parser = {.src = src, .expr = expr};
+
+    const int result = expr_parse_sum(&parser);
+    expr_skip_space(&parser);
+
+    if (parser.failed || result < 0 || src[parser.pos]) {
+
+        expr->error_pos = parser.pos;
+        return 1;
+    }
+
+    expr->result = result;
+    return 0;
+}
+
+
+// The formula given on the command line, behind the batched function
+// pointer signature the derivative routines take
+static Expr cli_expr;
+
+
+void
+cli_f_batch(const size_t n, const double xs[static n], double ys[static n]) {
+
+    expr_eval_batch(&cli_expr, n, xs, ys);
+}
+
+
+// Differentiates the formula src at the points given as strings, with both
+// the batched stencil and Ridders' method
+int
+deriv_cli(const char* src, const size_t n, char* points[static n]) {
+
+    if (expr_compile(&cli_expr, src)) {
+
+        fprintf(stderr, "Syntax error at offset %zu: %s\n",
+                cli_expr.error_pos, &src[cli_expr.error_pos]);
+        return EXIT_FAILURE;
+    }
+
+    const char* err_txt[] = {
+        [SUCCESS] = "Solution is valid.",
+        [UNDEFINED] = "Derivative does not exist.",
+        [UNSTABLE] = "Derivative is unstable."
+    };
+    double* xs = malloc(sizeof(double[n]));
+    double* derivs = malloc(sizeof(double[n]));
+    Num_Deriv_Error* errors = malloc(sizeof(Num_Deriv_Error[n]));
+    Adaptive_Deriv_Result* adaptive = malloc(sizeof(Adaptive_Deriv_Result[n]));
+    if (!xs || !derivs || !errors || !adaptive) {
+
+        fprintf(stderr, "Failed to allocate memory.\n");
+        free(xs);
+        free(derivs);
+        free(errors);
+        free(adaptive);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+
+        char* end = NULL;
+        xs[i] = strtod(points[i], &end);
+        if (end == points[i] || *end) {
+
+            printf(USAGE);
+            free(xs);
+            free(derivs);
+            free(errors);
+            free(adaptive);
+            return EXIT_FAILURE;
         }
-        
     }
-    
-    return result;
+
+    num_deriv_many(cli_f_batch, n, xs, 1e-6, derivs, errors);
+    if (num_deriv_ridders_many(cli_f_batch, n, xs, 0.1, 1e-12, adaptive)) {
+
+        fprintf(stderr, "Failed to allocate memory.\n");
+        free(xs);
+        free(derivs);
+        free(errors);
+        free(adaptive);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+
+        printf("d/dx (%s) @ %g\n", src, xs[i]);
+        if (!errors[i]) {
+
+            printf("    stencil: %.15g\n", derivs[i]);
+
+        } else {
+
+            printf("    stencil: %s\n", err_txt[errors[i]]);
+        }
+
+        const Adaptive_Deriv_Result ares = adaptive[i];
+        if (!ares.error) {
+
+            printf("    Ridders: %.15g +- %.1e (%zu evaluations)\n",
+                   ares.value, ares.error_estimate, ares.evaluations);
+
+        } else {
+
+            printf("    Ridders: %s\n", err_txt[ares.error]);
+        }
+    }
+
+    free(xs);
+    free(derivs);
+    free(errors);
+    free(adaptive);
+    return EXIT_SUCCESS;
 }
 
 
@@ -106,8 +1340,281 @@ testf4(const double x) {
 }
 
 
+double complex
+testf2_cmpl(const double complex x) {
+
+    return x*x;
+}
+
+
+double complex
+testf3_cmpl(const double complex x) {
+
+    return ccos(1.0/x);
+}
+
+
+Dual
+testf2_dual(const Dual x) {
+
+    return dual_mul(x, x);
+}
+
+
+Dual
+testf3_dual(const Dual x) {
+
+    return dual_cos(dual_div(dual_const(1.0), x));
+}
+
+
+Dual
+testf4_dual(const Dual x) {
+
+    return dual_pow(x, dual_const(0.333));
+}
+
+
+// 1/(1 + x^2) and its benchmark in type T. The function is pure
+// arithmetic, so every type computes it without a libm of its own, and the
+// step is chosen as eps^(1/5), which balances the h^4 truncation error of
+// the stencil against rounding.
+#define DEFINE_PRECISION_BENCH(T, S, T_EPSILON)                             \
+                                                                            \
+T                                                                           \
+runge_##S(const T x) {                                                      \
+                                                                            \
+    return 1/(1 + x*x);                                                     \
+}                                                                           \
+                                                                            \
+                                                                            \
+void                                                                        \
+runge_batch_##S(const size_t n, const T xs[static n], T ys[static n]) {     \
+                                                                            \
+    for (size_t i = 0; i < n; i++) {                                        \
+                                                                            \
+        ys[i] = 1/(1 + xs[i]*xs[i]);                                        \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+                                                                            \
+/* Times num_deriv one point at a time and num_deriv_many over the whole */ \
+/* range, which is where the lane count of the narrower types shows. The */ \
+/* rates mean little in the default sanitized -O0 build, which checks */    \
+/* every array access of the batched path; build with make CFLAGS=-O2. */   \
+void                                                                        \
+bench_num_deriv_##S(const char* name) {                                     \
+                                                                            \
+    const T dx = 2*pow(T_EPSILON, 0.2);                                     \
+    long double max_err = 0;                                                \
+    size_t failed = 0;                                                      \
+    size_t failed_many = 0;                                                 \
+                                                                            \
+    T* xs = malloc(PRECISION_BENCH_LEN*sizeof(T));                          \
+    T* out = malloc(PRECISION_BENCH_LEN*sizeof(T));                         \
+    Num_Deriv_Error* err = malloc(PRECISION_BENCH_LEN*sizeof(*err));        \
+    if (!xs || !out || !err) {                                              \
+                                                                            \
+        fprintf(stderr, "Out of memory\n");                                 \
+        free(xs);                                                           \
+        free(out);                                                          \
+        free(err);                                                          \
+        return;                                                             \
+    }                                                                       \
+                                                                            \
+    const clock_t begin = clock();                                          \
+    for (size_t i = 0; i < PRECISION_BENCH_LEN; i++) {                      \
+                                                                            \
+        const T x = (T)i/PRECISION_BENCH_LEN*4 - 2;                         \
+        const T exact = -2*x/((1 + x*x)*(1 + x*x));                         \
+        const Num_Deriv_Result_##S res = num_deriv(runge_##S, x, dx);       \
+        const T diff = res.value - exact;                                   \
+                                                                            \
+        failed += res.error != SUCCESS;                                     \
+        if (GENERIC_ABS(diff) > max_err) {                                  \
+            max_err = GENERIC_ABS(diff);                                    \
+        }                                                                   \
+    }                                                                       \
+    const double seconds = (double)(clock() - begin)/CLOCKS_PER_SEC;        \
+                                                                            \
+    /* Writing out and err first keeps page faults out of the timing */      \
+    for (size_t i = 0; i < PRECISION_BENCH_LEN; i++) {                      \
+                                                                            \
+        xs[i] = (T)i/PRECISION_BENCH_LEN*4 - 2;                             \
+        out[i] = 0;                                                         \
+        err[i] = SUCCESS;                                                   \
+    }                                                                       \
+    const clock_t begin_many = clock();                                     \
+    num_deriv_many(runge_batch_##S, PRECISION_BENCH_LEN, xs, dx, out, err); \
+    const double seconds_many =                                             \
+        (double)(clock() - begin_many)/CLOCKS_PER_SEC;                      \
+                                                                            \
+    for (size_t i = 0; i < PRECISION_BENCH_LEN; i++) {                      \
+                                                                            \
+        const T x = xs[i];                                                  \
+        const T diff = out[i] + 2*x/((1 + x*x)*(1 + x*x));                  \
+                                                                            \
+        failed_many += err[i] != SUCCESS;                                   \
+        if (GENERIC_ABS(diff) > max_err) {                                  \
+            max_err = GENERIC_ABS(diff);                                    \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    printf("%-12s %2zu bytes: %6.2f M/s, batched %7.2f M/s, "               \
+           "max error %.1Le, %zu/%zu failed\n",                             \
+           name, sizeof(T), PRECISION_BENCH_LEN/seconds*1e-6,               \
+           PRECISION_BENCH_LEN/seconds_many*1e-6, max_err, failed,          \
+           failed_many);                                                    \
+                                                                            \
+    free(xs);                                                               \
+    free(out);                                                              \
+    free(err);                                                              \
+}
+
+DEFINE_PRECISION_BENCH(float, f, FLT_EPSILON)
+DEFINE_PRECISION_BENCH(double, d, DBL_EPSILON)
+DEFINE_PRECISION_BENCH(long double, ld, LDBL_EPSILON)
+#ifdef HAVE_FLOAT128
+DEFINE_PRECISION_BENCH(float128, q, FLOAT128_EPSILON)
+#endif
+
+
+void
+batch_sin(const size_t n, const double xs[static n], double ys[static n]) {
+
+    for (size_t i = 0; i < n; i++) {
+
+        ys[i] = sin(xs[i]);
+    }
+}
+
+
+// Compiles formulas with known values, checking that integer exponents
+// compile to OP_POWI wherever they end, including at the end of the input.
+// Prints each failure and returns how many there were.
+size_t
+check_expr(void) {
+
+    const struct {
+        const char* src;
+        double x;
+        double value;
+        bool powi;
+    } cases[] = {
+        {"x^2", -3, 9, true},
+        {"(x)^3", -2, -8, true},
+        {"x^ 2", -3, 9, true},
+        {"x^2 + 1", -3, 10, true},
+        {"x^2.5", 4, 32, false},
+        {"x^2e0", 3, 9, false},
+        {"2^x", 3, 8, false},
+        {"x^3^2", 2, 512, true},
+        {"2^3^2", 0, 512, true}
+    };
+    const size_t count = sizeof(cases)/sizeof(cases[0]);
+    size_t failed = 0;
+
+    for (size_t i = 0; i < count; i++) {
+
+        Expr expr;
+        if (expr_compile(&expr, cases[i].src)) {
+
+            printf("Check of %s failed: syntax error\n", cases[i].src);
+            failed++;
+            continue;
+        }
+
+        bool powi = false;
+        bool general = false;
+        for (size_t k = 0; k < expr.length; k++) {
+
+            powi = powi || expr.code[k].op == OP_POWI;
+            general = general || expr.code[k].op == OP_POW;
+        }
+
+        const double value = expr_eval(&expr, cases[i].x);
+        // Only OP_POWI on its own has to be exact
+        const bool wrong = (powi && !general) ? value != cases[i].value
+                           : fabs(value - cases[i].value)
+                             > 1e-12*fabs(cases[i].value);
+        if (powi != cases[i].powi || wrong) {
+
+            printf("Check of %s failed: %s, value %.17g\n",
+                   cases[i].src, powi ? "OP_POWI" : "OP_POW", value);
+            failed++;
+        }
+    }
+
+    printf("Expression compiler: %zu of %zu checks passed\n",
+           count - failed, count);
+    return failed;
+}
+
+
+// Runs Ridders' method with the tolerance of the command line on formulas
+// with known derivatives, large ones included, which only a tolerance
+// relative to |f'| lets converge. Prints each failure and returns how many
+// there were.
+size_t
+check_ridders(void) {
+
+    const struct {
+        const char* src;
+        double x;
+        double deriv;
+    } cases[] = {
+        {"sin(x)", 1, 0.54030230586813972},
+        {"exp(x)", 30, 1.0686474581524462e13},
+        {"x^64", 2, 5.9029581035870565e20}
+    };
+    const size_t count = sizeof(cases)/sizeof(cases[0]);
+    size_t failed = 0;
+
+    for (size_t i = 0; i < count; i++) {
+
+        Adaptive_Deriv_Result res = {0};
+        if (expr_compile(&cli_expr, cases[i].src) ||
+            num_deriv_ridders_many(cli_f_batch, 1, &cases[i].x, 0.1, 1e-12,
+                                   &res)) {
+
+            printf("Check of d/dx %s failed: no result\n", cases[i].src);
+            failed++;
+            continue;
+        }
+
+        if (res.error || fabs(res.value - cases[i].deriv)
+                         > 1e-10*fabs(cases[i].deriv)) {
+
+            printf("Check of d/dx %s failed: error %d, value %.17g\n",
+                   cases[i].src, res.error, res.value);
+            failed++;
+        }
+    }
+
+    printf("Ridders' method: %zu of %zu checks passed\n",
+           count - failed, count);
+    return failed;
+}
+
+
 int
-main() {
+main(int argc, char * argv[static argc]) {
+
+    if (argc > 1) {
+
+        if (argc < 4 || strcmp(argv[1], "-f")) {
+
+            printf(USAGE);
+            return EXIT_FAILURE;
+        }
+
+        return deriv_cli(argv[2], argc - 3, &argv[3]);
+    }
+
+    if (check_expr() || check_ridders()) {
+
+        return EXIT_FAILURE;
+    }
 
     const double EPS = 1e-9;
     Num_Deriv_Result res = {0};
@@ -187,6 +1694,142 @@ main() {
         printf("Cannot compute the derivative! %s\n", err_txt[res.error]);
     }
 
+    res = dual_deriv(testf2_dual, -1.0);
+    if (!res.error) {
+        
+        printf("Dual: d/dx (x^2) @ -1.0 = %f\n", res.value);
+        
+    } else {
+
+        printf("Cannot compute the derivative! %s\n", err_txt[res.error]);
+    }
+
+    res = dual_deriv(testf3_dual, 1.0/3.141592654);
+    if (!res.error) {
+        
+        printf("Dual: d/dx (cos(1/x)) @ 1/pi = %f\n", res.value);
+
+    } else {
+
+        printf("Cannot compute the derivative! %s\n", err_txt[res.error]);
+    }
+
+    res = dual_deriv(testf4_dual, 0.0);
+    if (!res.error) {
+
+        printf("Dual: d/dx (x^0.333) @ 0.0 = %f\n", res.value);
+
+    } else {
+
+        printf("Cannot compute the derivative! %s\n", err_txt[res.error]);
+    }
+
+    res = num_deriv_cs(testf3, testf3_cmpl, 1.0/3.141592654, EPS);
+    if (!res.error) {
+
+        printf("Complex step: d/dx (cos(1/x)) @ 1/pi = %f\n", res.value);
+
+    } else {
+
+        printf("Cannot compute the derivative! %s\n", err_txt[res.error]);
+    }
+
+    res = num_deriv_cs(testf2, testf2_cmpl, 5.0e-10, EPS);
+    if (!res.error) {
+
+        printf("Complex step: d/dx (x^2) @ 5.0e-10 = %g\n", res.value);
+
+    } else {
+
+        printf("Cannot compute the derivative! %s\n", err_txt[res.error]);
+    }
+
+    res = num_deriv_cs(testf4, NULL, 0.0, EPS);
+    if (!res.error) {
+
+        printf("Complex step: d/dx (x^0.333) @ 0.0 = %f\n", res.value);
+
+    } else {
+
+        printf("Cannot compute the derivative! %s\n", err_txt[res.error]);
+    }
+
+    Adaptive_Deriv_Result ares = num_deriv_ridders(testf3, 1.0/3.141592654,
+                                                   0.01, 1e-10);
+    if (!ares.error) {
+
+        printf("Ridders: d/dx (cos(1/x)) @ 1/pi = %f +- %.1e "
+               "(%zu evaluations)\n", ares.value, ares.error_estimate,
+               ares.evaluations);
+
+    } else {
+
+        printf("Cannot compute the derivative! %s\n", err_txt[ares.error]);
+    }
+
+    ares = num_deriv_ridders(testf4, 0.0, 0.1, 1e-10);
+    if (!ares.error) {
+
+        printf("Ridders: d/dx (x^0.333) @ 0.0 = %f +- %.1e "
+               "(%zu evaluations)\n", ares.value, ares.error_estimate,
+               ares.evaluations);
+
+    } else {
+
+        printf("Cannot compute the derivative! %s\n", err_txt[ares.error]);
+    }
+
+    double* grid = malloc(sizeof(double[GRID_LEN]));
+    double* derivs = malloc(sizeof(double[GRID_LEN]));
+    Num_Deriv_Error* errors = malloc(sizeof(Num_Deriv_Error[GRID_LEN]));
+    if (!grid || !derivs || !errors) {
+
+        fprintf(stderr, "Failed to allocate memory.\n");
+        free(grid);
+        free(derivs);
+        free(errors);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < GRID_LEN; i++) {
+
+        grid[i] = 10.0*i/GRID_LEN;
+    }
+
+    const clock_t begin = clock();
+    num_deriv_many(batch_sin, GRID_LEN, grid, 1e-3, derivs, errors);
+    const double seconds = (double)(clock() - begin)/CLOCKS_PER_SEC;
+
+    double max_err = 0;
+    size_t failed = 0;
+    for (size_t i = 0; i < GRID_LEN; i++) {
+
+        if (errors[i]) {
+
+            failed++;
+
+        } else if (fabs(derivs[i] - cos(grid[i])) > max_err) {
+
+            max_err = fabs(derivs[i] - cos(grid[i]));
+        }
+    }
+
+    printf("d/dx (sin(x)) on %d points in [0, 10): max error %g, "
+           "%zu failed, %.3f s\n", GRID_LEN, max_err, failed, seconds);
+
+    free(errors);
+    free(derivs);
+    free(grid);
+
+    printf("d/dx (1/(1 + x^2)) on %d points in [-2, 2):\n",
+           PRECISION_BENCH_LEN);
+    bench_num_deriv_f("float");
+    bench_num_deriv_d("double");
+    bench_num_deriv_ld("long double");
+#ifdef HAVE_FLOAT128
+    bench_num_deriv_q("__float128");
+#endif
+
     return EXIT_SUCCESS;
 }
 
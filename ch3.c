@@ -7,8 +7,42 @@
 #include <stdint.h>
 #include <math.h>
 #include <stdbool.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <inttypes.h>
 
 #define BBP_SUMMATION_LIMIT 6ll
+#define DIGIT_CHUNK_LEN 16ll
+#define BLOCK_CHUNK_LEN 256ll
+#define FIXED_BITS 128
+#define VERIFY_SHIFT 3
+#define LANE_MOD_LIMIT (1ll << 26)
+#define LANE_SCALE 0x1p26
+#define LANE_ROUND 0x1.8p52
+#define STREAM_BLOCK_LEN 4096ll
+#define CKPT_NAME_LEN 255
+#define USAGE "Usage: ./ch3 [-j THREADS] [-b | -w | -k bbp|bellard|chudnovsky] " \
+              "[-V STRIDE] [-r] [-o FILE [-c CHECKPOINT]] [START] STOP\n"
+#define MAX_THREADS 256
+#define WINDOW_LIMBS 32
+#define WINDOW_CHUNK_LEN 4096ll
+#define KARATSUBA_CUTOFF 32
+#define NEWTON_GUARD_BITS 16
+#define CHUD_GUARD_BITS 64
+#define CHUD_BITS_PER_TERM 47.11
+#define CHUD_THREAD_MIN_TERMS 64
+#define CHUD_A 13591409ull
+#define CHUD_B 545140134ull
+#define CHUD_C3_OVER_24 10939058860032000ull
+#define CHUD_D 426880ull
+#define CHUD_E 10005ull
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+// One lane per BBP series, in the order plus_k = 1, 4, 5, 6
+typedef double Lanes __attribute__((vector_size(4*sizeof(double))));
+typedef int64_t Lanes_Int __attribute__((vector_size(4*sizeof(int64_t))));
 
 typedef struct Powers Powers;
 struct Powers {
@@ -27,19 +61,131 @@ struct Sums {
     long double s4;
 };
 
+// Running sums of the four series. whole holds exact integers in units of
+// 2^-26 and part the rounded remainder, which together carry about 80 bits
+// of each term instead of the 64 of a long double.
+typedef struct Lane_Sums Lane_Sums;
+struct Lane_Sums {
+    Lanes whole;
+    Lanes part;
+};
+
+// A fraction in [0, 1) in units of 2^-128, together with a bound on how far
+// the exact value may lie from it in the same units. Arithmetic wraps
+// modulo 2^128, which is exactly reduction modulo 1.
+typedef struct Fixed_Frac Fixed_Frac;
+struct Fixed_Frac {
+    uint128_t value;
+    uint128_t error;
+};
+
+// Where the printer is in the output. Text output is grouped in tens and
+// wrapped at 60 digits, indented under "pi = 3." when it starts at digit 0.
+// Raw output packs two digits per byte, high nibble first.
+typedef struct Digit_Layout Digit_Layout;
+struct Digit_Layout {
+    bool raw;
+    bool prefix;
+    size_t col_counter;
+    size_t col_offset;
+};
+
+// frac(16^n * pi) to 64*WINDOW_LIMBS bits in little-endian limbs, with a
+// bound on its error in units of the lowest bit
+typedef struct Window Window;
+struct Window {
+    uint64_t value[WINDOW_LIMBS];
+    uint64_t error[WINDOW_LIMBS];
+};
+
+// Computes frac(16^n * pi) in fixed point with some digit-extraction formula
+typedef Fixed_Frac Digit_Kernel(const int64_t n);
+
+// Shared state of a parallel digit extraction. Workers claim chunks of
+// digits from next until the range is exhausted, so the costlier high
+// digits are spread over whichever threads are free. Without a kernel the
+// digits come one at a time from hex_digit, or from a sliding window.
+typedef struct Digit_Job Digit_Job;
+struct Digit_Job {
+    int64_t start;
+    int64_t stop;
+    int8_t* digits;
+    Digit_Kernel* kernel;
+    bool sliding;
+    atomic_int_least64_t next;
+};
+
+// Arbitrary-precision integer in sign-magnitude form, little-endian limbs
+typedef struct Big_Num Big_Num;
+struct Big_Num {
+    uint64_t* limbs;
+    size_t len;
+    size_t cap;
+    bool negative;
+};
+
+// The three products of a range of the Chudnovsky series, see chud_split
+typedef struct Split_Terms Split_Terms;
+struct Split_Terms {
+    Big_Num p;
+    Big_Num q;
+    Big_Num t;
+};
+
+// Half of a binary splitting range handed to another thread
+typedef struct Split_Job Split_Job;
+struct Split_Job {
+    int64_t a;
+    int64_t b;
+    unsigned depth;
+    Split_Terms result;
+};
+
+// Shared state of a verification run: windows at start, start + stride, ...
+// are handed out through next, and every disagreement is counted.
+typedef struct Verify_Job Verify_Job;
+struct Verify_Job {
+    int64_t start;
+    int64_t stop;
+    int64_t stride;
+    atomic_int_least64_t next;
+    atomic_int_least64_t mismatches;
+};
+
+
+// Computes a*b mod m for residues a, b < m without overflowing. Moduli
+// that fit in 32 bits keep the whole product in a native 64-bit register.
+uint64_t
+mul_mod(const uint64_t a, const uint64_t b, const uint64_t mod) {
+
+    if (mod <= UINT32_MAX) {
+
+        return (a*b) % mod;
+    }
+
+    return (uint64_t)(((uint128_t)a * b) % mod);
+}
 
+
+// Computes base^exp mod m by binary square-and-multiply in O(log exp)
 int64_t
 mod_power(int64_t base, int64_t exp, int64_t mod) {
 
-    int64_t result = 1;
+    uint64_t result = 1;
+    uint64_t square = (uint64_t)base % (uint64_t)mod;
+
+    while (exp > 0) {
 
-    for (int64_t k = 0; k < exp; k++) {
+        if (exp & 1) {
+
+            result = mul_mod(result, square, mod);
+        }
 
-        result *= base;
-        result %= mod;
+        square = mul_mod(square, square, mod);
+        exp >>= 1;
     }
 
-    return result;
+    return (int64_t)result;
 }
 
 
@@ -92,16 +238,134 @@ bbp_short_sum(int64_t n, int64_t plus_k) {
 }
 
 
+// Rounds every lane to the nearest integer, valid for |x| < 2^51. Vectors
+// are passed by pointer throughout, since passing AVX-sized values by value
+// changes the ABI depending on the target flags.
+void
+lanes_round(Lanes* x) {
+
+    *x = (*x + LANE_ROUND) - LANE_ROUND;
+}
+
+
+// Replaces a with a*b mod m in every lane for residues |a|, |b| <= m/2 + 1
+// and m < 2^26. The product and q*m are exact in a double, so the result
+// is an exact residue, again balanced around zero.
+void
+lanes_mul_mod(Lanes* a, const Lanes* b, const Lanes* mod,
+              const Lanes* inv_mod) {
+
+    const Lanes product = *a * *b;
+    Lanes quot = product * *inv_mod;
+
+    lanes_round(&quot);
+    *a = product - quot * *mod;
+}
+
+
+void
+lanes_power(Lanes* result, int64_t exp, const Lanes* mod,
+            const Lanes* inv_mod) {
+
+    const Lanes one = {1, 1, 1, 1};
+    Lanes square = {16, 16, 16, 16};
+
+    lanes_mul_mod(&square, &one, mod, inv_mod);
+    *result = one;
+
+    while (exp > 0) {
+
+        if (exp & 1) {
+
+            lanes_mul_mod(result, &square, mod, inv_mod);
+        }
+
+        lanes_mul_mod(&square, &square, mod, inv_mod);
+        exp >>= 1;
+    }
+}
+
+
+// Adds residue/mod to every lane. The quotient is split at 2^-26 so that
+// its high part is an exact integer and only the low part is rounded.
+void
+lanes_add_frac(Lane_Sums* sums, const Lanes* residue, const Lanes* mod,
+               const Lanes* inv_mod) {
+
+    const Lanes scaled = *residue * LANE_SCALE;
+    Lanes quot = scaled * *inv_mod;
+
+    lanes_round(&quot);
+    sums->whole += quot;
+    sums->part += (scaled - quot * *mod) * *inv_mod;
+}
+
+
+Sums
+lanes_to_sums(const Lane_Sums* sums) {
+
+    Lanes wraps = sums->whole/LANE_SCALE;
+    long double frac[4];
+    long double int_part;
+
+    lanes_round(&wraps);
+    const Lanes whole = sums->whole - wraps*LANE_SCALE;
+
+    for (size_t i = 0; i < 4; i++) {
+
+        frac[i] = modfl(((long double)whole[i] + sums->part[i])/LANE_SCALE,
+                        &int_part);
+    }
+
+    return (Sums) {frac[0], frac[1], frac[2], frac[3]};
+}
+
+
+// Evaluates the head sums of all four BBP series (k <= n) at once, modulo 1.
+// Terms with moduli below LANE_MOD_LIMIT run as vector lanes; the rest, if
+// any, fall back to the scalar mod_power.
+Sums
+bbp_head_sums(const int64_t n) {
+
+    const Lanes plus_k = {1, 4, 5, 6};
+    Lane_Sums lanes = {{0}, {0}};
+    int64_t k = 0;
+
+    for (; k <= n && 8*k + 6 < LANE_MOD_LIMIT; k++) {
+
+        const Lanes mod = 8*(double)k + plus_k;
+        const Lanes inv_mod = 1.0/mod;
+        Lanes residue;
+
+        lanes_power(&residue, n - k, &mod, &inv_mod);
+        lanes_add_frac(&lanes, &residue, &mod, &inv_mod);
+    }
+
+    Sums sums = lanes_to_sums(&lanes);
+
+    for (; k <= n; k++) {
+
+        sums.s1 += (long double)mod_power(16, n - k, 8*k + 1)/(8*k + 1);
+        sums.s2 += (long double)mod_power(16, n - k, 8*k + 4)/(8*k + 4);
+        sums.s3 += (long double)mod_power(16, n - k, 8*k + 5)/(8*k + 5);
+        sums.s4 += (long double)mod_power(16, n - k, 8*k + 6)/(8*k + 6);
+    }
+
+    return sums;
+}
+
+
 int8_t
 hex_digit(const int64_t n) {
     
     long double frac_parts = 0.0;
     long double int_part;
+    const Sums sums = bbp_head_sums(n);
 
-    frac_parts += 4 * modfl(bbp_sum(n, 1), &int_part);
-    frac_parts -= 2 * modfl(bbp_sum(n, 4), &int_part);
-    frac_parts -= modfl(bbp_sum(n, 5), &int_part);
-    frac_parts -= modfl(bbp_sum(n, 6), &int_part);
+    frac_parts += 4 * modfl(sums.s1 + bbp_short_sum(n, 1), &int_part);
+    frac_parts -= 2 * modfl(sums.s2 + bbp_short_sum(n, 4), &int_part);
+    frac_parts -= modfl(sums.s3 + bbp_short_sum(n, 5), &int_part);
+    frac_parts -= modfl(sums.s4 + bbp_short_sum(n, 6), &int_part);
 
     frac_parts = modfl(frac_parts, &int_part);
     if (frac_parts < 0.0) {
@@ -113,6 +377,173 @@ hex_digit(const int64_t n) {
 }
 
 
+// Returns floor(2^128 * num/den) for num < den by two steps of long division
+uint128_t
+fixed_div(const uint64_t num, const uint64_t den) {
+
+    const uint128_t high = ((uint128_t)num << 64) / den;
+    const uint64_t rem = (uint64_t)(((uint128_t)num << 64) - high*den);
+    const uint128_t low = ((uint128_t)rem << 64) / den;
+
+    return (high << 64) | low;
+}
+
+
+// Same series as bbp_sum, reduced modulo 1 and accumulated in fixed point.
+// Every term is truncated, so the exact value lies in [value, value + error].
+Fixed_Frac
+bbp_fixed_sum(const int64_t n, const int64_t plus_k) {
+
+    Fixed_Frac result = {0, 0};
+
+    for (int64_t k = 0; k <= n; k++) {
+
+        const uint64_t mod = 8*k + plus_k;
+        result.value += fixed_div(mod_power(16, n - k, mod), mod);
+        result.error++;
+    }
+
+    for (int64_t k = n + 1; 4*(k - n) < FIXED_BITS; k++) {
+
+        result.value += fixed_div(1, 8*k + plus_k) >> 4*(k - n);
+        result.error++;
+    }
+
+    // The terms dropped from the tail add up to less than one unit
+    result.error++;
+    return result;
+}
+
+
+// Computes the fractional part of 16^n * pi, i.e. the hex digits of pi
+// from position n onwards, in fixed point.
+Fixed_Frac
+bbp_fixed(const int64_t n) {
+
+    const Fixed_Frac s1 = bbp_fixed_sum(n, 1);
+    const Fixed_Frac s2 = bbp_fixed_sum(n, 4);
+    const Fixed_Frac s3 = bbp_fixed_sum(n, 5);
+    const Fixed_Frac s4 = bbp_fixed_sum(n, 6);
+
+    return (Fixed_Frac) {
+        .value = 4*s1.value - 2*s2.value - s3.value - s4.value,
+        .error = 4*s1.error + 2*s2.error + s3.error + s4.error,
+    };
+}
+
+
+// Writes the leading hex digits of frac that are the same at both ends of
+// its error interval, at most max of them, and returns their count. When
+// not even the first digit is certain, it is still written as a best guess
+// so that callers always make progress.
+size_t
+fixed_digits(const Fixed_Frac frac, const size_t max,
+             int8_t digits[static max]) {
+
+    const uint128_t lower = frac.value - frac.error;
+    const uint128_t upper = frac.value + frac.error;
+    size_t count = 0;
+
+    if (lower < upper) {
+
+        while (count < max && count < FIXED_BITS/4) {
+
+            const unsigned shift = FIXED_BITS - 4*(count + 1);
+            const int8_t digit = (int8_t)((lower >> shift) & 0xf);
+
+            if (digit != (int8_t)((upper >> shift) & 0xf)) {
+
+                break;
+            }
+
+            digits[count] = digit;
+            count++;
+        }
+    }
+
+    if (!count) {
+
+        digits[0] = (int8_t)(frac.value >> (FIXED_BITS - 4));
+        count = 1;
+    }
+
+    return count;
+}
+
+
+// One series of Bellard's formula,
+//   pi = 1/2^6 sum_k (-1)^k/2^(10k) (-2^5/(4k+1) - 1/(4k+3) + 2^8/(10k+1)
+//        - 2^6/(10k+3) - 2^2/(10k+5) - 2^2/(10k+7) + 1/(10k+9)),
+// scaled by 2^(4n) and reduced modulo 1 like bbp_fixed_sum. Terms are
+// added or subtracted, so here the exact value lies within value +- error.
+Fixed_Frac
+bellard_fixed_sum(const int64_t n, const int64_t shift, const int64_t mult,
+                  const int64_t plus_k, const bool negative) {
+
+    Fixed_Frac result = {0, 0};
+
+    for (int64_t k = 0; 4*n + shift - 10*k > -FIXED_BITS; k++) {
+
+        const int64_t exp = 4*n + shift - 10*k;
+        const uint64_t mod = mult*k + plus_k;
+        uint128_t term = 0;
+
+        if (exp >= 0) {
+
+            term = fixed_div(mod_power(2, exp, mod), mod);
+
+        } else if (mod == 1) {
+
+            // fixed_div(1, 1) would already have wrapped around to 0
+            term = (uint128_t)1 << (FIXED_BITS + exp);
+
+        } else {
+
+            term = fixed_div(1, mod) >> -exp;
+        }
+
+        if ((k & 1) != negative) {
+
+            result.value -= term;
+
+        } else {
+
+            result.value += term;
+        }
+        result.error++;
+    }
+
+    result.error++;
+    return result;
+}
+
+
+// Computes the same fraction as bbp_fixed from Bellard's formula. Its seven
+// series need about 30% fewer terms than the four of BBP.
+Fixed_Frac
+bellard_fixed(const int64_t n) {
+
+    const Fixed_Frac s[] = {
+        bellard_fixed_sum(n, 5 - 6, 4, 1, true),
+        bellard_fixed_sum(n, 0 - 6, 4, 3, true),
+        bellard_fixed_sum(n, 8 - 6, 10, 1, false),
+        bellard_fixed_sum(n, 6 - 6, 10, 3, true),
+        bellard_fixed_sum(n, 2 - 6, 10, 5, true),
+        bellard_fixed_sum(n, 2 - 6, 10, 7, true),
+        bellard_fixed_sum(n, 0 - 6, 10, 9, false),
+    };
+    Fixed_Frac result = {0, 0};
+
+    for (size_t i = 0; i < sizeof s/sizeof s[0]; i++) {
+
+        result.value += s[i].value;
+        result.error += s[i].error;
+    }
+
+    return result;
+}
+
+
 void
 generate_power_series(const size_t n, Powers arr[static (n + 1)]) {
 
@@ -178,7 +609,7 @@ hex_sequence_imprecise(const int64_t start, const int64_t stop,
 
 void
 hex_sequence(const int64_t start, const int64_t stop,
-             int8_t digits[static (stop + 1)]) {
+             int8_t digits[static (stop - start + 1)]) {
     
     long double int_part;
     Powers* powers = malloc(sizeof(Powers[stop + 1]));
@@ -200,9 +631,23 @@ hex_sequence(const int64_t start, const int64_t stop,
     for (int64_t n = start; n <= stop; n++) {
         
         long double frac_parts = 0.0;
-        Sums sums = {0.0, 0.0, 0.0, 0.0};
+        Lane_Sums lanes = {{0}, {0}};
+        long k = 0;
+
+        for (; k <= n && 8*k + 6 < LANE_MOD_LIMIT; k++) {
 
-        for (long k = 0; k <= n; k++) {
+            const Lanes mod = 8*(double)k + (Lanes){1, 4, 5, 6};
+            const Lanes inv_mod = 1.0/mod;
+            Lanes_Int power;
+
+            memcpy(&power, &powers[k], sizeof power);
+            const Lanes residue = __builtin_convertvector(power, Lanes);
+            lanes_add_frac(&lanes, &residue, &mod, &inv_mod);
+        }
+
+        Sums sums = lanes_to_sums(&lanes);
+
+        for (; k <= n; k++) {
 
             sums.s1 += (long double)(powers[k].s1)/(8*k + 1);
             sums.s2 += (long double)(powers[k].s2)/(8*k + 4);
@@ -230,93 +675,1400 @@ hex_sequence(const int64_t start, const int64_t stop,
  }
 
 
+void
+window_digits(const int64_t first, const int64_t last,
+              int8_t digits[static (last - first + 1)]);
+
+
 int
-main(int argc, char * argv[static argc]) {
+hex_digit_worker(void* arg) {
+
+    Digit_Job* const job = arg;
+    const int64_t chunk_len = job->sliding ? WINDOW_CHUNK_LEN
+                              : job->kernel ? BLOCK_CHUNK_LEN
+                              : DIGIT_CHUNK_LEN;
+
+    for (;;) {
+
+        const int64_t first = atomic_fetch_add(&job->next, chunk_len);
+        if (first > job->stop) {
 
-    size_t start = 0;
-    size_t stop = 0;
-    char N_str[21] = {0};
-    char ** end = NULL;
-    
-    switch (argc) {
-        
-        case 2:
-            strncpy(N_str, argv[1], 20);
-            stop = strtoll(N_str, end, 10) - 1;
-            break;
-    
-        case 3:
-            strncpy(N_str, argv[1], 20);
-            start = strtoll(N_str, end, 10);
-            strncpy(N_str, argv[2], 20);
-            stop = strtoll(N_str, end, 10);
             break;
+        }
 
-        default:
-            printf("Usage: ./ch3 [START] STOP\n");
-            return EXIT_FAILURE;
-    }
+        int64_t last = first + chunk_len - 1;
+        if (last > job->stop) {
 
+            last = job->stop;
+        }
 
-    if (stop < start) {
+        if (job->sliding) {
 
-        printf("Usage: ./ch3 [START] STOP\n");
-        return EXIT_FAILURE;
-    }
-    
-    int8_t * pi_digits = malloc(sizeof(int8_t[stop - start + 1]));
-    if (!pi_digits) {
-        printf("Memory error.");
-        return EXIT_FAILURE;
+            window_digits(first, last, &job->digits[first - job->start]);
+            continue;
+        }
+
+        for (int64_t n = first; n <= last;) {
+
+            if (job->kernel) {
+
+                n += fixed_digits(job->kernel(n), last - n + 1,
+                                  &job->digits[n - job->start]);
+
+            } else {
+
+                job->digits[n - job->start] = hex_digit(n);
+                n++;
+            }
+        }
     }
-    
-    if (argc == 3) {
 
-        hex_sequence(start, stop, pi_digits);
+    return 0;
+}
 
-    } else {
 
-        for (size_t digit = 0; digit <= stop; digit++) {
+// Runs worker on up to thread_count threads sharing job. The calling thread
+// is one of the workers, so a failure to spawn threads only costs
+// parallelism.
+void
+run_workers(thrd_start_t worker, void* job, size_t thread_count) {
+
+    thrd_t threads[MAX_THREADS];
+    size_t spawned = 0;
+
+    if (thread_count > MAX_THREADS) {
+
+        thread_count = MAX_THREADS;
+    }
+
+    while (spawned + 1 < thread_count) {
 
-            pi_digits[digit] = hex_digit(digit);
+        if (thrd_create(&threads[spawned], worker, job) != thrd_success) {
+
+            break;
         }
+        spawned++;
     }
 
-    size_t col_counter = 0;
-    size_t col_offset = 0;
-    if (!start) {
+    worker(job);
+
+    for (size_t t = 0; t < spawned; t++) {
 
-        printf("pi = 3.");
-        col_counter = 6;
-        col_offset = 6;
+        thrd_join(threads[t], NULL);
     }
- 
-    for (size_t digit = 0; digit < stop - start + 1; digit++) {
+}
 
-        printf("%x", pi_digits[digit]);
-        col_counter++;
-        
-        if (col_counter == 65 + col_offset) {
-            
-            if (!start) {
 
-                printf("\n       ");
+// Computes digits start..stop on up to thread_count threads, either one
+// hex_digit at a time, in blocks of certain digits given a kernel, or by
+// sliding a window along each chunk.
+void
+hex_digits_parallel(const int64_t start, const int64_t stop,
+                    int8_t digits[static (stop - start + 1)],
+                    const size_t thread_count, Digit_Kernel* kernel,
+                    const bool sliding) {
 
-            } else {
+    Digit_Job job = {.start = start, .stop = stop, .digits = digits,
+                     .kernel = kernel, .sliding = sliding};
+    atomic_init(&job.next, start);
 
-                printf("\n");
-            }
+    run_workers(hex_digit_worker, &job, thread_count);
+}
+
+
+int
+verify_worker(void* arg) {
+
+    Verify_Job* const job = arg;
+    int8_t bbp_digits[FIXED_BITS/4];
+    int8_t bellard_digits[FIXED_BITS/4];
+
+    for (;;) {
+
+        const int64_t n = atomic_fetch_add(&job->next, job->stride);
+        if (n > job->stop) {
+
+            break;
+        }
+
+        const size_t bbp_count = fixed_digits(bbp_fixed(n), FIXED_BITS/4,
+                                              bbp_digits);
+        const size_t bellard_count = fixed_digits(
+            bellard_fixed(n + VERIFY_SHIFT), FIXED_BITS/4, bellard_digits);
+
+        size_t overlap = 0;
+        bool agree = bbp_count > VERIFY_SHIFT;
 
-            col_counter = col_offset;
+        for (; agree && overlap + VERIFY_SHIFT < bbp_count
+               && overlap < bellard_count; overlap++) {
 
-        } else if (col_counter >= (10 + col_offset) 
-                   && !((col_counter - 10 - col_offset) % 11)) {
+            agree = (bbp_digits[overlap + VERIFY_SHIFT]
+                     == bellard_digits[overlap]);
+        }
+
+        if (!agree) {
 
-            printf(" ");
-            col_counter++;
+            atomic_fetch_add(&job->mismatches, 1);
+            printf("Mismatch in the window at digit %" PRId64 "\n", n);
         }
     }
-    printf("\n");
+
+    return 0;
+}
+
+
+// Computes windows of digits at start, start + stride, ... up to stop with
+// both BBP and Bellard's formula. The Bellard window starts VERIFY_SHIFT
+// digits later, so the two also cross-check the positions. Returns the
+// number of windows in which they disagree.
+int64_t
+verify_digits(const int64_t start, const int64_t stop, const int64_t stride,
+              const size_t thread_count) {
+
+    Verify_Job job = {.start = start, .stop = stop, .stride = stride};
+    atomic_init(&job.next, start);
+    atomic_init(&job.mismatches, 0);
+
+    run_workers(verify_worker, &job, thread_count);
+
+    return atomic_load(&job.mismatches);
+}
+
+
+// Returns the carry of r = a + b, where r and a have n limbs and b has m <= n
+uint64_t
+limbs_add(const size_t n, uint64_t r[static n], const uint64_t a[static n],
+          const size_t m, const uint64_t b[static m]) {
+
+    uint64_t carry = 0;
+
+    for (size_t i = 0; i < n; i++) {
+
+        const uint128_t sum = (uint128_t)a[i] + (i < m ? b[i] : 0) + carry;
+        r[i] = (uint64_t)sum;
+        carry = (uint64_t)(sum >> 64);
+    }
+
+    return carry;
+}
+
+
+// Returns the borrow of r = a - b, where r and a have n limbs and b has m <= n
+uint64_t
+limbs_sub(const size_t n, uint64_t r[static n], const uint64_t a[static n],
+          const size_t m, const uint64_t b[static m]) {
+
+    uint64_t borrow = 0;
+
+    for (size_t i = 0; i < n; i++) {
+
+        const uint128_t diff = (uint128_t)a[i] - (i < m ? b[i] : 0) - borrow;
+        r[i] = (uint64_t)diff;
+        borrow = (uint64_t)(diff >> 64) & 1;
+    }
+
+    return borrow;
+}
+
+
+// Returns the sign of a - b for numbers of n and m limbs
+int
+limbs_cmp(size_t n, const uint64_t a[static n], size_t m,
+          const uint64_t b[static m]) {
+
+    while (n && !a[n - 1]) {
+
+        n--;
+    }
+
+    while (m && !b[m - 1]) {
+
+        m--;
+    }
+
+    if (n != m) {
+
+        return (n > m) ? 1 : -1;
+    }
+
+    while (n--) {
+
+        if (a[n] != b[n]) {
+
+            return (a[n] > b[n]) ? 1 : -1;
+        }
+    }
+
+    return 0;
+}
+
+
+void
+limbs_mul_school(const size_t n, const uint64_t a[static n], const size_t m,
+                 const uint64_t b[static m], uint64_t r[static (n + m)]) {
+
+    memset(r, 0, sizeof(uint64_t[n + m]));
+
+    for (size_t i = 0; i < n; i++) {
+
+        uint64_t carry = 0;
+
+        for (size_t j = 0; j < m; j++) {
+
+            const uint128_t prod = (uint128_t)a[i]*b[j] + r[i + j] + carry;
+            r[i + j] = (uint64_t)prod;
+            carry = (uint64_t)(prod >> 64);
+        }
+
+        r[i + m] = carry;
+    }
+}
+
+
+void* 
+big_alloc(const size_t size) {
+
+    void* const mem = malloc(size);
+
+    if (!mem) {
+
+        printf("Failed to allocate a big number.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return mem;
+}
+
+
+void
+limbs_mul(size_t n, const uint64_t a[static n], size_t m,
+          const uint64_t b[static m], uint64_t r[static (n + m)]);
+
+
+// Multiplies two numbers of n limbs each as
+//   (a1 X + a0)(b1 X + b0) = a1 b1 X^2 + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) X
+//                            + a0 b0,
+// with three half-size products instead of four.
+void
+limbs_mul_karatsuba(const size_t n, const uint64_t a[static n],
+                    const uint64_t b[static n], uint64_t r[static 2*n]) {
+
+    const size_t low = n/2;
+    const size_t high = n - low;
+    uint64_t* const sums = big_alloc(sizeof(uint64_t[2*(high + 1)]));
+    uint64_t* const mid = big_alloc(sizeof(uint64_t[2*(high + 1)]));
+    uint64_t* const sum_a = sums;
+    uint64_t* const sum_b = sums + high + 1;
+
+    sum_a[high] = limbs_add(high, sum_a, a + low, low, a);
+    sum_b[high] = limbs_add(high, sum_b, b + low, low, b);
+
+    limbs_mul(low, a, low, b, r);
+    limbs_mul(high, a + low, high, b + low, r + 2*low);
+    limbs_mul(high + 1, sum_a, high + 1, sum_b, mid);
+
+    limbs_sub(2*(high + 1), mid, mid, 2*low, r);
+    limbs_sub(2*(high + 1), mid, mid, 2*high, r + 2*low);
+
+    // The middle product fits in 2*high + 1 limbs once the others are gone
+    limbs_add(n + high, r + low, r + low, 2*high + 1, mid);
+
+    free(mid);
+    free(sums);
+}
+
+
+// Computes r = a*b. Balanced operands above KARATSUBA_CUTOFF limbs go through
+// Karatsuba; a much longer operand is cut into pieces the length of the
+// shorter one.
+void
+limbs_mul(size_t n, const uint64_t a[static n], size_t m,
+          const uint64_t b[static m], uint64_t r[static (n + m)]) {
+
+    if (n < m) {
+
+        const uint64_t* const swap = a;
+        const size_t len = n;
+        a = b;
+        b = swap;
+        n = m;
+        m = len;
+    }
+
+    if (m < KARATSUBA_CUTOFF) {
+
+        limbs_mul_school(n, a, m, b, r);
+        return;
+    }
+
+    if (n == m) {
+
+        limbs_mul_karatsuba(n, a, b, r);
+        return;
+    }
+
+    uint64_t* const piece = big_alloc(sizeof(uint64_t[2*m]));
+    memset(r, 0, sizeof(uint64_t[n + m]));
+
+    for (size_t offset = 0; offset < n; offset += m) {
+
+        const size_t len = (n - offset < m) ? n - offset : m;
+
+        limbs_mul(len, a + offset, m, b, piece);
+        limbs_add(n + m - offset, r + offset, r + offset, len + m, piece);
+    }
+
+    free(piece);
+}
+
+
+void
+big_reserve(Big_Num* x, const size_t cap) {
+
+    if (x->cap >= cap) {
+
+        return;
+    }
+
+    uint64_t* const limbs = realloc(x->limbs, sizeof(uint64_t[cap]));
+    if (!limbs) {
+
+        printf("Failed to allocate a big number.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    x->limbs = limbs;
+    x->cap = cap;
+}
+
+
+void
+big_trim(Big_Num* x) {
+
+    while (x->len && !x->limbs[x->len - 1]) {
+
+        x->len--;
+    }
+
+    if (!x->len) {
+
+        x->negative = false;
+    }
+}
+
+
+void
+big_set_u64(Big_Num* x, const uint64_t value) {
+
+    big_reserve(x, 1);
+    x->limbs[0] = value;
+    x->len = 1;
+    x->negative = false;
+    big_trim(x);
+}
+
+
+void
+big_free(Big_Num* x) {
+
+    free(x->limbs);
+    *x = (Big_Num) {0};
+}
+
+
+// Computes r = a*b; r may be one of the operands
+void
+big_mul(Big_Num* r, const Big_Num* a, const Big_Num* b) {
+
+    if (!a->len || !b->len) {
+
+        r->len = 0;
+        r->negative = false;
+        return;
+    }
+
+    const size_t len = a->len + b->len;
+    uint64_t* const limbs = big_alloc(sizeof(uint64_t[len]));
+    const bool negative = a->negative != b->negative;
+
+    limbs_mul(a->len, a->limbs, b->len, b->limbs, limbs);
+
+    free(r->limbs);
+    *r = (Big_Num) {.limbs = limbs, .len = len, .cap = len,
+                    .negative = negative};
+    big_trim(r);
+}
+
+
+void
+big_mul_u64(Big_Num* x, const uint64_t mult) {
+
+    uint64_t carry = 0;
+
+    for (size_t i = 0; i < x->len; i++) {
+
+        const uint128_t prod = (uint128_t)x->limbs[i]*mult + carry;
+        x->limbs[i] = (uint64_t)prod;
+        carry = (uint64_t)(prod >> 64);
+    }
+
+    if (carry) {
+
+        big_reserve(x, x->len + 1);
+        x->limbs[x->len++] = carry;
+    }
+
+    big_trim(x);
+}
+
+
+// Computes r = a + b with signs; r may be one of the operands
+void
+big_add(Big_Num* r, const Big_Num* a, const Big_Num* b) {
+
+    if (a->len < b->len) {
+
+        const Big_Num* const swap = a;
+        a = b;
+        b = swap;
+    }
+
+    const size_t len = a->len + 1;
+    uint64_t* const limbs = big_alloc(sizeof(uint64_t[len]));
+    bool negative = a->negative;
+
+    if (a->negative == b->negative) {
+
+        limbs[a->len] = limbs_add(a->len, limbs, a->limbs, b->len, b->limbs);
+
+    } else if (limbs_cmp(a->len, a->limbs, b->len, b->limbs) >= 0) {
+
+        limbs_sub(a->len, limbs, a->limbs, b->len, b->limbs);
+        limbs[a->len] = 0;
+
+    } else {
+
+        // Here |a| < |b| although a has at least as many limbs
+        limbs_sub(a->len, limbs, b->limbs, a->len, a->limbs);
+        limbs[a->len] = 0;
+        negative = b->negative;
+    }
+
+    free(r->limbs);
+    *r = (Big_Num) {.limbs = limbs, .len = len, .cap = len,
+                    .negative = negative};
+    big_trim(r);
+}
+
+
+// Computes x = |x| * 2^shift with the sign kept, shift may be negative
+void
+big_shift(Big_Num* x, const int64_t shift) {
+
+    if (!x->len || !shift) {
+
+        return;
+    }
+
+    if (shift > 0) {
+
+        const size_t limb_shift = shift/64;
+        const unsigned bit_shift = shift%64;
+
+        big_reserve(x, x->len + limb_shift + 1);
+        x->limbs[x->len + limb_shift] = 0;
+
+        for (size_t i = x->len; i-- > 0;) {
+
+            x->limbs[i + limb_shift + 1] |= bit_shift
+                ? x->limbs[i] >> (64 - bit_shift) : 0;
+            x->limbs[i + limb_shift] = x->limbs[i] << bit_shift;
+        }
+
+        memset(x->limbs, 0, sizeof(uint64_t[limb_shift]));
+        x->len += limb_shift + 1;
+
+    } else {
+
+        const size_t limb_shift = -shift/64;
+        const unsigned bit_shift = -shift%64;
+
+        if (limb_shift >= x->len) {
+
+            x->len = 0;
+            big_trim(x);
+            return;
+        }
+
+        for (size_t i = 0; i + limb_shift < x->len; i++) {
+
+            const uint64_t next = (i + limb_shift + 1 < x->len && bit_shift)
+                                  ? x->limbs[i + limb_shift + 1]
+                                    << (64 - bit_shift)
+                                  : 0;
+            x->limbs[i] = (x->limbs[i + limb_shift] >> bit_shift) | next;
+        }
+
+        x->len -= limb_shift;
+    }
+
+    big_trim(x);
+}
+
+
+void
+big_copy(Big_Num* r, const Big_Num* x) {
+
+    big_reserve(r, x->len ? x->len : 1);
+    memcpy(r->limbs, x->limbs, sizeof(uint64_t[x->len]));
+    r->len = x->len;
+    r->negative = x->negative;
+}
+
+
+int64_t
+big_bit_length(const Big_Num* x) {
+
+    if (!x->len) {
+
+        return 0;
+    }
+
+    uint64_t top = x->limbs[x->len - 1];
+    int64_t bits = 64*(x->len - 1);
+
+    while (top) {
+
+        top >>= 1;
+        bits++;
+    }
+
+    return bits;
+}
+
+
+// Returns the top 64 bits of a positive x, with the leading bit set
+uint64_t
+big_top_bits(const Big_Num* x) {
+
+    Big_Num top = {0};
+
+    big_copy(&top, x);
+    big_shift(&top, 64 - big_bit_length(x));
+
+    const uint64_t result = top.limbs[0];
+
+    big_free(&top);
+    return result;
+}
+
+
+// Computes X ~ 2^(prec + n)/b for b > 0 of n bits, to about prec bits, by
+// Newton's iteration x += x(1 - bx), doubling the precision on every step.
+void
+big_recip(Big_Num* x, const Big_Num* b, const int64_t prec) {
+
+    const int64_t n = big_bit_length(b);
+
+    if (prec <= 60) {
+
+        big_set_u64(x, (uint64_t)(((uint128_t)1 << (prec + 64))
+                                  / big_top_bits(b)));
+        return;
+    }
+
+    const int64_t half = prec/2 + NEWTON_GUARD_BITS;
+    Big_Num top = {0};
+    Big_Num err = {0};
+
+    big_recip(x, b, half);
+    big_shift(x, prec - half);
+
+    // err = 2^(2 prec + guard) - top*x, where top holds prec + guard bits
+    big_copy(&top, b);
+    big_shift(&top, prec + NEWTON_GUARD_BITS - n);
+    big_mul(&err, &top, x);
+    err.negative = !err.negative;
+    big_set_u64(&top, 1);
+    big_shift(&top, 2*prec + NEWTON_GUARD_BITS);
+    big_add(&err, &err, &top);
+
+    big_mul(&err, &err, x);
+    big_shift(&err, -(2*prec + NEWTON_GUARD_BITS));
+    big_add(x, x, &err);
+
+    big_free(&err);
+    big_free(&top);
+}
+
+
+// Computes Y ~ 2^prec/sqrt(c) for a small c by Newton's iteration
+// y += y(1 - c y^2)/2, doubling the precision on every step.
+void
+big_inv_sqrt(Big_Num* y, const uint64_t c, const int64_t prec) {
+
+    if (prec <= 50) {
+
+        big_set_u64(y, (uint64_t)ldexp(1.0/sqrt((double)c), prec));
+        return;
+    }
+
+    const int64_t half = prec/2 + NEWTON_GUARD_BITS;
+    Big_Num err = {0};
+    Big_Num one = {0};
+
+    big_inv_sqrt(y, c, half);
+    big_shift(y, prec - half);
+
+    big_mul(&err, y, y);
+    big_mul_u64(&err, c);
+    err.negative = !err.negative;
+    big_set_u64(&one, 1);
+    big_shift(&one, 2*prec);
+    big_add(&err, &err, &one);
+
+    big_mul(&err, &err, y);
+    big_shift(&err, -(2*prec + 1));
+    big_add(y, y, &err);
+
+    big_free(&one);
+    big_free(&err);
+}
+
+
+int
+chud_split_worker(void* arg);
+
+
+// Sums the Chudnovsky series over terms a <= k < b into
+//   P = prod (6k-5)(2k-1)(6k-1),  Q = prod k^3 640320^3/24,
+//   T = sum (-1)^k (13591409 + 545140134 k) P(a, k+1) Q(k+1, b),
+// so that pi = 426880 sqrt(10005) Q(0, N) / T(0, N). The two halves of the
+// range are merged as P = P1 P2, Q = Q1 Q2 and T = T1 Q2 + P1 T2.
+void
+chud_split(const int64_t a, const int64_t b, Split_Terms* out,
+           const unsigned depth) {
+
+    if (b - a == 1) {
+
+        if (!a) {
+
+            big_set_u64(&out->p, 1);
+            big_set_u64(&out->q, 1);
+
+        } else {
+
+            big_set_u64(&out->p, 6*a - 5);
+            big_mul_u64(&out->p, 2*a - 1);
+            big_mul_u64(&out->p, 6*a - 1);
+            big_set_u64(&out->q, a);
+            big_mul_u64(&out->q, a);
+            big_mul_u64(&out->q, a);
+            big_mul_u64(&out->q, CHUD_C3_OVER_24);
+        }
+
+        big_copy(&out->t, &out->p);
+        big_mul_u64(&out->t, CHUD_A + CHUD_B*a);
+        out->t.negative = a & 1;
+        return;
+    }
+
+    const int64_t mid = (a + b)/2;
+    const unsigned child_depth = depth ? depth - 1 : 0;
+    Split_Job left = {.a = a, .b = mid, .depth = child_depth};
+    Split_Terms right = {{0}, {0}, {0}};
+    thrd_t thread;
+    bool spawned = false;
+
+    if (depth && mid - a > CHUD_THREAD_MIN_TERMS) {
+
+        spawned = thrd_create(&thread, chud_split_worker, &left)
+                  == thrd_success;
+    }
+
+    if (!spawned) {
+
+        chud_split(a, mid, &left.result, child_depth);
+    }
+
+    chud_split(mid, b, &right, child_depth);
+
+    if (spawned) {
+
+        thrd_join(thread, NULL);
+    }
+
+    big_mul(&out->t, &left.result.t, &right.q);
+    big_mul(&right.t, &left.result.p, &right.t);
+    big_add(&out->t, &out->t, &right.t);
+    big_mul(&out->p, &left.result.p, &right.p);
+    big_mul(&out->q, &left.result.q, &right.q);
+
+    big_free(&left.result.p);
+    big_free(&left.result.q);
+    big_free(&left.result.t);
+    big_free(&right.p);
+    big_free(&right.q);
+    big_free(&right.t);
+}
+
+
+int
+chud_split_worker(void* arg) {
+
+    Split_Job* const job = arg;
+
+    chud_split(job->a, job->b, &job->result, job->depth);
+    return 0;
+}
+
+
+// Computes digits start..stop of pi all at once from the Chudnovsky series
+// with binary splitting, the halves of the splitting tree being spread over
+// up to thread_count threads.
+void
+chudnovsky_digits(const int64_t start, const int64_t stop,
+                  int8_t digits[static (stop - start + 1)],
+                  const size_t thread_count) {
+
+    const int64_t prec = 4*(stop + 1) + CHUD_GUARD_BITS;
+    const int64_t terms = prec/CHUD_BITS_PER_TERM + 2;
+    unsigned depth = 0;
+    Split_Terms sums = {{0}, {0}, {0}};
+    Big_Num recip = {0};
+    Big_Num root = {0};
+
+    while (depth < 16 && ((size_t)1 << depth) < thread_count) {
+
+        depth++;
+    }
+
+    chud_split(0, terms, &sums, depth);
+
+    // pi * 2^prec = 426880 Q (2^(prec + n)/T) / 2^n * sqrt(10005) 2^prec / 2^prec
+    big_recip(&recip, &sums.t, prec);
+    big_mul(&sums.q, &sums.q, &recip);
+    big_shift(&sums.q, -big_bit_length(&sums.t));
+    big_mul_u64(&sums.q, CHUD_D);
+
+    big_inv_sqrt(&root, CHUD_E, prec + NEWTON_GUARD_BITS);
+    big_mul_u64(&root, CHUD_E);
+    big_shift(&root, -NEWTON_GUARD_BITS);
+    big_mul(&sums.q, &sums.q, &root);
+    big_shift(&sums.q, -prec);
+
+    for (int64_t n = start; n <= stop; n++) {
+
+        const int64_t bit = prec - 4*(n + 1);
+
+        digits[n - start] = (sums.q.limbs[bit/64] >> (bit%64)) & 0xf;
+    }
+
+    big_free(&root);
+    big_free(&recip);
+    big_free(&sums.p);
+    big_free(&sums.q);
+    big_free(&sums.t);
+}
+
+
+// Computes floor(2^(64 WINDOW_LIMBS) * num/den) for num < den by long
+// division, one limb at a time from the top
+void
+wide_div(const uint64_t num, const uint64_t den,
+         uint64_t quot[static WINDOW_LIMBS]) {
+
+    uint64_t rem = num;
+
+    for (size_t i = WINDOW_LIMBS; i-- > 0;) {
+
+        const uint128_t cur = (uint128_t)rem << 64;
+        quot[i] = (uint64_t)(cur / den);
+        rem = (uint64_t)(cur - (uint128_t)quot[i]*den);
+    }
+}
+
+
+// Adds one BBP series at position n, reduced modulo 1, to sum in wide fixed
+// point, and returns how many truncated terms went into it
+uint64_t
+window_series(const int64_t n, const int64_t plus_k,
+              uint64_t sum[static WINDOW_LIMBS]) {
+
+    uint64_t term[WINDOW_LIMBS];
+    uint64_t count = 0;
+
+    memset(sum, 0, sizeof(uint64_t[WINDOW_LIMBS]));
+
+    for (int64_t k = 0; k <= n; k++) {
+
+        const uint64_t mod = 8*k + plus_k;
+
+        wide_div(mod_power(16, n - k, mod), mod, term);
+        limbs_add(WINDOW_LIMBS, sum, sum, WINDOW_LIMBS, term);
+        count++;
+    }
+
+    for (int64_t k = n + 1; 4*(k - n) < 64*WINDOW_LIMBS; k++) {
+
+        const int64_t shift = 4*(k - n);
+        const size_t limb_shift = shift/64;
+
+        // 16^(n - k)/m is 1/m shifted down by 4(k - n) bits
+        wide_div(1, 8*k + plus_k, term);
+        for (size_t i = 0; i < WINDOW_LIMBS; i++) {
+
+            const size_t from = i + limb_shift;
+            const uint64_t low = (from < WINDOW_LIMBS) ? term[from] : 0;
+            const uint64_t high = (from + 1 < WINDOW_LIMBS && shift%64)
+                                  ? term[from + 1] << (64 - shift%64) : 0;
+
+            term[i] = (shift%64 ? low >> shift%64 : low) | high;
+        }
+
+        limbs_add(WINDOW_LIMBS, sum, sum, WINDOW_LIMBS, term);
+        count++;
+    }
+
+    return count + 1;
+}
+
+
+// Sets win to frac(16^n * pi) from a full evaluation of the four series
+void
+window_eval(Window* win, const int64_t n) {
+
+    uint64_t sum[WINDOW_LIMBS];
+    uint64_t error = 0;
+
+    memset(win->value, 0, sizeof win->value);
+
+    error += 4*window_series(n, 1, sum);
+    for (size_t i = 0; i < 4; i++) {
+
+        limbs_add(WINDOW_LIMBS, win->value, win->value, WINDOW_LIMBS, sum);
+    }
+
+    error += 2*window_series(n, 4, sum);
+    limbs_sub(WINDOW_LIMBS, win->value, win->value, WINDOW_LIMBS, sum);
+    limbs_sub(WINDOW_LIMBS, win->value, win->value, WINDOW_LIMBS, sum);
+
+    error += window_series(n, 5, sum);
+    limbs_sub(WINDOW_LIMBS, win->value, win->value, WINDOW_LIMBS, sum);
+
+    error += window_series(n, 6, sum);
+    limbs_sub(WINDOW_LIMBS, win->value, win->value, WINDOW_LIMBS, sum);
+
+    memset(win->error, 0, sizeof win->error);
+    win->error[0] = error;
+}
+
+
+// Reads the leading digit of win into digit and returns whether it is the
+// same at both ends of the error interval
+bool
+window_digit(const Window* win, int8_t* digit) {
+
+    uint64_t lower[WINDOW_LIMBS];
+    uint64_t upper[WINDOW_LIMBS];
+    const bool wraps = limbs_sub(WINDOW_LIMBS, lower, win->value,
+                                 WINDOW_LIMBS, win->error)
+                       | limbs_add(WINDOW_LIMBS, upper, win->value,
+                                   WINDOW_LIMBS, win->error);
+
+    *digit = (int8_t)(win->value[WINDOW_LIMBS - 1] >> 60);
+
+    return !wraps && (lower[WINDOW_LIMBS - 1] >> 60)
+                     == (upper[WINDOW_LIMBS - 1] >> 60);
+}
+
+
+// Moves win from frac(16^n pi) to frac(16^(n+1) pi). Since the state holds
+// the whole series, tail included, multiplying by 16 modulo 1 is the exact
+// update and needs no correction terms; only the error grows 16-fold. An
+// error that would leave the window saturates instead of wrapping.
+void
+window_step(Window* win) {
+
+    const bool overflow = win->error[WINDOW_LIMBS - 1] >> 60;
+
+    for (size_t i = WINDOW_LIMBS - 1; i > 0; i--) {
+
+        win->value[i] = (win->value[i] << 4) | (win->value[i - 1] >> 60);
+        win->error[i] = (win->error[i] << 4) | (win->error[i - 1] >> 60);
+    }
+
+    win->value[0] <<= 4;
+    win->error[0] <<= 4;
+
+    if (overflow) {
+
+        memset(win->error, 0xff, sizeof win->error);
+    }
+}
+
+
+// Computes the contiguous digits first..last by sliding one wide window
+// along them, resynchronising from a full evaluation only once the error
+// reaches the leading digit. Memory use is independent of the range.
+void
+window_digits(const int64_t first, const int64_t last,
+              int8_t digits[static (last - first + 1)]) {
+
+    Window win;
+    int64_t synced = first;
+
+    window_eval(&win, first);
+
+    for (int64_t n = first; n <= last; n++) {
+
+        if (!window_digit(&win, &digits[n - first]) && synced != n) {
+
+            window_eval(&win, n);
+            synced = n;
+            window_digit(&win, &digits[n - first]);
+        }
+
+        window_step(&win);
+    }
+}
+
+
+void
+layout_begin(FILE* out, Digit_Layout* layout) {
+
+    if (layout->prefix && !layout->raw) {
+
+        fprintf(out, "pi = 3.");
+        layout->col_counter = 6;
+        layout->col_offset = 6;
+    }
+}
+
+
+// Prints count digits continuing from the column recorded in layout. Raw
+// output must be written in even-sized pieces except for the last one.
+// Returns 0 if OK, 1 if writing fails.
+int
+layout_write(FILE* out, Digit_Layout* layout, const size_t count,
+             const int8_t digits[static count]) {
+
+    if (layout->raw) {
+
+        for (size_t digit = 0; digit < count; digit += 2) {
+
+            const int low = (digit + 1 < count) ? digits[digit + 1] : 0;
+
+            if (fputc((digits[digit] << 4) | low, out) == EOF) {
+
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    for (size_t digit = 0; digit < count; digit++) {
+
+        fprintf(out, "%x", digits[digit]);
+        layout->col_counter++;
+        
+        if (layout->col_counter == 65 + layout->col_offset) {
+            
+            if (layout->prefix) {
+
+                fprintf(out, "\n       ");
+
+            } else {
+
+                fprintf(out, "\n");
+            }
+
+            layout->col_counter = layout->col_offset;
+
+        } else if (layout->col_counter >= (10 + layout->col_offset) 
+                   && !((layout->col_counter - 10 - layout->col_offset) % 11)) {
+
+            fprintf(out, " ");
+            layout->col_counter++;
+        }
+    }
+
+    return ferror(out);
+}
+
+
+int
+layout_end(FILE* out, const Digit_Layout* layout, const size_t total) {
+
+    if (!layout->raw || !total) {
+
+        fprintf(out, "\n");
+    }
+
+    fflush(out);
+    return ferror(out);
+}
+
+
+// Records that digits before next are safely in the output, which is offset
+// bytes long at that point. The file is replaced by a rename, so a crash
+// leaves either the old checkpoint or the new one.
+int
+write_checkpoint(const char* ckpt_name, const int64_t start,
+                 const int64_t stop, const int64_t next, const long offset,
+                 const Digit_Layout* layout) {
+
+    char tmp_name[CKPT_NAME_LEN + 5] = {0};
+    snprintf(tmp_name, sizeof tmp_name, "%s.tmp", ckpt_name);
+
+    FILE* ckpt = fopen(tmp_name, "w");
+    if (!ckpt) {
+
+        return 1;
+    }
+
+    fprintf(ckpt, "ch3 checkpoint %" PRId64 " %" PRId64 " %" PRId64 " %ld %zu %d\n",
+            start, stop, next, offset, layout->col_counter, layout->raw);
+
+    if (fclose(ckpt) || rename(tmp_name, ckpt_name)) {
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// Looks for a checkpoint of the same run. Returns the digit to resume from,
+// or start if there is none, restoring the output offset and column.
+int64_t
+read_checkpoint(const char* ckpt_name, const int64_t start,
+                const int64_t stop, long* offset, Digit_Layout* layout) {
+
+    FILE* ckpt = fopen(ckpt_name, "r");
+    if (!ckpt) {
+
+        return start;
+    }
+
+    int64_t ckpt_start = 0;
+    int64_t ckpt_stop = 0;
+    int64_t next = 0;
+    size_t col_counter = 0;
+    int raw = 0;
+    const int read = fscanf(ckpt, "ch3 checkpoint %" SCNd64 " %" SCNd64
+                            " %" SCNd64 " %ld %zu %d", &ckpt_start,
+                            &ckpt_stop, &next, offset, &col_counter, &raw);
+    fclose(ckpt);
+
+    if (read != 6 || ckpt_start != start || ckpt_stop != stop
+        || raw != layout->raw || next <= start || next > stop + 1) {
+
+        return start;
+    }
+
+    layout->col_counter = col_counter;
+    return next;
+}
+
+
+// Computes digits start..stop in blocks of STREAM_BLOCK_LEN and appends each
+// one to out_name as soon as it is done, so memory stays bounded whatever
+// the range. With a checkpoint file, progress is recorded after every block
+// and an interrupted run of the same range picks up where it stopped.
+// Returns 0 if OK, 1 if operation fails.
+int
+stream_digits(const int64_t start, const int64_t stop, const char* out_name,
+              const char* ckpt_name, Digit_Layout layout,
+              const size_t thread_count, Digit_Kernel* kernel,
+              const bool sliding) {
+
+    if (ckpt_name && strlen(ckpt_name) > CKPT_NAME_LEN) {
+
+        fprintf(stderr, "Checkpoint file name is too long.\n");
+        return 1;
+    }
+
+    long offset = 0;
+    int64_t next = ckpt_name
+                   ? read_checkpoint(ckpt_name, start, stop, &offset, &layout)
+                   : start;
+    FILE* out = NULL;
+
+    if (next > start) {
+
+        out = fopen(out_name, "r+b");
+        if (out && fseek(out, offset, SEEK_SET)) {
+
+            fclose(out);
+            out = NULL;
+        }
+
+        if (out) {
+            
+            layout.col_offset = (layout.prefix && !layout.raw) ? 6 : 0;
+            fprintf(stderr, "Resuming at digit %" PRId64 ".\n", next);
+
+        } else {
+        
+            next = start;
+        }
+    }
+
+    if (!out) {
+
+        out = fopen(out_name, "wb");
+        if (!out) {
+
+            fprintf(stderr, "Failed to open %s.\n", out_name);
+            return 1;
+        }
+
+        layout_begin(out, &layout);
+    }
+
+    int8_t* digits = malloc(sizeof(int8_t[STREAM_BLOCK_LEN]));
+    if (!digits) {
+
+        fprintf(stderr, "Memory error.\n");
+        fclose(out);
+        return 1;
+    }
+
+    for (; next <= stop; next += STREAM_BLOCK_LEN) {
+
+        int64_t last = next + STREAM_BLOCK_LEN - 1;
+        if (last > stop) {
+
+            last = stop;
+        }
+
+        hex_digits_parallel(next, last, digits, thread_count, kernel,
+                            sliding);
+
+        if (layout_write(out, &layout, last - next + 1, digits)
+            || fflush(out)) {
+
+            fprintf(stderr, "Failed to write to %s.\n", out_name);
+            goto fail;
+        }
+
+        if (ckpt_name && write_checkpoint(ckpt_name, start, stop, last + 1,
+                                          ftell(out), &layout)) {
+
+            fprintf(stderr, "Failed to write the checkpoint.\n");
+            goto fail;
+        }
+    }
+
+    if (layout_end(out, &layout, stop - start + 1)) {
+
+        fprintf(stderr, "Failed to write to %s.\n", out_name);
+        goto fail;
+    }
+
+    if (ckpt_name) {
+
+        remove(ckpt_name);
+    }
+
+    free(digits);
+    fclose(out);
+    return 0;
+
+    fail:
+    free(digits);
+    fclose(out);
+    return 1;
+}
+
+
+// One thread per online processor, up to MAX_THREADS
+size_t
+default_thread_count(void) {
+
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (online > MAX_THREADS) {
+
+        return MAX_THREADS;
+    }
+
+    return (online > 0) ? (size_t)online : 1;
+}
+
+
+int
+main(int argc, char * argv[static argc]) {
+
+    size_t start = 0;
+    size_t stop = 0;
+    size_t thread_count = default_thread_count();
+    char N_str[21] = {0};
+    char ** end = NULL;
+    int arg = 1;
+    Digit_Kernel* kernel = NULL;
+    bool chudnovsky = false;
+    bool sliding = false;
+    // -b, -w and -k pick how digits are computed, so only one may be given
+    size_t mode_count = 0;
+    int64_t verify_stride = 0;
+    bool raw = false;
+    const char* out_name = NULL;
+    const char* ckpt_name = NULL;
+
+    while (arg < argc && argv[arg][0] == '-') {
+
+        if (!strcmp(argv[arg], "-j") && arg + 1 < argc) {
+
+            char* count_end = NULL;
+            thread_count = strtoull(argv[arg + 1], &count_end, 10);
+            if (*count_end || !thread_count || thread_count > MAX_THREADS) {
+
+                printf(USAGE);
+                return EXIT_FAILURE;
+            }
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-b")) {
+
+            kernel = bbp_fixed;
+            mode_count++;
+            arg++;
+
+        } else if (!strcmp(argv[arg], "-k") && arg + 1 < argc
+                   && !strcmp(argv[arg + 1], "bbp")) {
+
+            kernel = bbp_fixed;
+            mode_count++;
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-k") && arg + 1 < argc
+                   && !strcmp(argv[arg + 1], "bellard")) {
+
+            kernel = bellard_fixed;
+            mode_count++;
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-k") && arg + 1 < argc
+                   && !strcmp(argv[arg + 1], "chudnovsky")) {
+
+            chudnovsky = true;
+            mode_count++;
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-V") && arg + 1 < argc) {
+
+            strncpy(N_str, argv[arg + 1], 20);
+            verify_stride = strtoll(N_str, end, 10);
+            arg += 2;
+
+            if (verify_stride <= 0) {
+
+                printf(USAGE);
+                return EXIT_FAILURE;
+            }
+
+        } else if (!strcmp(argv[arg], "-w")) {
+
+            sliding = true;
+            mode_count++;
+            arg++;
+
+        } else if (!strcmp(argv[arg], "-r")) {
+
+            raw = true;
+            arg++;
+
+        } else if (!strcmp(argv[arg], "-o") && arg + 1 < argc) {
+
+            out_name = argv[arg + 1];
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-c") && arg + 1 < argc) {
+
+            ckpt_name = argv[arg + 1];
+            arg += 2;
+
+        } else {
+
+            printf(USAGE);
+            return EXIT_FAILURE;
+        }
+    }
+    
+    switch (argc - arg) {
+        
+        case 1:
+            strncpy(N_str, argv[arg], 20);
+            stop = strtoll(N_str, end, 10) - 1;
+            break;
+    
+        case 2:
+            strncpy(N_str, argv[arg], 20);
+            start = strtoll(N_str, end, 10);
+            strncpy(N_str, argv[arg + 1], 20);
+            stop = strtoll(N_str, end, 10);
+            break;
+
+        default:
+            printf(USAGE);
+            return EXIT_FAILURE;
+    }
+
+
+    if (stop < start || mode_count > 1 || (ckpt_name && !out_name)
+        || (chudnovsky && (out_name || verify_stride))) {
+
+        printf(USAGE);
+        return EXIT_FAILURE;
+    }
+
+    if (verify_stride) {
+
+        const int64_t mismatches = verify_digits(start, stop, verify_stride,
+                                                 thread_count);
+        printf("Verified windows from %zu to %zu every %" PRId64 " digits: "
+               "%" PRId64 " mismatches.\n", start, stop, verify_stride,
+               mismatches);
+
+        return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (out_name) {
+
+        const Digit_Layout layout = {.raw = raw, .prefix = !start};
+
+        return stream_digits(start, stop, out_name, ckpt_name, layout,
+                             thread_count, kernel, sliding)
+               ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    
+    int8_t * pi_digits = malloc(sizeof(int8_t[stop - start + 1]));
+    if (!pi_digits) {
+        printf("Memory error.");
+        return EXIT_FAILURE;
+    }
+    
+    if (chudnovsky) {
+
+        chudnovsky_digits(start, stop, pi_digits, thread_count);
+
+    } else if (argc - arg == 2 && !kernel && !sliding) {
+
+        hex_sequence(start, stop, pi_digits);
+
+    } else {
+
+        hex_digits_parallel(start, stop, pi_digits, thread_count, kernel,
+                            sliding);
+    }
+
+    Digit_Layout layout = {.raw = raw, .prefix = !start};
+    layout_begin(stdout, &layout);
+    layout_write(stdout, &layout, stop - start + 1, pi_digits);
+    layout_end(stdout, &layout, stop - start + 1);
 
     free(pi_digits);
     return EXIT_SUCCESS;
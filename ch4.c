@@ -1,6 +1,118 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <string.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BENCH_UNIONS 100000000ull
+#define BENCH_ELEMENTS 10000000ull
+#define EDGE_BLOCK_LEN 65536
+#define MAX_THREADS 256
+#define READ_BUF_LEN (1 << 20)
+#define BENCH_OPS 1000000ull
+#define BENCH_VERTICES 100000ull
+#define CONNECTIVITY_SAMPLES 400
+#define USAGE "Usage: ./ch4 [-c] [-j THREADS] [UNIONS [ELEMENTS]]\n" \
+              "       ./ch4 -d [OPS [VERTICES]]\n" \
+              "       ./ch4 -e EDGES [-b] [-m] [-n VERTICES] [-l LABELS]\n"
+
+// Disjoint sets over the elements 0..count - 1. Roots are their own
+// parent, and size is only kept up to date at roots. 32 bit indices halve
+// the memory traffic of size_t ones. capacity is how many elements the
+// arrays have room for, so that dsu_grow can add elements cheaply.
+typedef struct Disjoint_Set Disjoint_Set;
+struct Disjoint_Set {
+
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t components;
+    uint32_t* parent;
+    uint32_t* size;
+};
+
+// Disjoint sets that any number of threads may find and union in at once.
+// A root is linked under another by a compare and swap on its own parent
+// entry, which fails if it stopped being a root in the meantime, so there
+// is no lock and no size array to keep consistent. Roots are linked under
+// the larger index, which keeps the forest acyclic.
+typedef struct Concurrent_Set Concurrent_Set;
+struct Concurrent_Set {
+
+    uint32_t count;
+    atomic_uint_least32_t components;
+    atomic_uint_least32_t* parent;
+};
+
+typedef struct Edge Edge;
+struct Edge {
+
+    uint32_t a;
+    uint32_t b;
+};
+
+// An edge list being read into set a block of edges at a time, so memory
+// stays proportional to the number of vertices however long the list is.
+// line counts text lines for error messages, and error is set to a
+// description of the first failure.
+typedef struct Edge_Stream Edge_Stream;
+struct Edge_Stream {
+
+    Disjoint_Set* set;
+    Edge* block;
+    size_t len;
+    bool fixed_count;
+    uint64_t edges;
+    uint64_t line;
+    const char* error;
+};
+
+// Disjoint sets whose unions can be undone in reverse order. Every link is
+// pushed onto history, and rolling back to an earlier history length
+// unlinks the newer ones. Path compression would rewrite parents that
+// later links rely on, so trees are kept shallow by rank alone, which
+// bounds finds to log2(count) steps.
+typedef struct Rollback_Link Rollback_Link;
+struct Rollback_Link {
+
+    uint32_t child;
+    bool rank_grew;
+};
+
+typedef struct Rollback_Set Rollback_Set;
+struct Rollback_Set {
+
+    uint32_t count;
+    uint32_t components;
+    uint32_t* parent;
+    uint8_t* rank;
+    Rollback_Link* history;
+    size_t len;
+};
+
+// One entry of a timed edge log. Ops take effect in log order, so an
+// EDGE_QUERY sees exactly the edges added and not yet removed before it.
+typedef enum {
+
+    EDGE_ADD = 0,
+    EDGE_REMOVE = 1,
+    EDGE_QUERY = 2
+} Edge_Op_Type;
+
+typedef struct Edge_Op Edge_Op;
+struct Edge_Op {
+
+    Edge_Op_Type type;
+    uint32_t a;
+    uint32_t b;
+};
 
 // Returns the root of the tree given a node
 size_t
@@ -55,13 +167,1505 @@ Union(size_t parent[], const size_t A, const size_t B) {
 }
 
 
+void
+dsu_free(Disjoint_Set* set) {
+
+    if (!set) {
+        return;
+    }
+
+    free(set->parent);
+    free(set->size);
+    free(set);
+}
+
+
+// Adds singleton sets until there are count elements, at least doubling the
+// capacity whenever it runs out. Returns 0 on success.
 int
-main() {
-    
-    size_t PARENT[10] = {1, 2, SIZE_MAX, 1, 3, 4, SIZE_MAX, 8, 6, 8};
+dsu_grow(Disjoint_Set* set, const uint32_t count) {
+
+    if (count > set->capacity) {
+
+        uint64_t capacity = set->capacity ? set->capacity : 1024;
+        while (capacity < count) {
+            capacity *= 2;
+        }
+        if (capacity > UINT32_MAX) {
+            capacity = UINT32_MAX;
+        }
+
+        uint32_t* parent = realloc(set->parent, capacity*sizeof(uint32_t));
+        if (!parent) {
+            return 1;
+        }
+        set->parent = parent;
+
+        uint32_t* size = realloc(set->size, capacity*sizeof(uint32_t));
+        if (!size) {
+            return 1;
+        }
+        set->size = size;
+        set->capacity = capacity;
+    }
+
+    for (uint32_t i = set->count; i < count; i++) {
+
+        set->parent[i] = i;
+        set->size[i] = 1;
+    }
+
+    if (count > set->count) {
+
+        set->components += count - set->count;
+        set->count = count;
+    }
+
+    return 0;
+}
+
+
+// Returns count singleton sets, or NULL if out of memory
+Disjoint_Set*
+dsu_alloc(const uint32_t count) {
+
+    Disjoint_Set* set = calloc(1, sizeof(Disjoint_Set));
+    if (!set) {
+        return NULL;
+    }
+
+    if (dsu_grow(set, count)) {
+
+        dsu_free(set);
+        return NULL;
+    }
+
+    return set;
+}
+
+
+// Returns the root of element. Each node on the way up is pointed at its
+// grandparent in a single pass, which halves the path for later calls
+// without the second pass full compression needs.
+uint32_t
+dsu_find(Disjoint_Set* set, uint32_t element) {
+
+    uint32_t* const parent = set->parent;
+
+    while (parent[element] != element) {
+
+        parent[element] = parent[parent[element]];
+        element = parent[element];
+    }
+
+    return element;
+}
+
+
+// Merges the sets of a and b, hanging the smaller tree under the larger so
+// that no tree gets deeper than log2(count). Returns true if they were
+// separate.
+bool
+dsu_union(Disjoint_Set* set, const uint32_t a, const uint32_t b) {
+
+    uint32_t root_a = dsu_find(set, a);
+    uint32_t root_b = dsu_find(set, b);
+
+    if (root_a == root_b) {
+
+        return false;
+    }
+
+    if (set->size[root_a] < set->size[root_b]) {
+
+        const uint32_t swap = root_a;
+        root_a = root_b;
+        root_b = swap;
+    }
+
+    set->parent[root_b] = root_a;
+    set->size[root_a] += set->size[root_b];
+    set->components--;
+
+    return true;
+}
+
+
+// Unions both ends of n edges. Returns the number of edges that joined two
+// separate sets.
+size_t
+union_edges(Disjoint_Set* set, const size_t n, const Edge pairs[static n]) {
+
+    size_t merged = 0;
+
+    for (size_t i = 0; i < n; i++) {
+
+        merged += dsu_union(set, pairs[i].a, pairs[i].b);
+    }
+
+    return merged;
+}
+
+
+void
+cdsu_free(Concurrent_Set* set) {
+
+    if (!set) {
+        return;
+    }
+
+    free(set->parent);
+    free(set);
+}
+
+
+Concurrent_Set*
+cdsu_alloc(const uint32_t count) {
+
+    Concurrent_Set* set = malloc(sizeof(Concurrent_Set));
+    if (!set) {
+        return NULL;
+    }
+
+    set->count = count;
+    atomic_init(&set->components, count);
+    set->parent = malloc(sizeof(atomic_uint_least32_t[count]));
+    if (!set->parent) {
+
+        free(set);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+
+        atomic_init(&set->parent[i], i);
+    }
+
+    return set;
+}
+
+
+// Returns the root of element, halving the path on the way. A halving step
+// only replaces a parent by one of its own ancestors, so losing the race
+// to another thread is harmless and the CAS result can be ignored. The
+// loop never waits on another thread.
+uint32_t
+cdsu_find(Concurrent_Set* set, uint32_t element) {
+
+    atomic_uint_least32_t* const parent = set->parent;
+
+    while (true) {
+
+        uint_least32_t up = atomic_load_explicit(&parent[element],
+                                                 memory_order_relaxed);
+        if (up == element) {
+
+            return element;
+        }
+
+        const uint_least32_t grand = atomic_load_explicit(
+            &parent[up], memory_order_relaxed);
+        if (up != grand) {
+
+            atomic_compare_exchange_weak_explicit(&parent[element], &up,
+                                                  grand,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed);
+        }
+
+        element = grand;
+    }
+}
+
+
+// Merges the sets of a and b. Returns true if this call joined them.
+bool
+cdsu_union(Concurrent_Set* set, uint32_t a, uint32_t b) {
+
+    while (true) {
+
+        a = cdsu_find(set, a);
+        b = cdsu_find(set, b);
+
+        if (a == b) {
+
+            return false;
+        }
+
+        if (a > b) {
+
+            const uint32_t swap = a;
+            a = b;
+            b = swap;
+        }
+
+        uint_least32_t expected = a;
+        if (atomic_compare_exchange_strong(&set->parent[a], &expected, b)) {
+
+            atomic_fetch_sub_explicit(&set->components, 1,
+                                      memory_order_relaxed);
+            return true;
+        }
+    }
+}
+
+
+typedef struct Union_Job Union_Job;
+struct Union_Job {
+
+    Concurrent_Set* set;
+    const Edge* edges;
+    size_t len;
+};
+
+
+int
+union_worker(void* arg) {
+
+    Union_Job* job = arg;
+
+    for (size_t i = 0; i < job->len; i++) {
+
+        cdsu_union(job->set, job->edges[i].a, job->edges[i].b);
+    }
+
+    return 0;
+}
+
+
+// Splits n edges into thread_count contiguous partitions and unions each on
+// its own thread. The calling thread takes the last partition, so a failed
+// spawn only costs parallelism.
+void
+union_edges_parallel(Concurrent_Set* set, const size_t n,
+                     const Edge pairs[static n], size_t thread_count) {
+
+    thrd_t threads[MAX_THREADS];
+    Union_Job jobs[MAX_THREADS];
+    size_t spawned = 0;
+
+    if (thread_count > MAX_THREADS) {
+
+        thread_count = MAX_THREADS;
+    }
+
+    for (size_t t = 0; t < thread_count; t++) {
+
+        const size_t begin = n*t/thread_count;
+        jobs[t] = (Union_Job) {
+            .set = set,
+            .edges = &pairs[begin],
+            .len = n*(t + 1)/thread_count - begin
+        };
+    }
+
+    size_t next = 0;
+    for (; next + 1 < thread_count; next++) {
+
+        if (thrd_create(&threads[spawned], union_worker, &jobs[next])
+            != thrd_success) {
+
+            break;
+        }
+        spawned++;
+    }
+
+    for (; next < thread_count; next++) {
+
+        union_worker(&jobs[next]);
+    }
+
+    for (size_t t = 0; t < spawned; t++) {
+
+        thrd_join(threads[t], NULL);
+    }
+}
+
+
+void
+rdsu_free(Rollback_Set* set) {
+
+    if (!set) {
+        return;
+    }
+
+    free(set->parent);
+    free(set->rank);
+    free(set->history);
+    free(set);
+}
+
+
+// Returns count singleton sets, or NULL if out of memory. At most
+// count - 1 links can be live at once, which sizes the history.
+Rollback_Set*
+rdsu_alloc(const uint32_t count) {
+
+    Rollback_Set* set = calloc(1, sizeof(Rollback_Set));
+    if (!set) {
+        return NULL;
+    }
+
+    set->count = count;
+    set->components = count;
+    set->parent = malloc(count*sizeof(uint32_t) + 1);
+    set->rank = calloc(count + 1, sizeof(uint8_t));
+    set->history = malloc(count*sizeof(Rollback_Link) + 1);
+    if (!set->parent || !set->rank || !set->history) {
+
+        rdsu_free(set);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+
+        set->parent[i] = i;
+    }
+
+    return set;
+}
+
+
+// Returns the root of element without changing the trees
+uint32_t
+rdsu_find(const Rollback_Set* set, uint32_t element) {
+
+    while (set->parent[element] != element) {
+
+        element = set->parent[element];
+    }
+
+    return element;
+}
+
+
+// Merges the sets of a and b, hanging the lower ranked root under the
+// other. Returns true if they were separate, in which case the link is
+// pushed onto the history.
+bool
+rdsu_union(Rollback_Set* set, const uint32_t a, const uint32_t b) {
+
+    uint32_t root_a = rdsu_find(set, a);
+    uint32_t root_b = rdsu_find(set, b);
+
+    if (root_a == root_b) {
+
+        return false;
+    }
+
+    if (set->rank[root_a] < set->rank[root_b]) {
+
+        const uint32_t swap = root_a;
+        root_a = root_b;
+        root_b = swap;
+    }
+
+    const bool rank_grew = set->rank[root_a] == set->rank[root_b];
+    set->parent[root_b] = root_a;
+    set->rank[root_a] += rank_grew;
+    set->history[set->len++] = (Rollback_Link) {root_b, rank_grew};
+    set->components--;
+
+    return true;
+}
+
+
+// Undoes the newest links until len are left
+void
+rdsu_rollback(Rollback_Set* set, const size_t len) {
+
+    while (set->len > len) {
+
+        const Rollback_Link link = set->history[--set->len];
+        const uint32_t root = set->parent[link.child];
+
+        set->rank[root] -= link.rank_grew;
+        set->parent[link.child] = link.child;
+        set->components++;
+    }
+}
+
+
+// An edge together with the range [first, last) of queries it is present
+// for. Queries are numbered in log order.
+typedef struct Live_Edge Live_Edge;
+struct Live_Edge {
+
+    uint64_t key;
+    size_t time;
+    size_t first;
+    size_t last;
+};
+
+// State of the divide and conquer over query numbers. The segment tree
+// node covering queries [lo, hi) owns the edges present for all of them
+// that no ancestor owns; node_start[node] indexes its run in node_edges.
+typedef struct Offline_Job Offline_Job;
+struct Offline_Job {
+
+    Rollback_Set* set;
+    const Live_Edge* edges;
+    const size_t* node_start;
+    const uint32_t* node_edges;
+    const size_t* query_ops;
+    const Edge_Op* ops;
+    bool* connected;
+};
+
+
+int
+compare_live_edges(const void* left, const void* right) {
+
+    const Live_Edge* l = left;
+    const Live_Edge* r = right;
+
+    if (l->key != r->key) {
+        return (l->key > r->key) - (l->key < r->key);
+    }
+
+    return (l->time > r->time) - (l->time < r->time);
+}
+
+
+// Visits the nodes of the segment tree over [lo, hi) that exactly cover
+// [first, last), counting edge into node_start or, once counts have been
+// turned into offsets, placing it in node_edges
+void
+cover_queries(const size_t node, const size_t lo, const size_t hi,
+              const size_t first, const size_t last, const uint32_t edge,
+              size_t* node_start, uint32_t* node_edges) {
+
+    if (last <= lo || hi <= first) {
+        return;
+    }
+
+    if (first <= lo && hi <= last) {
+
+        if (node_edges) {
+
+            node_edges[node_start[node]++] = edge;
+
+        } else {
+
+            node_start[node + 1]++;
+        }
+        return;
+    }
+
+    const size_t mid = lo + (hi - lo)/2;
+    cover_queries(2*node + 1, lo, mid, first, last, edge, node_start,
+                  node_edges);
+    cover_queries(2*node + 2, mid, hi, first, last, edge, node_start,
+                  node_edges);
+}
+
+
+// Unions the edges of node, answers the query of a leaf or recurses into
+// the halves of [lo, hi), then undoes its own unions
+void
+offline_visit(const Offline_Job* job, const size_t node, const size_t lo,
+              const size_t hi) {
+
+    const size_t saved = job->set->len;
+
+    for (size_t i = job->node_start[node]; i < job->node_start[node + 1];
+         i++) {
+
+        const uint64_t key = job->edges[job->node_edges[i]].key;
+        rdsu_union(job->set, key >> 32, (uint32_t)key);
+    }
+
+    if (hi - lo == 1) {
+
+        const Edge_Op* query = &job->ops[job->query_ops[lo]];
+        job->connected[lo] = rdsu_find(job->set, query->a)
+                             == rdsu_find(job->set, query->b);
+
+    } else {
+
+        const size_t mid = lo + (hi - lo)/2;
+        offline_visit(job, 2*node + 1, lo, mid);
+        offline_visit(job, 2*node + 2, mid, hi);
+    }
+
+    rdsu_rollback(job->set, saved);
+}
+
+
+// Answers every EDGE_QUERY of the log of n ops over vertex_count vertices,
+// setting connected[q] for the q-th query. Each edge is unioned only at the
+// O(log Q) segment tree nodes spanning the queries it is present for, and
+// undone on the way back up, so the whole log takes
+// O((n + Q) log Q log vertex_count) instead of a rebuild per query. Edges
+// are undirected and may be added several times; a removal drops one copy.
+// Returns 0 on success, 1 if out of memory, or 2 if an op has a vertex out
+// of range or removes an edge that is not present.
+int
+connected_offline(const uint32_t vertex_count, const size_t n,
+                  const Edge_Op ops[static n], bool connected[]) {
+
+    size_t query_count = 0;
+    size_t update_count = 0;
+
+    for (size_t t = 0; t < n; t++) {
+
+        if (ops[t].a >= vertex_count || ops[t].b >= vertex_count) {
+            return 2;
+        }
+
+        query_count += ops[t].type == EDGE_QUERY;
+        update_count += ops[t].type != EDGE_QUERY;
+    }
+
+    if (!query_count) {
+        return 0;
+    }
+
+    // Sort the updates by edge then time, and pair every removal with the
+    // latest open addition of the same edge
+    Live_Edge* edges = malloc(update_count*sizeof(Live_Edge) + 1);
+    size_t* query_ops = malloc(query_count*sizeof(size_t));
+    if (!edges || !query_ops) {
+
+        free(edges);
+        free(query_ops);
+        return 1;
+    }
+
+    query_count = 0;
+    update_count = 0;
+    for (size_t t = 0; t < n; t++) {
+
+        if (ops[t].type == EDGE_QUERY) {
+
+            query_ops[query_count++] = t;
+            continue;
+        }
+
+        const uint32_t lo = (ops[t].a < ops[t].b) ? ops[t].a : ops[t].b;
+        const uint32_t hi = (ops[t].a < ops[t].b) ? ops[t].b : ops[t].a;
+        edges[update_count++] = (Live_Edge) {
+            .key = (uint64_t)lo << 32 | hi,
+            .time = t,
+            .first = query_count,
+            .last = (ops[t].type == EDGE_ADD) ? SIZE_MAX : 0
+        };
+    }
+
+    qsort(edges, update_count, sizeof(Live_Edge), compare_live_edges);
+
+    // Open additions are stacked in place at the front of each key's run
+    Live_Edge* live_edges = malloc(update_count*sizeof(Live_Edge) + 1);
+    size_t live = 0;
+    size_t run = 0;
+    int status = live_edges ? 0 : 1;
+
+    while (run < update_count && !status) {
+
+        size_t open = run;
+        size_t end = run;
+
+        for (; end < update_count && edges[end].key == edges[run].key;
+             end++) {
+
+            if (edges[end].last == SIZE_MAX) {
+
+                edges[open++] = edges[end];
+
+            } else if (open == run) {
+
+                status = 2;
+                break;
+
+            } else {
+
+                Live_Edge added = edges[--open];
+                added.last = edges[end].first;
+                if (added.first < added.last) {
+                    live_edges[live++] = added;
+                }
+            }
+        }
+
+        for (size_t i = run; i < open && !status; i++) {
+
+            edges[i].last = query_count;
+            if (edges[i].first < edges[i].last) {
+                live_edges[live++] = edges[i];
+            }
+        }
+
+        run = end;
+    }
+    free(edges);
+
+    size_t node_count = 1;
+    while (node_count < query_count) {
+        node_count *= 2;
+    }
+    node_count *= 2;
+
+    size_t* node_start = calloc(node_count + 1, sizeof(size_t));
+    Rollback_Set* set = rdsu_alloc(vertex_count);
+    uint32_t* node_edges = NULL;
+
+    if (!status && node_start && set) {
+
+        for (size_t e = 0; e < live; e++) {
+
+            cover_queries(0, 0, query_count, live_edges[e].first,
+                          live_edges[e].last, e, node_start, NULL);
+        }
+
+        for (size_t node = 0; node < node_count; node++) {
+
+            node_start[node + 1] += node_start[node];
+        }
+
+        node_edges = malloc(node_start[node_count]*sizeof(uint32_t) + 1);
+    }
+
+    if (!status && (!node_start || !set || !node_edges)) {
+        status = 1;
+    }
+
+    if (!status) {
+
+        // Placing edges advances each node's start to the next node's, so
+        // shift the offsets back afterwards
+        for (size_t e = 0; e < live; e++) {
+
+            cover_queries(0, 0, query_count, live_edges[e].first,
+                          live_edges[e].last, e, node_start, node_edges);
+        }
+
+        memmove(&node_start[1], node_start, node_count*sizeof(size_t));
+        node_start[0] = 0;
+
+        const Offline_Job job = {
+            .set = set,
+            .edges = live_edges,
+            .node_start = node_start,
+            .node_edges = node_edges,
+            .query_ops = query_ops,
+            .ops = ops,
+            .connected = connected
+        };
+        offline_visit(&job, 0, 0, query_count);
+    }
+
+    rdsu_free(set);
+    free(node_edges);
+    free(node_start);
+    free(query_ops);
+    free(live_edges);
+    return status;
+}
+
+
+// One thread per online processor, up to MAX_THREADS
+size_t
+default_thread_count(void) {
+
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (online > MAX_THREADS) {
+
+        return MAX_THREADS;
+    }
+
+    return (online > 0) ? (size_t)online : 1;
+}
+
+
+uint64_t
+xorshift64(uint64_t* state) {
+
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+
+// Performs unions random unions among elements elements, in blocks of
+// EDGE_BLOCK_LEN edges, and reports the rate and the components left.
+// Returns 0 on success.
+int
+bench_unions(const uint64_t unions, const uint32_t elements) {
+
+    Disjoint_Set* set = dsu_alloc(elements);
+    Edge* edges = malloc(sizeof(Edge[EDGE_BLOCK_LEN]));
+    if (!set || !edges) {
+
+        dsu_free(set);
+        free(edges);
+        return 1;
+    }
+
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    double seconds = 0;
+
+    for (uint64_t done = 0; done < unions; done += EDGE_BLOCK_LEN) {
+
+        const size_t len = (unions - done < EDGE_BLOCK_LEN)
+                           ? unions - done : EDGE_BLOCK_LEN;
+
+        for (size_t i = 0; i < len; i++) {
+
+            const uint64_t r = xorshift64(&state);
+            edges[i].a = (r >> 32) % elements;
+            edges[i].b = (uint32_t)r % elements;
+        }
+
+        const clock_t begin = clock();
+        union_edges(set, len, edges);
+        seconds += (double)(clock() - begin)/CLOCKS_PER_SEC;
+    }
+
+    printf("%" PRIu64 " random unions over %" PRIu32 " elements: %.2f s, "
+           "%.1f M unions/s, %" PRIu32 " components\n", unions, elements,
+           seconds, unions/seconds*1e-6, set->components);
+
+    dsu_free(set);
+    free(edges);
+    return 0;
+}
+
+
+// Finds the connected components of a random graph with edge_count edges
+// on vertex_count vertices with 1, 2, 4, ... up to max_threads threads,
+// checking each count of components against the sequential dsu_union.
+// Returns 0 on success.
+int
+bench_components(const uint64_t edge_count, const uint32_t vertex_count,
+                 const size_t max_threads) {
+
+    Edge* edges = malloc(sizeof(Edge[edge_count]));
+    Disjoint_Set* reference = dsu_alloc(vertex_count);
+    if (!edges || !reference) {
+
+        free(edges);
+        dsu_free(reference);
+        return 1;
+    }
+
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (uint64_t i = 0; i < edge_count; i++) {
+
+        const uint64_t r = xorshift64(&state);
+        edges[i].a = (r >> 32) % vertex_count;
+        edges[i].b = (uint32_t)r % vertex_count;
+    }
+    union_edges(reference, edge_count, edges);
+
+    double base_seconds = 0;
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+
+        Concurrent_Set* set = cdsu_alloc(vertex_count);
+        if (!set) {
+
+            free(edges);
+            dsu_free(reference);
+            return 1;
+        }
+
+        struct timespec begin;
+        struct timespec end;
+        timespec_get(&begin, TIME_UTC);
+        union_edges_parallel(set, edge_count, edges, threads);
+        timespec_get(&end, TIME_UTC);
+
+        const double seconds = (end.tv_sec - begin.tv_sec)
+                               + (end.tv_nsec - begin.tv_nsec)*1e-9;
+        if (threads == 1) {
+
+            base_seconds = seconds;
+        }
+
+        const uint32_t components = atomic_load(&set->components);
+        printf("%3zu threads: %.2f s, %.1f M edges/s, speedup %.2f, "
+               "%" PRIu32 " components%s\n", threads, seconds,
+               edge_count/seconds*1e-6, base_seconds/seconds, components,
+               (components == reference->components) ? "" : " (MISMATCH)");
+        cdsu_free(set);
+    }
+
+    free(edges);
+    dsu_free(reference);
+    return 0;
+}
+
+
+// Returns a random op: half add an edge to present, and the rest split
+// between removing a random present edge and querying a random pair
+Edge_Op
+random_edge_op(uint64_t* state, const uint32_t vertex_count, Edge present[],
+               size_t* present_len) {
+
+    const uint64_t r = xorshift64(state);
+    const uint32_t a = (r >> 32) % vertex_count;
+    const uint32_t b = (uint32_t)r % vertex_count;
+    const unsigned kind = (r >> 20) & 3;
+
+    if (kind < 2) {
+
+        present[(*present_len)++] = (Edge) {a, b};
+        return (Edge_Op) {EDGE_ADD, a, b};
+    }
+
+    if (kind == 2 && *present_len) {
+
+        const size_t i = (r >> 8) % *present_len;
+        const Edge_Op op = {EDGE_REMOVE, present[i].a, present[i].b};
+        present[i] = present[--(*present_len)];
+        return op;
+    }
+
+    return (Edge_Op) {EDGE_QUERY, a, b};
+}
+
+
+// Answers the queries of a random log of op_count edge additions, removals
+// and queries over vertex_count vertices offline, and checks a sample of
+// them against a set rebuilt from the edges present at the time. Returns
+// nonzero if out of memory.
+int
+bench_connectivity(const uint64_t op_count, const uint32_t vertex_count) {
+
+    Edge_Op* ops = malloc(op_count*sizeof(Edge_Op) + 1);
+    Edge* present = malloc(op_count*sizeof(Edge) + 1);
+    bool* connected = malloc(op_count*sizeof(bool) + 1);
+    bool* sampled = calloc(op_count + 1, sizeof(bool));
+    if (!ops || !present || !connected || !sampled) {
+
+        free(ops);
+        free(present);
+        free(connected);
+        free(sampled);
+        return 1;
+    }
+
+    // Queries whose log position is a multiple of sample_every are checked
+    // against a rebuild
+    const uint64_t sample_every = op_count/CONNECTIVITY_SAMPLES + 1;
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    size_t present_len = 0;
+    size_t query_count = 0;
+    size_t mismatches = 0;
+    size_t checked = 0;
+    double rebuild_seconds = 0;
+
+    for (uint64_t t = 0; t < op_count; t++) {
+
+        ops[t] = random_edge_op(&state, vertex_count, present, &present_len);
+        if (ops[t].type == EDGE_QUERY) {
+
+            sampled[query_count++] = t % sample_every == 0;
+        }
+    }
+
+    const clock_t begin = clock();
+    const int status = connected_offline(vertex_count, op_count, ops,
+                                         connected);
+    const double seconds = (double)(clock() - begin)/CLOCKS_PER_SEC;
+
+    if (status) {
+
+        free(ops);
+        free(present);
+        free(connected);
+        free(sampled);
+        return status;
+    }
+
+    // Replay the log to recover the present edges at each sampled query
+    state = 0x9E3779B97F4A7C15ull;
+    present_len = 0;
+    query_count = 0;
+
+    for (uint64_t t = 0; t < op_count; t++) {
+
+        random_edge_op(&state, vertex_count, present, &present_len);
+        if (ops[t].type == EDGE_QUERY && sampled[query_count++]) {
+
+            const clock_t rebuild_begin = clock();
+            Disjoint_Set* set = dsu_alloc(vertex_count);
+            if (!set) {
+
+                free(ops);
+                free(present);
+                free(connected);
+                free(sampled);
+                return 1;
+            }
+
+            union_edges(set, present_len, present);
+            mismatches += (dsu_find(set, ops[t].a) == dsu_find(set, ops[t].b))
+                          != connected[query_count - 1];
+            checked++;
+            dsu_free(set);
+            rebuild_seconds += (double)(clock() - rebuild_begin)
+                               /CLOCKS_PER_SEC;
+        }
+    }
+
+    printf("%zu connectivity queries in a log of %" PRIu64 " ops over %"
+           PRIu32 " vertices: %.2f s offline against about %.2f s "
+           "rebuilding for each; %zu of %zu checked answers wrong\n",
+           query_count, op_count, vertex_count, seconds,
+           checked ? rebuild_seconds/checked*query_count : 0.0, mismatches,
+           checked);
+
+    free(ops);
+    free(present);
+    free(connected);
+    free(sampled);
+    return 0;
+}
+
+
+// Unions the buffered edges, first growing the set to cover their
+// vertices unless its size was fixed up front
+void
+stream_flush(Edge_Stream* stream) {
+
+    uint32_t max_vertex = 0;
+    for (size_t i = 0; i < stream->len; i++) {
+
+        if (stream->block[i].a > max_vertex) {
+            max_vertex = stream->block[i].a;
+        }
+        if (stream->block[i].b > max_vertex) {
+            max_vertex = stream->block[i].b;
+        }
+    }
+
+    if (stream->len && max_vertex >= stream->set->count) {
+
+        if (max_vertex == UINT32_MAX ||
+            dsu_grow(stream->set, max_vertex + 1)) {
+
+            stream->error = "vertex out of range or out of memory";
+            stream->len = 0;
+            return;
+        }
+    }
+
+    union_edges(stream->set, stream->len, stream->block);
+    stream->edges += stream->len;
+    stream->len = 0;
+}
+
+
+// Appends edge to the stream, handing a full block to union_edges. With a
+// fixed count, each edge is checked here rather than per block, so that
+// an error names the line the vertex is on.
+void
+stream_edge(Edge_Stream* stream, const uint32_t a, const uint32_t b) {
+
+    if (stream->fixed_count &&
+        (a >= stream->set->count || b >= stream->set->count)) {
+
+        stream->error = "vertex out of range";
+        return;
+    }
+
+    stream->block[stream->len++] = (Edge) {a, b};
+    if (stream->len == EDGE_BLOCK_LEN) {
+
+        stream_flush(stream);
+    }
+}
+
+
+// Parses "u v" lines from text[0..len). Blank lines, and lines starting
+// with # or %, are skipped, as is anything after the second number, such
+// as a weight. Unless last is set, parsing stops after the last complete
+// line; returns the number of bytes consumed.
+size_t
+stream_text(Edge_Stream* stream, const char* text, const size_t len,
+            const bool last) {
+
+    size_t end = len;
+    if (!last) {
+
+        while (end > 0 && text[end - 1] != '\n') {
+            end--;
+        }
+    }
+
+    size_t pos = 0;
+    while (pos < end && !stream->error) {
+
+        uint64_t ends[2] = {0};
+        size_t found = 0;
+        stream->line++;
+
+        while (pos < end && text[pos] != '\n' && found < 2) {
+
+            if (text[pos] == '#' || text[pos] == '%') {
+                break;
+            }
+
+            if (text[pos] >= '0' && text[pos] <= '9') {
+
+                uint64_t value = 0;
+                while (pos < end && text[pos] >= '0' && text[pos] <= '9') {
+
+                    value = 10*value + (text[pos++] - '0');
+                    if (value > UINT32_MAX) {
+                        value = UINT32_MAX;
+                    }
+                }
+                ends[found++] = value;
+
+            } else if (text[pos] == ' ' || text[pos] == '\t' ||
+                       text[pos] == '\r' || text[pos] == ',') {
+
+                pos++;
+
+            } else {
+
+                found = 3;
+            }
+        }
+
+        while (pos < end && text[pos] != '\n') {
+            pos++;
+        }
+        pos++;
+
+        if (found == 2 && ends[0] < UINT32_MAX && ends[1] < UINT32_MAX) {
+
+            stream_edge(stream, ends[0], ends[1]);
+
+        } else if (found) {
+
+            stream->error = "malformed edge";
+        }
+    }
+
+    return (pos < end) ? pos : end;
+}
+
+
+// Decodes little endian 32 bit vertex pairs from data[0..len); returns the
+// number of bytes consumed, which leaves out a trailing partial pair
+size_t
+stream_binary(Edge_Stream* stream, const unsigned char* data,
+              const size_t len) {
+
+    size_t pos = 0;
+
+    for (; pos + 8 <= len && !stream->error; pos += 8) {
+
+        const unsigned char* p = &data[pos];
+        stream_edge(stream,
+                    p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24,
+                    p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24);
+    }
+
+    return pos;
+}
+
+
+// Streams the edge file through fixed size reads, carrying any partial
+// line or pair over to the next read. Returns 0 on success.
+int
+stream_read(Edge_Stream* stream, FILE* in, const bool binary) {
+
+    char* buffer = malloc(READ_BUF_LEN);
+    if (!buffer) {
+
+        stream->error = "out of memory";
+        return 1;
+    }
+
+    size_t kept = 0;
+    while (!stream->error) {
+
+        const size_t got = fread(&buffer[kept], 1, READ_BUF_LEN - kept, in);
+        const size_t len = kept + got;
+        const bool last = got == 0;
+
+        if (last && ferror(in)) {
+
+            stream->error = "read failed";
+            break;
+        }
+
+        const size_t used = binary
+            ? stream_binary(stream, (unsigned char*)buffer, len)
+            : stream_text(stream, buffer, len, last);
+
+        kept = len - used;
+        if (last) {
+
+            if (kept) {
+                stream->error = "truncated edge at the end of the file";
+            }
+            break;
+        }
+
+        if (kept == READ_BUF_LEN) {
+
+            stream->error = "line too long";
+            break;
+        }
+        memmove(buffer, &buffer[used], kept);
+    }
+
+    free(buffer);
+    return stream->error != NULL;
+}
+
+
+// Parses the whole edge file through a read only mapping, leaving paging
+// to the kernel. Returns 0 on success.
+int
+stream_mmap(Edge_Stream* stream, FILE* in, const bool binary) {
+
+    struct stat info;
+    if (fstat(fileno(in), &info)) {
+
+        stream->error = "cannot stat the file";
+        return 1;
+    }
+
+    if (!info.st_size) {
+        return 0;
+    }
+
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE,
+                      fileno(in), 0);
+    if (data == MAP_FAILED) {
+
+        stream->error = "cannot map the file";
+        return 1;
+    }
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+    const size_t used = binary
+        ? stream_binary(stream, data, info.st_size)
+        : stream_text(stream, data, info.st_size, true);
+    if (!stream->error && used != (size_t)info.st_size) {
+
+        stream->error = "truncated edge at the end of the file";
+    }
+
+    munmap(data, info.st_size);
+    return stream->error != NULL;
+}
+
+
+// Prints how many components have sizes in [1, 2), [2, 4), [4, 8), ...
+void
+print_size_histogram(Disjoint_Set* set) {
+
+    uint64_t buckets[33] = {0};
+
+    for (uint32_t i = 0; i < set->count; i++) {
+
+        if (set->parent[i] == i) {
+
+            size_t bucket = 0;
+            for (uint32_t size = set->size[i]; size > 1; size >>= 1) {
+                bucket++;
+            }
+            buckets[bucket]++;
+        }
+    }
+
+    printf("Component sizes:\n");
+    for (size_t b = 0; b < 33; b++) {
+
+        if (buckets[b]) {
+
+            printf("    %10" PRIu64 " - %10" PRIu64 " : %" PRIu64 "\n",
+                   (uint64_t)1 << b, ((uint64_t)2 << b) - 1, buckets[b]);
+        }
+    }
+}
+
+
+// Writes one line per vertex with the number of its component, numbering
+// components 0, 1, ... in order of their smallest vertex. Returns 0 on
+// success.
+int
+write_labels(Disjoint_Set* set, FILE* out) {
+
+    uint32_t* labels = malloc(set->count*sizeof(uint32_t) + 1);
+    if (!labels) {
+        return 1;
+    }
+
+    memset(labels, 0xFF, set->count*sizeof(uint32_t));
+    uint32_t next = 0;
+
+    for (uint32_t v = 0; v < set->count; v++) {
+
+        const uint32_t root = dsu_find(set, v);
+        if (labels[root] == UINT32_MAX) {
+            labels[root] = next++;
+        }
+
+        if (fprintf(out, "%" PRIu32 "\n", labels[root]) < 0) {
+
+            free(labels);
+            return 1;
+        }
+    }
+
+    free(labels);
+    return 0;
+}
+
+
+// Runs the connected components tool on the edge file in_name; see USAGE.
+// vertex_count fixes the number of vertices, or is 0 to size the set by the
+// largest vertex seen.
+int
+components_cli(const char* in_name, const uint32_t vertex_count,
+               const bool binary, const bool use_mmap,
+               const char* label_name) {
+
+    FILE* in = fopen(in_name, "rb");
+    if (!in) {
+
+        fprintf(stderr, "Failed to open %s.\n", in_name);
+        return EXIT_FAILURE;
+    }
+
+    Edge_Stream stream = {
+        .set = dsu_alloc(vertex_count),
+        .block = malloc(sizeof(Edge[EDGE_BLOCK_LEN])),
+        .fixed_count = vertex_count > 0
+    };
+    if (!stream.set || !stream.block) {
+
+        fprintf(stderr, "Failed to allocate memory.\n");
+        dsu_free(stream.set);
+        free(stream.block);
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    const clock_t begin = clock();
+    const int failed = use_mmap ? stream_mmap(&stream, in, binary)
+                                : stream_read(&stream, in, binary);
+    if (!failed) {
+        stream_flush(&stream);
+    }
+    const double seconds = (double)(clock() - begin)/CLOCKS_PER_SEC;
+    fclose(in);
+
+    if (stream.error) {
+
+        if (binary) {
+
+            fprintf(stderr, "Failed to read %s: %s.\n", in_name,
+                    stream.error);
+
+        } else {
+
+            fprintf(stderr, "Failed to read %s: %s on line %" PRIu64 ".\n",
+                    in_name, stream.error, stream.line);
+        }
+
+        dsu_free(stream.set);
+        free(stream.block);
+        return EXIT_FAILURE;
+    }
+
+    printf("%" PRIu32 " vertices, %" PRIu64 " edges, %" PRIu32
+           " components in %.2f s (%.1f M edges/s)\n", stream.set->count,
+           stream.edges, stream.set->components, seconds,
+           stream.edges/seconds*1e-6);
+    print_size_histogram(stream.set);
+
+    int status = EXIT_SUCCESS;
+    if (label_name) {
+
+        FILE* out = fopen(label_name, "w");
+        if (!out || write_labels(stream.set, out)) {
+
+            fprintf(stderr, "Failed to write the labels to %s.\n",
+                    label_name);
+            status = EXIT_FAILURE;
+        }
+
+        if (out && fclose(out)) {
+
+            fprintf(stderr, "Failed to write the labels to %s.\n",
+                    label_name);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    dsu_free(stream.set);
+    free(stream.block);
+    return status;
+}
+
+
+int
+main(int argc, char * argv[static argc]) {
+    
+    uint64_t unions = BENCH_UNIONS;
+    uint64_t elements = BENCH_ELEMENTS;
+    size_t thread_count = default_thread_count();
+    bool concurrent = false;
+    bool dynamic = false;
+    const char* edge_name = NULL;
+    const char* label_name = NULL;
+    uint64_t vertex_count = 0;
+    bool binary = false;
+    bool use_mmap = false;
+    bool threads_given = false;
+    char* end = NULL;
+    int arg = 1;
+
+    while (arg < argc && argv[arg][0] == '-') {
+
+        if (!strcmp(argv[arg], "-j") && arg + 1 < argc) {
+
+            thread_count = strtoull(argv[arg + 1], &end, 10);
+            if (*end || !thread_count || thread_count > MAX_THREADS) {
+
+                printf(USAGE);
+                exit(EXIT_FAILURE);
+            }
+            threads_given = true;
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-c")) {
+
+            concurrent = true;
+            arg++;
+
+        } else if (!strcmp(argv[arg], "-d")) {
+
+            dynamic = true;
+            unions = BENCH_OPS;
+            elements = BENCH_VERTICES;
+            arg++;
+
+        } else if (!strcmp(argv[arg], "-e") && arg + 1 < argc) {
+
+            edge_name = argv[arg + 1];
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-l") && arg + 1 < argc) {
+
+            label_name = argv[arg + 1];
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-n") && arg + 1 < argc) {
+
+            vertex_count = strtoull(argv[arg + 1], &end, 10);
+            if (*end || !vertex_count || vertex_count > UINT32_MAX) {
+
+                printf(USAGE);
+                exit(EXIT_FAILURE);
+            }
+            arg += 2;
+
+        } else if (!strcmp(argv[arg], "-b")) {
+
+            binary = true;
+            arg++;
+
+        } else if (!strcmp(argv[arg], "-m")) {
+
+            use_mmap = true;
+            arg++;
+
+        } else {
+
+            printf(USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // -b, -m, -n and -l only apply to -e, the benchmark options only apply
+    // without it, and -d runs on one thread
+    const bool edge_options = binary || use_mmap || vertex_count
+                              || label_name;
+    const bool bench_options = concurrent || dynamic || threads_given;
+    if (argc - arg > 2 || (edge_name ? bench_options : edge_options)
+        || (dynamic && (concurrent || threads_given))) {
+
+        printf(USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+    if (edge_name) {
+
+        if (argc - arg > 0) {
+
+            printf(USAGE);
+            exit(EXIT_FAILURE);
+        }
+
+        exit(components_cli(edge_name, vertex_count, binary, use_mmap,
+                            label_name));
+    }
+
+    size_t PARENT[10] = {1, 2, SIZE_MAX, 1, 3, 4, SIZE_MAX, 8, 6, 8};
+
+    Union(PARENT, 7, 3);
+    printf("The root is: %zu\n", Find(PARENT, 5));
+
+    if (argc - arg > 0) {
+
+        unions = strtoull(argv[arg], &end, 10);
+        if (*end || !unions) {
+
+            printf(USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - arg > 1) {
+
+        elements = strtoull(argv[arg + 1], &end, 10);
+        if (*end || !elements || elements > UINT32_MAX) {
+
+            printf(USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (dynamic) {
+
+        if (bench_connectivity(unions, elements)) {
+
+            fprintf(stderr, "Failed to allocate memory.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        exit(EXIT_SUCCESS);
+    }
+
+    if (concurrent) {
+
+        if (bench_components(unions, elements, thread_count)) {
+
+            fprintf(stderr, "Failed to allocate memory.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        exit(EXIT_SUCCESS);
+    }
+
+    if (bench_unions(unions, elements)) {
+
+        fprintf(stderr, "Failed to allocate memory.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    Union(PARENT, 7, 3);
-    printf("The root is: %zu\n", Find(PARENT, 5));
     exit(EXIT_SUCCESS);
 }
 
@@ -5,6 +5,20 @@
 #include <complex.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <float.h>
+
+#define RIDDERS_TABLE 10
+#define RIDDERS_SHRINK 1.4
+#define RIDDERS_SAFE 2.0
+#define EXPR_MAX_CODE 128
+#define EXPR_MAX_REGS 128
+#define EXPR_MAX_DEPTH 64
+#define EXPR_MAX_POWI 64
+#define EXPR_BATCH_LEN 128
+#define USAGE "Usage: ./ch5 [-f EXPR RE IM]\n"
 
 typedef double complex lfc_t;
 
@@ -20,100 +34,904 @@ struct Cmpl_Deriv_Result{
     Num_Deriv_Error error;
 };
 
+// Cmpl_Deriv_Result in the other floating point types
+typedef Cmpl_Deriv_Result Cmpl_Deriv_Result_d;
+
+typedef struct Cmpl_Deriv_Result_f Cmpl_Deriv_Result_f;
+struct Cmpl_Deriv_Result_f{
+    float complex value;
+    Num_Deriv_Error error;
+};
+
+typedef struct Cmpl_Deriv_Result_ld Cmpl_Deriv_Result_ld;
+struct Cmpl_Deriv_Result_ld{
+    long double complex value;
+    Num_Deriv_Error error;
+};
+
+// Picks name_f, name_d or name_ld by the type of the function f
+#define CMPL_GENERIC(name, f) \
+    _Generic((f), float complex (*)(const float complex): name##_f, \
+             double complex (*)(const double complex): name##_d, \
+             long double complex (*)(const long double complex): name##_ld)
+
+typedef enum {
+
+    OP_CONST,
+    OP_VAR,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_NEG,
+    OP_POW,
+    OP_POWI,
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_EXP,
+    OP_LOG,
+    OP_SQRT,
+    OP_ABS
+} Expr_Op;
+
+// dst = op(a, b) on registers; OP_CONST loads consts[a] and OP_POWI raises
+// register a to the literal power b
+typedef struct Expr_Instr Expr_Instr;
+struct Expr_Instr {
+
+    uint8_t op;
+    uint8_t dst;
+    uint8_t a;
+    uint8_t b;
+};
+
+// A formula compiled by expr_compile. The value ends up in register result.
+typedef struct Expr Expr;
+struct Expr {
+
+    size_t length;
+    size_t reg_count;
+    size_t const_count;
+    size_t result;
+    size_t error_pos;
+    Expr_Instr code[EXPR_MAX_CODE];
+    lfc_t consts[EXPR_MAX_CODE];
+};
+
+typedef struct Expr_Parser Expr_Parser;
+struct Expr_Parser {
+
+    const char* src;
+    size_t pos;
+    size_t depth;
+    bool failed;
+    Expr* expr;
+};
+
+// Names an expression may use: the variable, constants and functions
+typedef struct Expr_Name Expr_Name;
+struct Expr_Name {
+
+    const char* name;
+    Expr_Op op;
+    lfc_t value;
+};
+
+static const Expr_Name EXPR_NAMES[] = {
+    {"z", OP_VAR, 0},
+    {"i", OP_CONST, I},
+    {"pi", OP_CONST, M_PI},
+    {"e", OP_CONST, M_E},
+    {"sin", OP_SIN, 0},
+    {"cos", OP_COS, 0},
+    {"tan", OP_TAN, 0},
+    {"exp", OP_EXP, 0},
+    {"log", OP_LOG, 0},
+    {"sqrt", OP_SQRT, 0},
+    {"abs", OP_ABS, 0}
+};
+
+// Result of an adaptive derivative: the estimate, a bound on its error and
+// the number of evaluations of f that went into it
+typedef struct Cmpl_Adaptive_Result Cmpl_Adaptive_Result;
+struct Cmpl_Adaptive_Result{
+    lfc_t value;
+    double error_estimate;
+    size_t evaluations;
+    Num_Deriv_Error error;
+};
+
+// A complex value together with its complex derivative. Functions written
+// with the cdual_* operations yield f(z) and the exact f'(z) from a single
+// evaluation, instead of the five of cmpl_deriv.
+typedef struct Cmpl_Dual Cmpl_Dual;
+struct Cmpl_Dual{
+    lfc_t value;
+    lfc_t deriv;
+};
+
 
 // Given z = x + iy and f(z) = u(x,y) + iv(x,y), computes f'(z) as:
 // du/dx + i*dv/dx with both derivatives evaluated at z_0
-Cmpl_Deriv_Result 
-cmpl_deriv(lfc_t (*f)(const lfc_t), const lfc_t z, const double dz) {
-    
-    const double h = fabs(dz/2);
-
-    const lfc_t f1 = f(z - 2*(lfc_t)h);
-    const lfc_t f2 = f(z - (lfc_t)h);
-    const lfc_t f3 = f(z);
-    const lfc_t f4 = f(z + (lfc_t)h);
-    const lfc_t f5 = f(z + 2*(lfc_t)h);
-
-    const double u1 = creal(f1);
-    const double u2 = creal(f2);
-    const double u3 = creal(f3);
-    const double u4 = creal(f4);
-    const double u5 = creal(f5);
-
-    const double v1 = cimag(f1);
-    const double v2 = cimag(f2);
-    const double v3 = cimag(f3);
-    const double v4 = cimag(f4);
-    const double v5 = cimag(f5);
-
-    Cmpl_Deriv_Result result = {0, SUCCESS};
-    
-    const double dudx = (u1 - 8*u2 + 8*u4 - u5) / (12*h);
-    const double dvdx = (v1 - 8*v2 + 8*v4 - v5) / (12*h);
+//
+// Written once for the real type T, whose complex type is C, and
+// instantiated as cmpl_deriv_f, cmpl_deriv_d and cmpl_deriv_ld. RE, IM and
+// ABS are the creal, cimag and fabs of T. cmpl_deriv picks one by the type
+// of f, since literals such as 1 + I*3 are float complex whatever the
+// caller means.
+#define DEFINE_CMPL_DERIV(T, C, S, RE, IM, ABS)                             \
+                                                                            \
+Cmpl_Deriv_Result_##S                                                       \
+cmpl_deriv_##S(C (*f)(const C), const C z, const T dz) {                    \
+                                                                            \
+    const T h = ABS(dz/2);                                                  \
+                                                                            \
+    const C f1 = f(z - 2*(C)h);                                             \
+    const C f2 = f(z - (C)h);                                               \
+    const C f3 = f(z);                                                      \
+    const C f4 = f(z + (C)h);                                               \
+    const C f5 = f(z + 2*(C)h);                                             \
+                                                                            \
+    const T u1 = RE(f1);                                                    \
+    const T u2 = RE(f2);                                                    \
+    const T u3 = RE(f3);                                                    \
+    const T u4 = RE(f4);                                                    \
+    const T u5 = RE(f5);                                                    \
+                                                                            \
+    const T v1 = IM(f1);                                                    \
+    const T v2 = IM(f2);                                                    \
+    const T v3 = IM(f3);                                                    \
+    const T v4 = IM(f4);                                                    \
+    const T v5 = IM(f5);                                                    \
+                                                                            \
+    Cmpl_Deriv_Result_##S result = {0, SUCCESS};                            \
+                                                                            \
+    const T dudx = (u1 - 8*u2 + 8*u4 - u5) / (12*h);                        \
+    const T dvdx = (v1 - 8*v2 + 8*v4 - v5) / (12*h);                        \
+                                                                            \
+    if (isnan(dudx) || isinf(dudx) || isnan(dvdx) || isinf(dvdx) ||         \
+        isnan(u3) || isinf(u3) || isnan(v3) || isinf(v3) ) {                \
+                                                                            \
+        result.error = UNDEFINED;                                           \
+        return result;                                                      \
+    }                                                                       \
+                                                                            \
+    result.value = (C)dudx + I*(C)dvdx;                                     \
+                                                                            \
+    const bool u_monotonic = (u1 < u2 && u2 < u3 && u3 < u4 && u4 < u5) ||  \
+                             (u1 > u2 && u2 > u3 && u3 > u4 && u4 > u5);    \
+    const bool v_monotonic = (v1 < v2 && v2 < v3 && v3 < v4 && v4 < v5) ||  \
+                             (v1 > v2 && v2 > v3 && v3 > v4 && v4 > v5);    \
+                                                                            \
+    if (u_monotonic && v_monotonic) {                                       \
+        return result;                                                      \
+    }                                                                       \
+                                                                            \
+    const bool u_right_hump = (u4 > u3 && u4 > u5) || (u4 < u3 && u4 < u5); \
+    const bool u_left_hump = (u2 > u1 && u2 > u3) || (u2 < u1 && u2 < u3);  \
+                                                                            \
+    if (u_right_hump) {                                                     \
+                                                                            \
+        if (u_left_hump || ABS(2*u4 - u3 - u5) > ABS(u3 - u1)) {            \
+                                                                            \
+            result.error = UNSTABLE;                                        \
+            return result;                                                  \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    if (u_left_hump) {                                                      \
+                                                                            \
+        if (u_right_hump || ABS(2*u2 - u1 - u3) > ABS(u5 - u3)) {           \
+                                                                            \
+            result.error = UNSTABLE;                                        \
+            return result;                                                  \
+        }                                                                   \
+                                                                            \
+    }                                                                       \
+                                                                            \
+    const bool v_right_hump = (v4 > v3 && v4 > v5) || (v4 < v3 && v4 < v5); \
+    const bool v_left_hump = (v2 > v1 && v2 > v3) || (v2 < v1 && v2 < v3);  \
+                                                                            \
+    if (v_right_hump) {                                                     \
+                                                                            \
+        if (v_left_hump || ABS(2*v4 - v3 - v5) > ABS(v3 - v1)) {            \
+                                                                            \
+            result.error = UNSTABLE;                                        \
+            return result;                                                  \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    if (v_left_hump) {                                                      \
+                                                                            \
+        if (v_right_hump || ABS(2*v2 - v1 - v3) > ABS(v5 - v3)) {           \
+                                                                            \
+            result.error = UNSTABLE;                                        \
+            return result;                                                  \
+        }                                                                   \
+                                                                            \
+    }                                                                       \
+                                                                            \
+    return result;                                                          \
+}
+
+DEFINE_CMPL_DERIV(float, float complex, f, crealf, cimagf, fabsf)
+DEFINE_CMPL_DERIV(double, double complex, d, creal, cimag, fabs)
+DEFINE_CMPL_DERIV(long double, long double complex, ld, creall, cimagl, fabsl)
+
+#define cmpl_deriv(f, z, dz) CMPL_GENERIC(cmpl_deriv, f)(f, z, dz)
+
+
+
+Cmpl_Dual
+cdual_var(const lfc_t z) {
 
-    if (isnan(dudx) || isinf(dudx) || isnan(dvdx) || isinf(dvdx) ||
-        isnan(u3) || isinf(u3) || isnan(v3) || isinf(v3) ) {
+    return (Cmpl_Dual) {z, 1};
+}
+
+
+Cmpl_Dual
+cdual_const(const lfc_t c) {
+
+    return (Cmpl_Dual) {c, 0};
+}
+
+
+Cmpl_Dual
+cdual_add(const Cmpl_Dual a, const Cmpl_Dual b) {
+
+    return (Cmpl_Dual) {a.value + b.value, a.deriv + b.deriv};
+}
+
+
+Cmpl_Dual
+cdual_sub(const Cmpl_Dual a, const Cmpl_Dual b) {
+
+    return (Cmpl_Dual) {a.value - b.value, a.deriv - b.deriv};
+}
 
+
+Cmpl_Dual
+cdual_mul(const Cmpl_Dual a, const Cmpl_Dual b) {
+
+    return (Cmpl_Dual) {a.value*b.value, a.deriv*b.value + a.value*b.deriv};
+}
+
+
+Cmpl_Dual
+cdual_div(const Cmpl_Dual a, const Cmpl_Dual b) {
+
+    return (Cmpl_Dual) {a.value/b.value,
+                        (a.deriv*b.value - a.value*b.deriv)
+                        / (b.value*b.value)};
+}
+
+
+Cmpl_Dual
+cdual_exp(const Cmpl_Dual a) {
+
+    const lfc_t value = cexp(a.value);
+
+    return (Cmpl_Dual) {value, value*a.deriv};
+}
+
+
+// Principal branch, like clog
+Cmpl_Dual
+cdual_log(const Cmpl_Dual a) {
+
+    return (Cmpl_Dual) {clog(a.value), a.deriv/a.value};
+}
+
+
+Cmpl_Dual
+cdual_sin(const Cmpl_Dual a) {
+
+    return (Cmpl_Dual) {csin(a.value), ccos(a.value)*a.deriv};
+}
+
+
+Cmpl_Dual
+cdual_cos(const Cmpl_Dual a) {
+
+    return (Cmpl_Dual) {ccos(a.value), -csin(a.value)*a.deriv};
+}
+
+
+// Computes a^b on the principal branch. A constant exponent uses the power
+// rule, which stays defined at a = 0 for exponents of at least one.
+Cmpl_Dual
+cdual_pow(const Cmpl_Dual a, const Cmpl_Dual b) {
+
+    const lfc_t value = cpow(a.value, b.value);
+
+    if (b.deriv == 0) {
+
+        return (Cmpl_Dual) {value,
+                            b.value*cpow(a.value, b.value - 1)*a.deriv};
+    }
+
+    return (Cmpl_Dual) {value, value*(b.deriv*clog(a.value)
+                                      + b.value*a.deriv/a.value)};
+}
+
+
+// Computes f'(z) exactly from one evaluation of f on dual numbers
+Cmpl_Deriv_Result
+cmpl_dual_deriv(Cmpl_Dual (*f)(const Cmpl_Dual), const lfc_t z) {
+
+    const Cmpl_Dual fz = f(cdual_var(z));
+    Cmpl_Deriv_Result result = {fz.deriv, SUCCESS};
+
+    if (isnan(creal(fz.value)) || isinf(creal(fz.value)) ||
+        isnan(cimag(fz.value)) || isinf(cimag(fz.value)) ||
+        isnan(creal(fz.deriv)) || isinf(creal(fz.deriv)) ||
+        isnan(cimag(fz.deriv)) || isinf(cimag(fz.deriv))) {
+
+        result.value = 0;
         result.error = UNDEFINED;
-        return result;
     }
-    
-    result.value = (lfc_t)dudx + I*(lfc_t)dvdx;
 
-    const bool u_monotonic = (u1 < u2 && u2 < u3 && u3 < u4 && u4 < u5) ||
-                             (u1 > u2 && u2 > u3 && u3 > u4 && u4 > u5);
-    const bool v_monotonic = (v1 < v2 && v2 < v3 && v3 < v4 && v4 < v5) ||
-                             (v1 > v2 && v2 > v3 && v3 > v4 && v4 > v5);
+    return result;
+}
+
+
+// Ridders' method along the real axis, as in ch2: central differences with
+// a shrinking step, extrapolated in a Richardson tableau until the error
+// estimate reaches tol or starts to grow. tol is relative to |f'| past 1,
+// as in ch2, and an unmet tol is UNSTABLE.
+Cmpl_Adaptive_Result
+cmpl_deriv_ridders(lfc_t (*f)(const lfc_t), const lfc_t z, const double h,
+                   const double tol) {
+
+    lfc_t table[RIDDERS_TABLE][RIDDERS_TABLE];
+    double step = fabs(h);
+    Cmpl_Adaptive_Result result = {.error_estimate = INFINITY,
+                                   .error = SUCCESS};
+
+    table[0][0] = (f(z + step) - f(z - step)) / (2*step);
+    result.evaluations = 2;
+    result.value = table[0][0];
+
+    for (size_t i = 1; i < RIDDERS_TABLE; i++) {
+
+        step /= RIDDERS_SHRINK;
+        table[0][i] = (f(z + step) - f(z - step)) / (2*step);
+        result.evaluations += 2;
+
+        double factor = RIDDERS_SHRINK*RIDDERS_SHRINK;
+        for (size_t j = 1; j <= i; j++) {
+
+            table[j][i] = (table[j - 1][i]*factor - table[j - 1][i - 1])
+                          / (factor - 1);
+            factor *= RIDDERS_SHRINK*RIDDERS_SHRINK;
+
+            const double err = fmax(cabs(table[j][i] - table[j - 1][i]),
+                                    cabs(table[j][i] - table[j - 1][i - 1]));
+            if (err <= result.error_estimate) {
+
+                result.error_estimate = err;
+                result.value = table[j][i];
+            }
+        }
+
+        if (result.error_estimate <= tol*fmax(1, cabs(result.value)) ||
+            cabs(table[i][i] - table[i - 1][i - 1])
+            >= RIDDERS_SAFE*result.error_estimate) {
+            break;
+        }
+    }
+
+    if (isnan(creal(result.value)) || isinf(creal(result.value)) ||
+        isnan(cimag(result.value)) || isinf(cimag(result.value))) {
 
-    if (u_monotonic && v_monotonic) { 
-        return result;
+        result.value = 0;
+        result.error = UNDEFINED;
+
+    } else if (!(result.error_estimate
+                 <= tol*fmax(1, cabs(result.value)))) {
+
+        result.error = UNSTABLE;
     }
-    
-    const bool u_right_hump = (u4 > u3 && u4 > u5) || (u4 < u3 && u4 < u5);
-    const bool u_left_hump = (u2 > u1 && u2 > u3) || (u2 < u1 && u2 < u3); 
 
-    if (u_right_hump) {
-        
-        if (u_left_hump || fabs(2*u4 - u3 - u5) > fabs(u3 - u1)) { 
-            
-            result.error = UNSTABLE;
-            return result;
+    return result;
+}
+
+
+// Evaluates every instruction of expr across n points at a time, so the
+// cost of decoding an instruction is paid once per EXPR_BATCH_LEN points
+// rather than once per point
+void
+expr_eval_batch(const Expr* expr, const size_t n, const lfc_t xs[static n],
+                lfc_t ys[static n]) {
+
+    lfc_t regs[expr->reg_count][EXPR_BATCH_LEN];
+
+    for (size_t first = 0; first < n; first += EXPR_BATCH_LEN) {
+
+        const size_t len = (n - first < EXPR_BATCH_LEN)
+                           ? n - first : EXPR_BATCH_LEN;
+        const lfc_t* x = &xs[first];
+
+        for (size_t pc = 0; pc < expr->length; pc++) {
+
+            const Expr_Instr in = expr->code[pc];
+            lfc_t* d = regs[in.dst];
+
+            switch (in.op) {
+
+                case OP_CONST:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = expr->consts[in.a];
+                    }
+                    break;
+
+                case OP_VAR:
+                    memcpy(d, x, sizeof(lfc_t[len]));
+                    break;
+
+                case OP_ADD:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] + regs[in.b][i];
+                    }
+                    break;
+
+                case OP_SUB:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] - regs[in.b][i];
+                    }
+                    break;
+
+                case OP_MUL:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] * regs[in.b][i];
+                    }
+                    break;
+
+                case OP_DIV:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = regs[in.a][i] / regs[in.b][i];
+                    }
+                    break;
+
+                case OP_NEG:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = -regs[in.a][i];
+                    }
+                    break;
+
+                case OP_POW:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = cpow(regs[in.a][i], regs[in.b][i]);
+                    }
+                    break;
+
+                // Exponent in in.b, by repeated squaring
+                case OP_POWI:
+                    for (size_t i = 0; i < len; i++) {
+
+                        lfc_t power = 1;
+                        lfc_t base = regs[in.a][i];
+                        for (unsigned e = in.b; e; e >>= 1) {
+
+                            if (e & 1) {
+                                power *= base;
+                            }
+                            base *= base;
+                        }
+                        d[i] = power;
+                    }
+                    break;
+
+                case OP_SIN:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = csin(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_COS:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = ccos(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_TAN:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = ctan(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_EXP:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = cexp(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_LOG:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = clog(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_SQRT:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = csqrt(regs[in.a][i]);
+                    }
+                    break;
+
+                case OP_ABS:
+                    for (size_t i = 0; i < len; i++) {
+                        d[i] = cabs(regs[in.a][i]);
+                    }
+                    break;
+            }
         }
+
+        memcpy(&ys[first], regs[expr->result], sizeof(lfc_t[len]));
     }
+}
+
+
+lfc_t
+expr_eval(const Expr* expr, const lfc_t x) {
+
+    lfc_t y;
+    expr_eval_batch(expr, 1, &x, &y);
+
+    return y;
+}
+
+
+// Appends an instruction writing to a fresh register and returns that
+// register, or -1 once the program or register file is full
+int
+expr_emit(Expr_Parser* parser, const Expr_Op op, const int a, const int b) {
+
+    Expr* expr = parser->expr;
+
+    if (a < 0 || b < 0 || expr->length >= EXPR_MAX_CODE
+        || expr->reg_count >= EXPR_MAX_REGS) {
+
+        parser->failed = true;
+        return -1;
+    }
+
+    expr->code[expr->length++] = (Expr_Instr) {
+        .op = op, .dst = expr->reg_count, .a = a, .b = b
+    };
+
+    return expr->reg_count++;
+}
+
 
-    if (u_left_hump) {
-        
-        if (u_right_hump || fabs(2*u2 - u1 - u3) > fabs(u5 - u3)) {
-            
-            result.error = UNSTABLE;
-            return result;
+void
+expr_skip_space(Expr_Parser* parser) {
+
+    while (isspace((unsigned char)parser->src[parser->pos])) {
+
+        parser->pos++;
+    }
+}
+
+
+bool
+expr_accept(Expr_Parser* parser, const char c) {
+
+    expr_skip_space(parser);
+    if (parser->src[parser->pos] != c) {
+
+        return false;
+    }
+
+    parser->pos++;
+    return true;
+}
+
+
+int expr_parse_sum(Expr_Parser* parser);
+int expr_parse_unary(Expr_Parser* parser);
+
+
+// primary = number | variable | constant | function "(" sum ")" | "(" sum ")"
+int
+expr_parse_primary(Expr_Parser* parser) {
+
+    Expr* expr = parser->expr;
+    expr_skip_space(parser);
+    const char* start = &parser->src[parser->pos];
+
+    if (isdigit((unsigned char)*start) || *start == '.') {
+
+        char* end = NULL;
+        const double value = strtod(start, &end);
+        if (end == start || expr->const_count >= EXPR_MAX_CODE) {
+
+            parser->failed = true;
+            return -1;
         }
-        
+
+        parser->pos += end - start;
+        expr->consts[expr->const_count] = value;
+        return expr_emit(parser, OP_CONST, expr->const_count++, 0);
     }
 
-    const bool v_right_hump = (v4 > v3 && v4 > v5) || (v4 < v3 && v4 < v5);
-    const bool v_left_hump = (v2 > v1 && v2 > v3) || (v2 < v1 && v2 < v3); 
+    if (expr_accept(parser, '(')) {
 
-    if (v_right_hump) {
-        
-        if (v_left_hump || fabs(2*v4 - v3 - v5) > fabs(v3 - v1)) { 
-            
-            result.error = UNSTABLE;
-            return result;
+        const int reg = expr_parse_sum(parser);
+        if (!expr_accept(parser, ')')) {
+
+            parser->failed = true;
+            return -1;
         }
+        return reg;
+    }
+
+    size_t name_len = 0;
+    while (isalpha((unsigned char)start[name_len])) {
+
+        name_len++;
     }
 
-    if (v_left_hump) {
-        
-        if (v_right_hump || fabs(2*v2 - v1 - v3) > fabs(v5 - v3)) {
-            
-            result.error = UNSTABLE;
-            return result;
+    if (!name_len) {
+
+        parser->failed = true;
+        return -1;
+    }
+    parser->pos += name_len;
+
+    for (size_t i = 0; i < sizeof(EXPR_NAMES)/sizeof(EXPR_NAMES[0]); i++) {
+
+        if (strlen(EXPR_NAMES[i].name) != name_len
+            || strncmp(EXPR_NAMES[i].name, start, name_len)) {
+            continue;
+        }
+
+        if (EXPR_NAMES[i].op == OP_VAR) {
+
+            return expr_emit(parser, OP_VAR, 0, 0);
+        }
+
+        if (EXPR_NAMES[i].op == OP_CONST) {
+
+            if (expr->const_count >= EXPR_MAX_CODE) {
+
+                parser->failed = true;
+                return -1;
+            }
+
+            expr->consts[expr->const_count] = EXPR_NAMES[i].value;
+            return expr_emit(parser, OP_CONST, expr->const_count++, 0);
+        }
+
+        if (!expr_accept(parser, '(')) {
+
+            parser->failed = true;
+            return -1;
         }
-        
+
+        const int arg = expr_parse_sum(parser);
+        if (!expr_accept(parser, ')')) {
+
+            parser->failed = true;
+            return -1;
+        }
+
+        return expr_emit(parser, EXPR_NAMES[i].op, arg, 0);
     }
-    
-    return result;
+
+    parser->pos -= name_len;
+    parser->failed = true;
+    return -1;
+}
+
+
+// power = primary ["^" unary], right associative. Small integer literal
+// exponents compile to OP_POWI, which stays exact for negative bases.
+int
+expr_parse_power(Expr_Parser* parser) {
+
+    const int base = expr_parse_primary(parser);
+
+    if (parser->failed || !expr_accept(parser, '^')) {
+
+        return base;
+    }
+
+    expr_skip_space(parser);
+    const char* start = &parser->src[parser->pos];
+    char* end = NULL;
+    const long exponent = strtol(start, &end, 10);
+
+    // A literal followed by another ^ is the base of a power itself, which
+    // the general path below handles right-associatively
+    const char* next = end;
+    while (isspace((unsigned char)*next)) {
+        next++;
+    }
+
+    if (end != start && isdigit((unsigned char)*start)
+        && exponent <= EXPR_MAX_POWI
+        && (*end == '\0' || !strchr(".eE", *end)) && *next != '^') {
+
+        parser->pos += end - start;
+        return expr_emit(parser, OP_POWI, base, exponent);
+    }
+
+    const int power = expr_parse_unary(parser);
+    return expr_emit(parser, OP_POW, base, power);
+}
+
+
+// unary = "-" unary | "+" unary | power. Every level of nesting passes
+// through here, so this is where the recursion depth is bounded.
+int
+expr_parse_unary(Expr_Parser* parser) {
+
+    int reg = -1;
+
+    if (++parser->depth > EXPR_MAX_DEPTH) {
+
+        parser->failed = true;
+
+    } else if (expr_accept(parser, '-')) {
+
+        reg = expr_emit(parser, OP_NEG, expr_parse_unary(parser), 0);
+
+    } else if (expr_accept(parser, '+')) {
+
+        reg = expr_parse_unary(parser);
+
+    } else {
+
+        reg = expr_parse_power(parser);
+    }
+
+    parser->depth--;
+    return reg;
+}
+
+
+// product = unary {("*" | "/") unary}
+int
+expr_parse_product(Expr_Parser* parser) {
+
+    int reg = expr_parse_unary(parser);
+
+    while (!parser->failed) {
+
+        if (expr_accept(parser, '*')) {
+
+            reg = expr_emit(parser, OP_MUL, reg, expr_parse_unary(parser));
+
+        } else if (expr_accept(parser, '/')) {
+
+            reg = expr_emit(parser, OP_DIV, reg, expr_parse_unary(parser));
+
+        } else {
+
+            break;
+        }
+    }
+
+    return reg;
+}
+
+
+// sum = product {("+" | "-") product}
+int
+expr_parse_sum(Expr_Parser* parser) {
+
+    int reg = expr_parse_product(parser);
+
+    while (!parser->failed) {
+
+        if (expr_accept(parser, '+')) {
+
+            reg = expr_emit(parser, OP_ADD, reg, expr_parse_product(parser));
+
+        } else if (expr_accept(parser, '-')) {
+
+            reg = expr_emit(parser, OP_SUB, reg, expr_parse_product(parser));
+
+        } else {
+
+            break;
+        }
+    }
+
+    return reg;
+}
+
+
+// Compiles src into expr. Every node of the expression gets its own
+// register, so the program is a straight line with no stack. Returns 0 on
+// success and 1 on a syntax error, leaving its offset in expr->error_pos.
+int
+expr_compile(Expr* expr, const char* src) {
+
+    *expr = (Expr) {0};
+    Expr_Parser parser = {.src = src, .expr = expr};
+
+    const int result = expr_parse_sum(&parser);
+    expr_skip_space(&parser);
+
+    if (parser.failed || result < 0 || src[parser.pos]) {
+
+        expr->error_pos = parser.pos;
+        return 1;
+    }
+
+    expr->result = result;
+    return 0;
+}
+
+
+// The formula given on the command line, behind the function pointer
+// signature cmpl_deriv takes
+static Expr cli_expr;
+
+
+lfc_t
+cli_f(const lfc_t z) {
+
+    return expr_eval(&cli_expr, z);
+}
+
+
+// Differentiates the formula src at re + i*im with the stencil and with
+// Ridders' method
+int
+deriv_cli(const char* src, const char* re, const char* im) {
+
+    if (expr_compile(&cli_expr, src)) {
+
+        fprintf(stderr, "Syntax error at offset %zu: %s\n",
+                cli_expr.error_pos, &src[cli_expr.error_pos]);
+        return EXIT_FAILURE;
+    }
+
+    char* re_end = NULL;
+    char* im_end = NULL;
+    const lfc_t z = CMPLX(strtod(re, &re_end), strtod(im, &im_end));
+    if (re_end == re || *re_end || im_end == im || *im_end) {
+
+        printf(USAGE);
+        return EXIT_FAILURE;
+    }
+
+    const char* err_txt[] = {
+        [SUCCESS] = "",
+        [UNDEFINED] = "Derivative is not defined!",
+        [UNSTABLE] = "Derivative is unstable!"
+    };
+
+    printf("d/dz (%s) @ %g + %gi\n", src, creal(z), cimag(z));
+
+    const Cmpl_Deriv_Result res = cmpl_deriv(cli_f, z, 1e-6);
+    if (!res.error) {
+
+        printf("    stencil: %.15g + %.15gi\n",
+               creal(res.value), cimag(res.value));
+
+    } else {
+
+        printf("    stencil: %s\n", err_txt[res.error]);
+    }
+
+    const Cmpl_Adaptive_Result ares = cmpl_deriv_ridders(cli_f, z, 0.1,
+                                                         1e-12);
+    if (!ares.error) {
+
+        printf("    Ridders: %.15g + %.15gi +- %.1e (%zu evaluations)\n",
+               creal(ares.value), cimag(ares.value), ares.error_estimate,
+               ares.evaluations);
+
+    } else {
+
+        printf("    Ridders: %s\n", err_txt[ares.error]);
+    }
+
+    return EXIT_SUCCESS;
 }
 
 
@@ -145,8 +963,147 @@ func4(const lfc_t z) {
 }
 
 
+Cmpl_Dual
+func3_dual(const Cmpl_Dual z) {
+
+    return cdual_mul(cdual_cos(cdual_div(cdual_const(1), z)), z);
+}
+
+
+Cmpl_Dual
+func4_dual(const Cmpl_Dual z) {
+
+    return cdual_div(cdual_const(1), z);
+}
+
+
+// Compiles formulas with known values, checking that integer exponents
+// compile to OP_POWI wherever they end, including at the end of the input.
+// Prints each failure and returns how many there were.
+size_t
+check_expr(void) {
+
+    const struct {
+        const char* src;
+        lfc_t x;
+        lfc_t value;
+        bool powi;
+    } cases[] = {
+        {"z^2", -3, 9, true},
+        {"(z)^3", -2, -8, true},
+        {"z^ 2", -3, 9, true},
+        {"z^2 + 1", -3, 10, true},
+        {"z^2.5", 4, 32, false},
+        {"z^2e0", 3, 9, false},
+        {"2^z", 3, 8, false},
+        {"z^3^2", 2, 512, true},
+        {"2^3^2", 0, 512, true}
+    };
+    const size_t count = sizeof(cases)/sizeof(cases[0]);
+    size_t failed = 0;
+
+    for (size_t i = 0; i < count; i++) {
+
+        Expr expr;
+        if (expr_compile(&expr, cases[i].src)) {
+
+            printf("Check of %s failed: syntax error\n", cases[i].src);
+            failed++;
+            continue;
+        }
+
+        bool powi = false;
+        bool general = false;
+        for (size_t k = 0; k < expr.length; k++) {
+
+            powi = powi || expr.code[k].op == OP_POWI;
+            general = general || expr.code[k].op == OP_POW;
+        }
+
+        const lfc_t value = expr_eval(&expr, cases[i].x);
+        // Only OP_POWI on its own has to be exact
+        const bool wrong = (powi && !general) ? value != cases[i].value
+                           : cabs(value - cases[i].value)
+                             > 1e-12*cabs(cases[i].value);
+        if (powi != cases[i].powi || wrong) {
+
+            printf("Check of %s failed: %s, value %.17g + %.17gi\n",
+                   cases[i].src, powi ? "OP_POWI" : "OP_POW",
+                   creal(value), cimag(value));
+            failed++;
+        }
+    }
+
+    printf("Expression compiler: %zu of %zu checks passed\n",
+           count - failed, count);
+    return failed;
+}
+
+
+// Runs Ridders' method with the tolerance of the command line on formulas
+// with known derivatives, large ones included, which only a tolerance
+// relative to |f'| lets converge. Prints each failure and returns how many
+// there were.
+size_t
+check_ridders(void) {
+
+    const struct {
+        const char* src;
+        lfc_t z;
+        lfc_t deriv;
+    } cases[] = {
+        {"sin(z)", 1, 0.54030230586813972},
+        {"exp(z)", 30, 1.0686474581524462e13},
+        {"z^64", 2, 5.9029581035870565e20}
+    };
+    const size_t count = sizeof(cases)/sizeof(cases[0]);
+    size_t failed = 0;
+
+    for (size_t i = 0; i < count; i++) {
+
+        if (expr_compile(&cli_expr, cases[i].src)) {
+
+            printf("Check of d/dz %s failed: syntax error\n", cases[i].src);
+            failed++;
+            continue;
+        }
+
+        const Cmpl_Adaptive_Result res = cmpl_deriv_ridders(cli_f, cases[i].z,
+                                                            0.1, 1e-12);
+        if (res.error || cabs(res.value - cases[i].deriv)
+                         > 1e-10*cabs(cases[i].deriv)) {
+
+            printf("Check of d/dz %s failed: error %d, value %.17g + %.17gi\n",
+                   cases[i].src, res.error, creal(res.value),
+                   cimag(res.value));
+            failed++;
+        }
+    }
+
+    printf("Ridders' method: %zu of %zu checks passed\n",
+           count - failed, count);
+    return failed;
+}
+
+
 int
-main() {
+main(int argc, char * argv[static argc]) {
+
+    if (argc > 1) {
+
+        if (argc != 5 || strcmp(argv[1], "-f")) {
+
+            printf(USAGE);
+            return EXIT_FAILURE;
+        }
+
+        return deriv_cli(argv[2], argv[3], argv[4]);
+    }
+
+    if (check_expr() || check_ridders()) {
+
+        return EXIT_FAILURE;
+    }
     
     Cmpl_Deriv_Result res = {0};
 
@@ -250,5 +1207,101 @@ main() {
             printf("Unknown error!\n");
     }
 
+    res = cmpl_dual_deriv(cdual_sin, I);
+    printf("Dual test #2: ");
+    switch (res.error) {
+
+        case UNDEFINED:
+            printf("Derivative is not defined!\n");
+            break;
+
+        case UNSTABLE:
+            printf("Derivative is unstable!\n");
+            break;
+
+        case SUCCESS:
+            printf("%f + %fi\n", creal(res.value), cimag(res.value));
+            break;
+
+        default:
+            printf("Unknown error!\n");
+    }
+
+    res = cmpl_dual_deriv(func3_dual, 0.5 + 0.5*I);
+    printf("Dual test #3: ");
+    switch (res.error) {
+
+        case UNDEFINED:
+            printf("Derivative is not defined!\n");
+            break;
+
+        case UNSTABLE:
+            printf("Derivative is unstable!\n");
+            break;
+
+        case SUCCESS:
+            printf("%f + %fi\n", creal(res.value), cimag(res.value));
+            break;
+
+        default:
+            printf("Unknown error!\n");
+    }
+
+    res = cmpl_dual_deriv(func4_dual, 0);
+    printf("Dual test #4: ");
+    switch (res.error) {
+
+        case UNDEFINED:
+            printf("Derivative is not defined!\n");
+            break;
+
+        case UNSTABLE:
+            printf("Derivative is unstable!\n");
+            break;
+
+        case SUCCESS:
+            printf("%f + %fi\n", creal(res.value), cimag(res.value));
+            break;
+
+        default:
+            printf("Unknown error!\n");
+    }
+
+    Cmpl_Adaptive_Result ares = cmpl_deriv_ridders(func3, 0.5 + 0.5*I, 0.1,
+                                                   1e-10);
+    printf("Ridders test #3: ");
+    switch (ares.error) {
+
+        case UNDEFINED:
+            printf("Derivative is not defined!\n");
+            break;
+
+        case UNSTABLE:
+            printf("Derivative is unstable!\n");
+            break;
+
+        case SUCCESS:
+            printf("%f + %fi +- %.1e (%zu evaluations)\n",
+                   creal(ares.value), cimag(ares.value),
+                   ares.error_estimate, ares.evaluations);
+            break;
+
+        default:
+            printf("Unknown error!\n");
+    }
+
+    // d/dz sin z at 1 + i in each type, with the step eps^(1/5) that
+    // balances truncation against rounding for this stencil
+    const Cmpl_Deriv_Result_f res_f = cmpl_deriv(csinf, 1 + I,
+                                                 2*powf(FLT_EPSILON, 0.2f));
+    const Cmpl_Deriv_Result_d res_d = cmpl_deriv(csin, 1 + I,
+                                                 2*pow(DBL_EPSILON, 0.2));
+    const Cmpl_Deriv_Result_ld res_ld = cmpl_deriv(csinl, 1 + I,
+                                                   2*powl(LDBL_EPSILON, 0.2L));
+    const long double complex exact = ccosl(1 + I);
+    printf("Precision: float %.1Le, double %.1Le, long double %.1Le\n",
+           cabsl(res_f.value - exact), cabsl(res_d.value - exact),
+           cabsl(res_ld.value - exact));
+
     exit(EXIT_SUCCESS);
 }
@@ -6,8 +6,52 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+
+#define BENCH_LEN (1 << 20)
+#define BENCH_REPS 8
+#define SOLVE_LEN 400
+#define COND_ITERATIONS 5
+#define GEMM_BENCH_LEN 512
+#define GEMM_MAX_BENCH_LEN 8192
+#define GEMM_PEAK_ITERATIONS (1 << 25)
+#define LANE_COUNT 4
+#define GEMM_MR 6
+#define GEMM_NR 8
+#define GEMM_MC 72
+#define GEMM_KC 256
+#define GEMM_NC 2048
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GEMM_X86
+#endif
+
+#define USAGE "Usage: ./ch6 [-g [N...]]\n"
+
+#ifdef __SIZEOF_FLOAT128__
+#define HAVE_FLOAT128
+__extension__ typedef __float128 float128;
+#define FLOAT128_GENERIC(name) , float128: name##_q
+typedef float128 Exact_Float;
+#else
+#define FLOAT128_GENERIC(name)
+typedef long double Exact_Float;
+#endif
+
+// LANE_COUNT doubles side by side, for the gemm micro kernel
+typedef double Lanes __attribute__((vector_size(LANE_COUNT*sizeof(double))));
+
+// Micro kernels multiply packed panels of A and B into a tile; see gemm
+typedef void Gemm_Kernel(size_t kc, const double* a, const double* b,
+                         double* out);
+
+// Picks name_f, name_d, name_ld or name_q by the type of x
+#define VEC_GENERIC(name, x) \
+    _Generic((x), float: name##_f, double: name##_d, \
+             long double: name##_ld FLOAT128_GENERIC(name))
 
 void
 print_vec(const size_t N, const double vec[static N]) {
@@ -26,75 +70,348 @@ print_vec(const size_t N, const double vec[static N]) {
 }
 
 
-double
-dot(const size_t N, const double vec1[static N],
-    const double vec2[static N]) {
-    
-    double result = 0;
+// The kernels below exist once per floating point type. DEFINE_VEC_KERNELS
+// writes them for type T with the suffix S, and the macros of the same
+// names pick the version matching their vector arguments with _Generic.
+#define DEFINE_VEC_KERNELS(T, S)                                           \
+                                                                           \
+T                                                                          \
+dot_##S(const size_t N, const T vec1[static N], const T vec2[static N]) {  \
+                                                                           \
+    T result = 0;                                                          \
+                                                                           \
+    for (size_t i = 0; i < N; i++) {                                       \
+                                                                           \
+        result += vec1[i]*vec2[i];                                         \
+    }                                                                      \
+                                                                           \
+    return result;                                                         \
+}                                                                          \
+                                                                           \
+                                                                           \
+/* Multiplies an N by M matrix by a vector of length M. */                 \
+void                                                                       \
+matvec_mult_##S(const size_t N, const size_t M, const T mat[static N][M],  \
+                const T vec2[static M], T result[static N]) {              \
+                                                                           \
+    for (size_t n = 0; n < N; n++) {                                       \
+                                                                           \
+        result[n] = dot_##S(M, mat[n], vec2);                              \
+    }                                                                      \
+}                                                                          \
+                                                                           \
+                                                                           \
+void                                                                       \
+mult_vec_##S(const size_t N, T vec[static N], const T mult) {              \
+                                                                           \
+    for (size_t i = 0; i < N; i++) {                                       \
+                                                                           \
+        vec[i] *= mult;                                                    \
+    }                                                                      \
+}                                                                          \
+                                                                           \
+                                                                           \
+void                                                                       \
+addmult_vec_##S(const size_t N, T dest[static N], const T from[static N], \
+                const T mult) {                                            \
+                                                                           \
+    if (dest == from) {                                                    \
+                                                                           \
+        mult_vec_##S(N, dest, mult + 1);                                   \
+        return;                                                            \
+    }                                                                      \
+                                                                           \
+    for (size_t i = 0; i < N; i++) {                                       \
+                                                                           \
+        dest[i] += mult*from[i];                                           \
+    }                                                                      \
+}
 
-    for (size_t i = 0; i < N; i++) {
-        
-        result += vec1[i]*vec2[i];
+DEFINE_VEC_KERNELS(float, f)
+DEFINE_VEC_KERNELS(double, d)
+DEFINE_VEC_KERNELS(long double, ld)
+#ifdef HAVE_FLOAT128
+DEFINE_VEC_KERNELS(float128, q)
+#endif
+
+#define dot(N, vec1, vec2) \
+    VEC_GENERIC(dot, (vec1)[0])(N, vec1, vec2)
+#define matvec_mult(N, M, mat, vec2, result) \
+    VEC_GENERIC(matvec_mult, (vec2)[0])(N, M, mat, vec2, result)
+#define mult_vec(N, vec, mult) \
+    VEC_GENERIC(mult_vec, (vec)[0])(N, vec, mult)
+#define addmult_vec(N, dest, from, mult) \
+    VEC_GENERIC(addmult_vec, (dest)[0])(N, dest, from, mult)
+
+
+// Factors the N by N matrix a in place as PA = LU with partial pivoting,
+// recording the row taken as pivot of each column in pivots. L has a unit
+// diagonal and is stored below it. Returns 0 on success, 1 if a is
+// singular.
+int
+lu_factor(const size_t N, double a[static N][N], size_t pivots[static N]) {
+
+    for (size_t c = 0; c < N; c++) {
+
+        size_t pivot = c;
+        for (size_t r = c + 1; r < N; r++) {
+
+            if (fabs(a[r][c]) > fabs(a[pivot][c])) {
+                pivot = r;
+            }
+        }
+
+        pivots[c] = pivot;
+        if (a[pivot][c] == 0) {
+
+            return 1;
+        }
+
+        if (pivot != c) {
+
+            for (size_t k = 0; k < N; k++) {
+
+                const double swap = a[c][k];
+                a[c][k] = a[pivot][k];
+                a[pivot][k] = swap;
+            }
+        }
+
+        const double lead_inv = 1.0/a[c][c];
+        for (size_t r = c + 1; r < N; r++) {
+
+            a[r][c] *= lead_inv;
+            addmult_vec(N - c - 1, &a[r][c + 1], &a[c][c + 1], -a[r][c]);
+        }
     }
 
-    return result;
+    return 0;
 }
 
 
-// Multiplies an N by M matrix by a vector of length M.
+// Solves AX = B in place in the N by M matrix b, given the factors of A
+// from lu_factor. Rows of b are updated whole, so the M right hand sides
+// share each pass over lu.
 void
-matvec_mult(const size_t N, const size_t M, const double mat[static N][M],
-            const double vec2[static M], double result[static N]) {
+lu_solve_many(const size_t N, const size_t M, double lu[static N][N],
+              const size_t pivots[static N], double b[static N][M]) {
+
+    for (size_t r = 0; r < N; r++) {
 
-    for (size_t n = 0; n < N; n++) {
-        
-        result[n] = dot(M, mat[n], vec2);
+        if (pivots[r] != r) {
+
+            for (size_t k = 0; k < M; k++) {
+
+                const double swap = b[r][k];
+                b[r][k] = b[pivots[r]][k];
+                b[pivots[r]][k] = swap;
+            }
+        }
+
+        for (size_t k = 0; k < r; k++) {
+
+            addmult_vec(M, b[r], b[k], -lu[r][k]);
+        }
+    }
+
+    for (size_t r = N; r-- > 0;) {
+
+        for (size_t k = r + 1; k < N; k++) {
+
+            addmult_vec(M, b[r], b[k], -lu[r][k]);
+        }
+        mult_vec(M, b[r], 1.0/lu[r][r]);
     }
 }
 
 
+// Solves Ax = b in place in b, given the factors of A from lu_factor
 void
-mult_vec(const size_t N, double vec[static N], const double mult) {
-    
-    for (size_t i = 0; i < N; i++) {
+lu_solve(const size_t N, double lu[static N][N],
+         const size_t pivots[static N], double b[static N]) {
 
-        vec[i] *= mult;
-    }
+    lu_solve_many(N, 1, lu, pivots, (double (*)[1])b);
 }
 
 
+// Solves the transposed system A^T x = b in place in b. As A^T = U^T L^T P,
+// this substitutes forward through U^T, back through L^T and then undoes
+// the row swaps in reverse.
 void
-addmult_vec(const size_t N, double dest[static N],
-            const double from[static N], const double mult) {
+lu_solve_transposed(const size_t N, double lu[static N][N],
+                    const size_t pivots[static N], double b[static N]) {
 
-    if (dest == from) {
+    for (size_t r = 0; r < N; r++) {
 
-        mult_vec(N, dest, mult + 1);
-        return;
+        for (size_t k = 0; k < r; k++) {
+
+            b[r] -= lu[k][r]*b[k];
+        }
+        b[r] /= lu[r][r];
+    }
+
+    for (size_t r = N; r-- > 0;) {
+
+        for (size_t k = r + 1; k < N; k++) {
+
+            b[r] -= lu[k][r]*b[k];
+        }
+    }
+
+    for (size_t r = N; r-- > 0;) {
+
+        const double swap = b[r];
+        b[r] = b[pivots[r]];
+        b[pivots[r]] = swap;
+    }
+}
+
+
+// Returns the determinant of A given its factors from lu_factor: the
+// product of the diagonal of U, negated once per row swap
+double
+lu_det(const size_t N, double lu[static N][N],
+       const size_t pivots[static N]) {
+
+    double det = 1;
+
+    for (size_t r = 0; r < N; r++) {
+
+        det *= (pivots[r] == r) ? lu[r][r] : -lu[r][r];
+    }
+
+    return det;
+}
+
+
+// Returns the largest absolute column sum of the N by N matrix a
+double
+mat_norm1(const size_t N, double a[static N][N]) {
+
+    double norm = 0;
+
+    for (size_t c = 0; c < N; c++) {
+
+        double sum = 0;
+        for (size_t r = 0; r < N; r++) {
+
+            sum += fabs(a[r][c]);
+        }
+
+        if (sum > norm) {
+            norm = sum;
+        }
+    }
+
+    return norm;
+}
+
+
+// Estimates the 1-norm condition number ||A|| ||A^-1|| of A given its
+// 1-norm and factors, without forming A^-1. Hager's method climbs to the
+// column of A^-1 with the largest sum using a few solves with A and A^T,
+// and Higham's alternating test vector guards against the cases where
+// that stalls. The estimate is a lower bound, and usually within a small
+// factor. Returns INFINITY if out of memory.
+double
+lu_cond(const size_t N, const double a_norm, double lu[static N][N],
+        const size_t pivots[static N]) {
+
+    double* x = malloc(sizeof(double[N]));
+    double* y = malloc(sizeof(double[N]));
+    if (!x || !y) {
+
+        free(x);
+        free(y);
+        return INFINITY;
     }
 
     for (size_t i = 0; i < N; i++) {
 
-        dest[i] += mult*from[i];
+        x[i] = 1.0/N;
     }
+
+    double inv_norm = 0;
+
+    for (size_t iter = 0; iter < COND_ITERATIONS; iter++) {
+
+        memcpy(y, x, sizeof(double[N]));
+        lu_solve(N, lu, pivots, y);
+
+        double y_norm = 0;
+        for (size_t i = 0; i < N; i++) {
+
+            y_norm += fabs(y[i]);
+        }
+
+        if (iter && y_norm <= inv_norm) {
+            break;
+        }
+        inv_norm = y_norm;
+
+        for (size_t i = 0; i < N; i++) {
+
+            y[i] = (y[i] < 0) ? -1 : 1;
+        }
+        lu_solve_transposed(N, lu, pivots, y);
+
+        size_t j = 0;
+        for (size_t i = 1; i < N; i++) {
+
+            if (fabs(y[i]) > fabs(y[j])) {
+                j = i;
+            }
+        }
+
+        if (iter && fabs(y[j]) <= dot(N, y, x)) {
+            break;
+        }
+
+        memset(x, 0, sizeof(double[N]));
+        x[j] = 1;
+    }
+
+    for (size_t i = 0; i < N; i++) {
+
+        x[i] = ((i % 2) ? -1 : 1)*(1 + (N > 1 ? (double)i/(N - 1) : 0));
+    }
+    lu_solve(N, lu, pivots, x);
+
+    double alt_norm = 0;
+    for (size_t i = 0; i < N; i++) {
+
+        alt_norm += fabs(x[i]);
+    }
+    alt_norm *= 2.0/(3*N);
+
+    free(x);
+    free(y);
+    return a_norm*((alt_norm > inv_norm) ? alt_norm : inv_norm);
 }
 
 
-// Computes the inverse of an N by N matrix, using Gaussian elimination
-// Returns 0 if OK, 1 if operation fails
+// Computes the inverse of an N by N matrix by solving for the columns of
+// the identity with lu_factor and lu_solve_many. Prefer those directly to
+// solve Ax = b, which takes about a third of the work of inverting.
+// Returns 0 if OK, 1 if the matrix is singular or memory runs out.
 int
 mat_inv(const size_t N, const double init_mat[static N*N],
         double inv[static N][N]) {
     
-    const size_t mat_size = sizeof(double[N*N]);
-    double* const mat = malloc(mat_size);
-
-    if (mat) {
+    double (*const lu)[N] = malloc(sizeof(double[N][N]));
+    size_t* const pivots = malloc(sizeof(size_t[N]));
+    if (!lu || !pivots) {
 
-        memcpy(mat, init_mat, mat_size);
+        free(lu);
+        free(pivots);
+        return 1;
+    }
 
-    } else {
+    memcpy(lu, init_mat, sizeof(double[N][N]));
+    if (lu_factor(N, lu, pivots)) {
 
+        free(lu);
+        free(pivots);
         return 1;
     }
 
@@ -106,42 +423,681 @@ mat_inv(const size_t N, const double init_mat[static N*N],
             inv[r][c] = (r == c);
         }
     }
-    
-    for (size_t c = 0; c < N; c++) {
-        
-        // Normalize the initial row
-        const double row_lead_inv = 1.0/mat[c*N + c];
 
-        if (fpclassify(row_lead_inv) == FP_INFINITE) {
+    lu_solve_many(N, N, lu, pivots, inv);
+
+    free(lu);
+    free(pivots);
+    return 0;
+}
+
+
+// Computes the GEMM_MR by GEMM_NR tile out = A B from kc columns of a
+// packed A panel and kc rows of a packed B panel, one element at a time
+void
+gemm_kernel_scalar(const size_t kc, const double a[static kc*GEMM_MR],
+                   const double b[static kc*GEMM_NR],
+                   double out[static GEMM_MR*GEMM_NR]) {
+
+    double acc[GEMM_MR][GEMM_NR] = {0};
+
+    for (size_t k = 0; k < kc; k++) {
+
+        for (size_t r = 0; r < GEMM_MR; r++) {
+
+            for (size_t c = 0; c < GEMM_NR; c++) {
+
+                acc[r][c] += a[k*GEMM_MR + r]*b[k*GEMM_NR + c];
+            }
+        }
+    }
+
+    memcpy(out, acc, sizeof(acc));
+}
+
+
+#ifdef GEMM_X86
+// gemm_kernel_scalar for CPUs with AVX2 and FMA. The tile lives in 12 of
+// the 16 ymm registers, and each step broadcasts one element of A against
+// two vectors of B.
+__attribute__((target("avx2,fma")))
+void
+gemm_kernel_avx2(const size_t kc, const double a[static kc*GEMM_MR],
+                 const double b[static kc*GEMM_NR],
+                 double out[static GEMM_MR*GEMM_NR]) {
+
+    Lanes acc[GEMM_MR][GEMM_NR/LANE_COUNT] = {0};
+
+    // The loops over the tile are fully unrolled so that acc stays in
+    // registers, which GCC does not do on its own at -O2
+    for (size_t k = 0; k < kc; k++) {
+
+        Lanes b_lanes[GEMM_NR/LANE_COUNT];
+
+        #pragma GCC unroll 8
+        for (size_t c = 0; c < GEMM_NR/LANE_COUNT; c++) {
+
+            memcpy(&b_lanes[c], &b[k*GEMM_NR + c*LANE_COUNT], sizeof(Lanes));
+        }
+
+        #pragma GCC unroll 8
+        for (size_t r = 0; r < GEMM_MR; r++) {
+
+            #pragma GCC unroll 8
+            for (size_t c = 0; c < GEMM_NR/LANE_COUNT; c++) {
+
+                acc[r][c] += a[k*GEMM_MR + r]*b_lanes[c];
+            }
+        }
+    }
+
+    for (size_t r = 0; r < GEMM_MR; r++) {
+
+        for (size_t c = 0; c < GEMM_NR/LANE_COUNT; c++) {
+
+            memcpy(&out[r*GEMM_NR + c*LANE_COUNT], &acc[r][c], sizeof(Lanes));
+        }
+    }
+}
+#endif
+
+
+// Returns the fastest micro kernel this CPU can run
+Gemm_Kernel*
+gemm_select_kernel(void) {
+
+#ifdef GEMM_X86
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+
+        return gemm_kernel_avx2;
+    }
+#endif
+
+    return gemm_kernel_scalar;
+}
+
+
+// Copies the mc by kc block of op(A) at (row, col) into panels of GEMM_MR
+// rows, each stored column by column, padding the last panel with zeros
+void
+gemm_pack_a(const bool trans, const double* a, const size_t lda,
+            const size_t row, const size_t col, const size_t mc,
+            const size_t kc, double packed[]) {
+
+    for (size_t panel = 0; panel < mc; panel += GEMM_MR) {
+
+        for (size_t k = 0; k < kc; k++) {
+
+            for (size_t r = 0; r < GEMM_MR; r++) {
+
+                const size_t i = row + panel + r;
+                const size_t j = col + k;
+
+                *packed++ = (panel + r >= mc) ? 0
+                            : trans ? a[j*lda + i] : a[i*lda + j];
+            }
+        }
+    }
+}
+
+
+// Copies the kc by nc block of op(B) at (row, col) into panels of GEMM_NR
+// columns, each stored row by row, padding the last panel with zeros
+void
+gemm_pack_b(const bool trans, const double* b, const size_t ldb,
+            const size_t row, const size_t col, const size_t kc,
+            const size_t nc, double packed[]) {
+
+    for (size_t panel = 0; panel < nc; panel += GEMM_NR) {
+
+        for (size_t k = 0; k < kc; k++) {
 
-            free(mat);
+            for (size_t c = 0; c < GEMM_NR; c++) {
+
+                const size_t i = row + k;
+                const size_t j = col + panel + c;
+
+                *packed++ = (panel + c >= nc) ? 0
+                            : trans ? b[j*ldb + i] : b[i*ldb + j];
+            }
+        }
+    }
+}
+
+
+// Computes C = alpha op(A) op(B) + beta C for the row major M by N matrix
+// C, where op(A) is M by K and op(B) is K by N, and op transposes its
+// operand if trans_a or trans_b is set. lda, ldb and ldc are the row
+// strides of the arrays as stored, so a transposed A is stored K by M.
+//
+// op(B) is packed GEMM_KC rows by GEMM_NC columns at a time to stay in the
+// last level cache, and op(A) GEMM_MC by GEMM_KC at a time to stay in L2.
+// The micro kernel then sweeps a GEMM_MR by GEMM_NR tile of C along kc,
+// reading both panels contiguously from L1 and keeping the tile in
+// registers. Returns 0 if OK, 1 if out of memory.
+int
+gemm(const bool trans_a, const bool trans_b, const size_t M, const size_t N,
+     const size_t K, const double alpha, const double* a, const size_t lda,
+     const double* b, const size_t ldb, const double beta, double* c,
+     const size_t ldc) {
+
+    for (size_t i = 0; i < M; i++) {
+
+        if (beta == 0) {
+
+            memset(&c[i*ldc], 0, N*sizeof(double));
+
+        } else if (beta != 1) {
+
+            mult_vec(N, &c[i*ldc], beta);
+        }
+    }
+
+    if (!M || !N || !K || alpha == 0) {
+        return 0;
+    }
+
+    double* packed_a = malloc(sizeof(double[GEMM_MC*GEMM_KC]));
+    double* packed_b = malloc(sizeof(double[GEMM_KC*GEMM_NC]));
+    if (!packed_a || !packed_b) {
+
+        free(packed_a);
+        free(packed_b);
+        return 1;
+    }
+
+    Gemm_Kernel* const kernel = gemm_select_kernel();
+    double tile[GEMM_MR*GEMM_NR];
+
+    for (size_t jc = 0; jc < N; jc += GEMM_NC) {
+
+        const size_t nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+
+        for (size_t pc = 0; pc < K; pc += GEMM_KC) {
+
+            const size_t kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+            gemm_pack_b(trans_b, b, ldb, pc, jc, kc, nc, packed_b);
+
+            for (size_t ic = 0; ic < M; ic += GEMM_MC) {
+
+                const size_t mc = (M - ic < GEMM_MC) ? M - ic : GEMM_MC;
+                gemm_pack_a(trans_a, a, lda, ic, pc, mc, kc, packed_a);
+
+                for (size_t jr = 0; jr < nc; jr += GEMM_NR) {
+
+                    const size_t nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+
+                    for (size_t ir = 0; ir < mc; ir += GEMM_MR) {
+
+                        const size_t mr = (mc - ir < GEMM_MR)
+                                          ? mc - ir : GEMM_MR;
+                        kernel(kc, &packed_a[ir*kc], &packed_b[jr*kc], tile);
+
+                        for (size_t r = 0; r < mr; r++) {
+
+                            addmult_vec(nr, &c[(ic + ir + r)*ldc + jc + jr],
+                                        &tile[r*GEMM_NR], alpha);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    free(packed_a);
+    free(packed_b);
+    return 0;
+}
+
+
+// Returns the largest absolute difference between the M by N matrices x
+// and y
+double
+max_diff(const size_t M, const size_t N, const double x[static M*N],
+         const double y[static M*N]) {
+
+    double diff = 0;
+
+    for (size_t i = 0; i < M*N; i++) {
+
+        if (fabs(x[i] - y[i]) > diff) {
+            diff = fabs(x[i] - y[i]);
+        }
+    }
+
+    return diff;
+}
+
+
+// Times GEMM_MR*GEMM_NR/LANE_COUNT independent chains of multiply-adds on
+// T, as many as the micro kernel keeps in registers, so that the FMA units
+// never wait on a result. Returns the rate in flop/s, the peak one core
+// can reach with the instructions the kernel of the same name uses.
+#define DEFINE_GEMM_PEAK(T, S, ATTR)                                       \
+                                                                           \
+ATTR double                                                                \
+gemm_peak_##S(void) {                                                      \
+                                                                           \
+    T acc[GEMM_MR*GEMM_NR/LANE_COUNT] = {0};                               \
+                                                                           \
+    const clock_t begin = clock();                                         \
+    for (size_t i = 0; i < GEMM_PEAK_ITERATIONS; i++) {                    \
+                                                                           \
+        _Pragma("GCC unroll 12")                                           \
+        for (size_t r = 0; r < GEMM_MR*GEMM_NR/LANE_COUNT; r++) {          \
+                                                                           \
+            acc[r] = acc[r]*0.5 + 1;                                       \
+        }                                                                  \
+    }                                                                      \
+    const double seconds = (double)(clock() - begin)/CLOCKS_PER_SEC;       \
+                                                                           \
+    /* Keeps the loop from being optimized away */                         \
+    volatile T sink = acc[0];                                              \
+    for (size_t r = 1; r < GEMM_MR*GEMM_NR/LANE_COUNT; r++) {              \
+                                                                           \
+        sink = acc[r];                                                     \
+    }                                                                      \
+    (void)sink;                                                            \
+                                                                           \
+    return 2.0*GEMM_PEAK_ITERATIONS*sizeof(acc)/sizeof(double)/seconds;    \
+}
+
+DEFINE_GEMM_PEAK(double, scalar, )
+#ifdef GEMM_X86
+DEFINE_GEMM_PEAK(Lanes, avx2, __attribute__((target("avx2,fma"))))
+#endif
+
+
+// Times N by N by N products with gemm for each of the count sizes, and
+// reports each as a fraction of the peak rate of the selected micro
+// kernel. The rates are only meaningful in an optimized build without the
+// sanitizers, e.g. make CFLAGS=-O2. Returns 0 on success.
+int
+bench_gemm_sizes(const size_t count, const size_t sizes[static count]) {
+
+    const bool avx2 = gemm_select_kernel() != gemm_kernel_scalar;
+#ifdef GEMM_X86
+    const double peak = avx2 ? gemm_peak_avx2() : gemm_peak_scalar();
+#else
+    const double peak = gemm_peak_scalar();
+#endif
+
+    printf("gemm on %s, peak %.2f Gflop/s on one core:\n",
+           avx2 ? "AVX2 and FMA" : "scalar code", peak*1e-9);
+
+    srand(3);
+    for (size_t s = 0; s < count; s++) {
+
+        const size_t N = sizes[s];
+        double* a = malloc(sizeof(double[N*N]));
+        double* b = malloc(sizeof(double[N*N]));
+        double* c = malloc(sizeof(double[N*N]));
+        int failed = !a || !b || !c;
+
+        if (!failed) {
+
+            for (size_t i = 0; i < N*N; i++) {
+
+                a[i] = 2.0*rand()/RAND_MAX - 1;
+                b[i] = 2.0*rand()/RAND_MAX - 1;
+            }
+
+            const clock_t begin = clock();
+            failed = gemm(false, false, N, N, N, 1, a, N, b, N, 0, c, N);
+            const double seconds = (double)(clock() - begin)/CLOCKS_PER_SEC;
+            const double rate = 2.0*N*N*N/seconds;
+
+            if (!failed) {
+
+                printf("    %zu by %zu product: %.2f s, %.2f Gflop/s, "
+                       "%.0f%% of peak\n", N, N, seconds, rate*1e-9,
+                       100*rate/peak);
+            }
+        }
+
+        free(a);
+        free(b);
+        free(c);
+        if (failed) {
             return 1;
         }
-    
-        mult_vec(N, mat + c*N, row_lead_inv);
-        mult_vec(N, inv[c], row_lead_inv);
+    }
+
+    return 0;
+}
+
+
+// Checks gemm with each combination of transposed operands against the
+// plain triple loop on an awkwardly sized product, then times it against
+// building A B one column at a time with matvec_mult. Returns 0 on
+// success.
+int
+bench_gemm(void) {
+
+    const size_t N = GEMM_BENCH_LEN;
+    double* a = malloc(sizeof(double[N*N]));
+    double* b = malloc(sizeof(double[N*N]));
+    double* c = malloc(sizeof(double[N*N]));
+    double* ref = malloc(sizeof(double[N*N]));
+    double* col = malloc(sizeof(double[N]));
+    double* out = malloc(sizeof(double[N]));
+    int failed = !a || !b || !c || !ref || !col || !out;
+
+    if (!failed) {
+
+        srand(3);
+        for (size_t i = 0; i < N*N; i++) {
+
+            a[i] = 2.0*rand()/RAND_MAX - 1;
+            b[i] = 2.0*rand()/RAND_MAX - 1;
+            c[i] = 2.0*rand()/RAND_MAX - 1;
+        }
+
+        printf("gemm on %s:\n",
+               (gemm_select_kernel() == gemm_kernel_scalar) ? "scalar code"
+               : "AVX2 and FMA");
+
+        const size_t m = 37;
+        const size_t n = 53;
+        const size_t k = 29;
+
+        for (int trans = 0; trans < 4 && !failed; trans++) {
+
+            const bool trans_a = trans & 1;
+            const bool trans_b = trans & 2;
+            const size_t lda = trans_a ? m : k;
+            const size_t ldb = trans_b ? k : n;
+
+            for (size_t i = 0; i < m; i++) {
+
+                for (size_t j = 0; j < n; j++) {
+
+                    double sum = 0;
+                    for (size_t l = 0; l < k; l++) {
+
+                        sum += (trans_a ? a[l*lda + i] : a[i*lda + l])
+                               *(trans_b ? b[j*ldb + l] : b[l*ldb + j]);
+                    }
+                    ref[i*n + j] = 1.5*sum + 0.5*c[i*n + j];
+                }
+            }
+
+            failed = gemm(trans_a, trans_b, m, n, k, 1.5, a, lda, b, ldb,
+                          0.5, c, n);
+            printf("    op(A) = A%s, op(B) = B%s: %zu by %zu by %zu, "
+                   "max error %.1e\n", trans_a ? "^T" : "",
+                   trans_b ? "^T" : "", m, n, k, max_diff(m, n, c, ref));
+        }
+
+        clock_t begin = clock();
+        for (size_t j = 0; j < N && !failed; j++) {
+
+            for (size_t i = 0; i < N; i++) {
+
+                col[i] = b[i*N + j];
+            }
+
+            matvec_mult(N, N, (const double (*)[N])a, col, out);
+            for (size_t i = 0; i < N; i++) {
+
+                ref[i*N + j] = out[i];
+            }
+        }
+        const double matvec_seconds = (double)(clock() - begin)
+                                      /CLOCKS_PER_SEC;
+
+        begin = clock();
+        failed = failed || gemm(false, false, N, N, N, 1, a, N, b, N, 0, c,
+                                N);
+        const double gemm_seconds = (double)(clock() - begin)/CLOCKS_PER_SEC;
+
+        if (!failed) {
+
+            printf("    %zu by %zu product: matvec_mult %.2f s (%.2f Gflop/s), "
+                   "gemm %.2f s (%.2f Gflop/s), max difference %.1e\n", N, N,
+                   matvec_seconds, 2.0*N*N*N/matvec_seconds*1e-9,
+                   gemm_seconds, 2.0*N*N*N/gemm_seconds*1e-9,
+                   max_diff(N, N, c, ref));
+        }
+    }
+
+    free(a);
+    free(b);
+    free(c);
+    free(ref);
+    free(col);
+    free(out);
+    return failed;
+}
+
+
+// Times dot in type T over the vectors x and y and compares the result to
+// exact, their dot product in the widest type available
+#define DEFINE_DOT_BENCH(T, S)                                             \
+                                                                           \
+int                                                                        \
+bench_dot_##S(const char* name, const size_t n, const double x[static n], \
+              const double y[static n], const Exact_Float exact) {         \
+                                                                           \
+    T* a = malloc(sizeof(T[n]));                                           \
+    T* b = malloc(sizeof(T[n]));                                           \
+    if (!a || !b) {                                                        \
+                                                                           \
+        free(a);                                                           \
+        free(b);                                                           \
+        return 1;                                                          \
+    }                                                                      \
+                                                                           \
+    for (size_t i = 0; i < n; i++) {                                       \
+                                                                           \
+        a[i] = x[i];                                                       \
+        b[i] = y[i];                                                       \
+    }                                                                      \
+                                                                           \
+    T result = 0;                                                          \
+    const clock_t begin = clock();                                         \
+    for (size_t r = 0; r < BENCH_REPS; r++) {                              \
+                                                                           \
+        result = dot(n, a, b);                                             \
+    }                                                                      \
+    const double seconds = (double)(clock() - begin)/CLOCKS_PER_SEC;       \
+                                                                           \
+    const Exact_Float diff = (Exact_Float)result - exact;                  \
+    printf("%-12s %2zu bytes: %8.1f Mflop/s, relative error %.1e\n",      \
+           name, sizeof(T), 2.0*n*BENCH_REPS/seconds*1e-6,                 \
+           (double)((diff < 0 ? -diff : diff)/exact));                     \
+                                                                           \
+    free(a);                                                               \
+    free(b);                                                               \
+    return 0;                                                              \
+}
+
+DEFINE_DOT_BENCH(float, f)
+DEFINE_DOT_BENCH(double, d)
+DEFINE_DOT_BENCH(long double, ld)
+#ifdef HAVE_FLOAT128
+DEFINE_DOT_BENCH(float128, q)
+#endif
+
+
+// Compares speed and accuracy of dot across the floating point types on
+// random vectors. Everything is rounded to double first, so the inputs are
+// identical and only the arithmetic differs.
+int
+bench_dot(void) {
+
+    double* x = malloc(sizeof(double[BENCH_LEN]));
+    double* y = malloc(sizeof(double[BENCH_LEN]));
+    if (!x || !y) {
 
+        free(x);
+        free(y);
+        return 1;
+    }
+
+    srand(1);
+    Exact_Float exact = 0;
+    for (size_t i = 0; i < BENCH_LEN; i++) {
+
+        x[i] = 2.0*rand()/RAND_MAX - 1;
+        y[i] = 2.0*rand()/RAND_MAX - 1;
+        exact += (Exact_Float)x[i]*y[i];
+    }
+
+    printf("dot of length %d:\n", BENCH_LEN);
+    int failed = bench_dot_f("float", BENCH_LEN, x, y, exact)
+                 || bench_dot_d("double", BENCH_LEN, x, y, exact)
+                 || bench_dot_ld("long double", BENCH_LEN, x, y, exact);
+#ifdef HAVE_FLOAT128
+    failed = failed || bench_dot_q("__float128", BENCH_LEN, x, y, exact);
+#endif
+
+    free(x);
+    free(y);
+    return failed;
+}
+
+
+// Solves a random SOLVE_LEN by SOLVE_LEN system through the LU factors
+// and through the explicit inverse, comparing times and the relative
+// residuals ||Ax - b||/(||A|| ||x||). Also checks lu_cond against the
+// condition number computed from the inverse. Returns 0 on success.
+int
+bench_solve(void) {
+
+    const size_t N = SOLVE_LEN;
+    double (*a)[N] = malloc(sizeof(double[N][N]));
+    double (*lu)[N] = malloc(sizeof(double[N][N]));
+    double (*inv)[N] = malloc(sizeof(double[N][N]));
+    size_t* pivots = malloc(sizeof(size_t[N]));
+    double* b = malloc(sizeof(double[N]));
+    double* x_lu = malloc(sizeof(double[N]));
+    double* x_inv = malloc(sizeof(double[N]));
+    double* residual = malloc(sizeof(double[N]));
+    int failed = !a || !lu || !inv || !pivots || !b || !x_lu || !x_inv
+                 || !residual;
+
+    if (!failed) {
+
+        srand(2);
         for (size_t r = 0; r < N; r++) {
-            
-            if (r == c) {
-                continue;
+
+            for (size_t c = 0; c < N; c++) {
+
+                a[r][c] = 2.0*rand()/RAND_MAX - 1;
             }
-            
-            // Cancel out element c in other rows
-            const double mult_inv = -mat[r*N + c];
+            b[r] = 2.0*rand()/RAND_MAX - 1;
+        }
+
+        const double a_norm = mat_norm1(N, a);
+
+        clock_t begin = clock();
+        memcpy(lu, a, sizeof(double[N][N]));
+        memcpy(x_lu, b, sizeof(double[N]));
+        failed = lu_factor(N, lu, pivots);
+        if (!failed) {
+            lu_solve(N, lu, pivots, x_lu);
+        }
+        const double lu_seconds = (double)(clock() - begin)/CLOCKS_PER_SEC;
 
-            addmult_vec(N, mat + r*N, mat + c*N, mult_inv);
-            addmult_vec(N, inv[r], inv[c], mult_inv);
+        begin = clock();
+        failed = failed || mat_inv(N, (const double*)a, inv);
+        if (!failed) {
+            matvec_mult(N, N, (const double (*)[N])inv, b, x_inv);
+        }
+        const double inv_seconds = (double)(clock() - begin)/CLOCKS_PER_SEC;
+
+        if (!failed) {
+
+            printf("Solving a random %zu by %zu system:\n", N, N);
+
+            const double* xs[2] = {x_lu, x_inv};
+            const double seconds[2] = {lu_seconds, inv_seconds};
+            const char* names[2] = {"LU", "inverse"};
+
+            for (size_t m = 0; m < 2; m++) {
+
+                matvec_mult(N, N, (const double (*)[N])a, xs[m],
+                            residual);
+                double residual_norm = 0;
+                double x_norm = 0;
+                for (size_t i = 0; i < N; i++) {
+
+                    residual_norm += fabs(residual[i] - b[i]);
+                    x_norm += fabs(xs[m][i]);
+                }
+
+                printf("    %-8s %.3f s, relative residual %.1e\n",
+                       names[m], seconds[m],
+                       residual_norm/(a_norm*x_norm));
+            }
+
+            printf("    condition number %.4g, estimated %.4g\n",
+                   a_norm*mat_norm1(N, inv), lu_cond(N, a_norm, lu, pivots));
         }
     }
 
-    free(mat);
-    return 0;
+    free(a);
+    free(lu);
+    free(inv);
+    free(pivots);
+    free(b);
+    free(x_lu);
+    free(x_inv);
+    free(residual);
+    return failed;
 }
 
 
 int
-main() {
+main(int argc, char* argv[static argc]) {
+
+    // -g only times gemm, at the given sizes or at 1000, 2000 and 4000
+    if (argc > 1) {
+
+        size_t sizes[] = {1000, 2000, 4000};
+        size_t count = sizeof(sizes)/sizeof(sizes[0]);
+        size_t* given = NULL;
+
+        if (strcmp(argv[1], "-g")) {
+
+            printf(USAGE);
+            return EXIT_FAILURE;
+        }
+
+        if (argc > 2) {
+
+            count = argc - 2;
+            given = malloc(sizeof(size_t[count]));
+            if (!given) {
+
+                fprintf(stderr, "Failed to allocate memory.\n");
+                return EXIT_FAILURE;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+
+                char* end = NULL;
+                given[i] = strtoull(argv[i + 2], &end, 10);
+                if (*end || !given[i] || given[i] > GEMM_MAX_BENCH_LEN) {
+
+                    free(given);
+                    printf(USAGE);
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+
+        const int failed = bench_gemm_sizes(count, given ? given : sizes);
+        free(given);
+        if (failed) {
+
+            fprintf(stderr, "Failed to allocate memory.\n");
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
 
     #define LEN 5
     #define MAT_R 4
@@ -167,12 +1123,21 @@ main() {
         {3, -4, -2},
         {-1, 3,  5}
     };
+    const double M3[3][3] = {
+        {0, 2, 1},
+        {1, 1, 1},
+        {2, 1, 0}
+    };
+    const double b3[3] = {7, 6, 4};
 
     double MA[MAT_R] = {0};
     double MB[MAT_R] = {0};
     double IM_inv[LEN][LEN] = {0};
     double M2_inv[3][3] = {0};
     double M2_inv_inv[3][3] = {0};
+    double M3_lu[3][3] = {0};
+    double x3[3] = {0};
+    size_t pivots3[3] = {0};
     
     matvec_mult(MAT_R, MAT_C, M, A, MA);
     matvec_mult(MAT_R, MAT_C, M, B, MB);
@@ -180,6 +1145,15 @@ main() {
     mat_inv(3, (const double *)M2, M2_inv);
     mat_inv(3, (const double *)M2_inv, M2_inv_inv);
 
+    // M3 needs a row swap before its first column can be eliminated
+    memcpy(M3_lu, M3, sizeof(M3));
+    memcpy(x3, b3, sizeof(b3));
+    const double M3_norm = mat_norm1(3, M3_lu);
+    const int M3_singular = lu_factor(3, M3_lu, pivots3);
+    if (!M3_singular) {
+        lu_solve(3, M3_lu, pivots3, x3);
+    }
+
     printf("A = [");
     print_vec(LEN, A);
     printf("]\n");
@@ -240,5 +1214,37 @@ main() {
     }
     printf("]\n\n");
 
+    printf("M3 = [\n");
+    for (size_t r = 0; r < 3; r++) {
+        print_vec(3, M3[r]);
+        printf("\n");
+    }
+    printf("]\n\n");
+
+    if (M3_singular) {
+
+        printf("M3 is singular\n\n");
+
+    } else {
+
+        printf("b3 = [");
+        print_vec(3, b3);
+        printf("]\n");
+
+        printf("M3 x = b3 for x = [");
+        print_vec(3, x3);
+        printf("]\n");
+
+        printf("det(M3) = %f, cond(M3) ~ %f\n\n",
+               lu_det(3, M3_lu, pivots3),
+               lu_cond(3, M3_norm, M3_lu, pivots3));
+    }
+
+    if (bench_dot() || bench_solve() || bench_gemm()) {
+
+        fprintf(stderr, "Failed to allocate memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
     exit(EXIT_SUCCESS);
 }